@@ -0,0 +1,139 @@
+/** Minimal wrapper around the bpf(2) system call.
+ *
+ * We do not depend on libbpf. Maps and programs are created directly via bpf(2).
+ *
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/syscall.h>
+
+#include "bpf.h"
+
+static int bpf(int cmd, union bpf_attr *attr)
+{
+#ifdef __NR_bpf
+	return syscall(__NR_bpf, cmd, attr, sizeof(union bpf_attr));
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+void bpf_patch(struct bpf_insn *insns, unsigned len, int label, unsigned target)
+{
+	for (unsigned i = 0; i < len; i++) {
+		if (BPF_CLASS(insns[i].code) == BPF_JMP && insns[i].off == BPF_LABEL(label))
+			insns[i].off = target - i - 1;
+	}
+}
+
+int bpf_map_create(enum bpf_map_type type, unsigned key_size, unsigned value_size, unsigned max_entries)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+
+	attr.map_type = type;
+	attr.key_size = key_size;
+	attr.value_size = value_size;
+	attr.max_entries = max_entries;
+
+	return bpf(BPF_MAP_CREATE, &attr);
+}
+
+int bpf_map_update(int fd, const void *key, const void *value)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+
+	attr.map_fd = fd;
+	attr.key = (uintptr_t) key;
+	attr.value = (uintptr_t) value;
+	attr.flags = BPF_ANY;
+
+	return bpf(BPF_MAP_UPDATE_ELEM, &attr);
+}
+
+int bpf_map_lookup(int fd, const void *key, void *value)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+
+	attr.map_fd = fd;
+	attr.key = (uintptr_t) key;
+	attr.value = (uintptr_t) value;
+
+	return bpf(BPF_MAP_LOOKUP_ELEM, &attr);
+}
+
+int bpf_num_cpus(void)
+{
+	int first, last, ret;
+	FILE *f;
+
+	/* Format: "0-N" or "0" */
+	f = fopen("/sys/devices/system/cpu/possible", "r");
+	if (!f)
+		return sysconf(_SC_NPROCESSORS_CONF);
+
+	ret = fscanf(f, "%d-%d", &first, &last);
+	fclose(f);
+
+	if (ret == 1)
+		return first + 1;
+	else if (ret == 2)
+		return last + 1;
+
+	return sysconf(_SC_NPROCESSORS_CONF);
+}
+
+int bpf_prog_load(enum bpf_prog_type type, const struct bpf_insn *insns, unsigned len, char *log, size_t loglen)
+{
+	int fd;
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+
+	attr.prog_type = type;
+	attr.insns = (uintptr_t) insns;
+	attr.insn_cnt = len;
+	attr.license = (uintptr_t) "GPL";
+
+	fd = bpf(BPF_PROG_LOAD, &attr);
+	if (fd >= 0 || !log)
+		return fd;
+
+	/* Try again to get the reason from the verifier */
+	log[0] = '\0';
+
+	attr.log_buf = (uintptr_t) log;
+	attr.log_size = loglen;
+	attr.log_level = 1;
+
+	return bpf(BPF_PROG_LOAD, &attr);
+}
+
+int bpf_xdp_attach(int prog, int ifindex, unsigned flags)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+
+	attr.link_create.prog_fd = prog;
+	attr.link_create.target_ifindex = ifindex;
+	attr.link_create.attach_type = BPF_XDP;
+	attr.link_create.flags = flags;
+
+	return bpf(BPF_LINK_CREATE, &attr);
+}
@@ -0,0 +1,79 @@
+/** Minimal wrapper around the bpf(2) system call.
+ *
+ * The programs are assembled from the instruction macros below.
+ * Their names follow the ones used by the Kernel sources.
+ *
+ * @file
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#ifndef _BPF_H_
+#define _BPF_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <linux/bpf.h>
+
+#define BPF_INSN(c, d, s, o, i)		((struct bpf_insn) { .code = (c), .dst_reg = (d), .src_reg = (s), .off = (o), .imm = (i) })
+
+#define BPF_MOV64_REG(d, s)		BPF_INSN(BPF_ALU64 | BPF_MOV | BPF_X, d, s, 0, 0)
+#define BPF_MOV64_IMM(d, i)		BPF_INSN(BPF_ALU64 | BPF_MOV | BPF_K, d, 0, 0, i)
+#define BPF_ALU64_IMM(op, d, i)		BPF_INSN(BPF_ALU64 | (op) | BPF_K, d, 0, 0, i)
+#define BPF_ALU64_REG(op, d, s)		BPF_INSN(BPF_ALU64 | (op) | BPF_X, d, s, 0, 0)
+#define BPF_ENDIAN(type, d, len)	BPF_INSN(BPF_ALU | BPF_END | (type), d, 0, 0, len)
+
+#define BPF_LDX_MEM(sz, d, s, o)	BPF_INSN(BPF_LDX | (sz) | BPF_MEM, d, s, o, 0)
+#define BPF_STX_MEM(sz, d, s, o)	BPF_INSN(BPF_STX | (sz) | BPF_MEM, d, s, o, 0)
+#define BPF_ST_MEM(sz, d, o, i)		BPF_INSN(BPF_ST  | (sz) | BPF_MEM, d, 0, o, i)
+
+#define BPF_JMP_IMM(op, d, i, o)	BPF_INSN(BPF_JMP | (op) | BPF_K, d, 0, o, i)
+#define BPF_JMP_REG(op, d, s, o)	BPF_INSN(BPF_JMP | (op) | BPF_X, d, s, o, 0)
+#define BPF_JMP_A(o)			BPF_INSN(BPF_JMP | BPF_JA, 0, 0, o, 0)
+
+/** Load the file descriptor of a map (takes two instructions). */
+#define BPF_LD_MAP_FD(d, fd)		BPF_INSN(BPF_LD | BPF_DW | BPF_IMM, d, BPF_PSEUDO_MAP_FD, 0, fd), \
+					BPF_INSN(0, 0, 0, 0, 0)
+
+#define BPF_EMIT_CALL(f)		BPF_INSN(BPF_JMP | BPF_CALL, 0, 0, 0, f)
+#define BPF_EXIT_INSN()			BPF_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+
+/** Jump offset which is replaced by the offset to a label by bpf_patch(). */
+#define BPF_LABEL(n)			(0x7F00 + (n))
+
+/** Replace all jump offsets BPF_LABEL(label) by the offset to the instruction at index target. */
+void bpf_patch(struct bpf_insn *insns, unsigned len, int label, unsigned target);
+
+int bpf_map_create(enum bpf_map_type type, unsigned key_size, unsigned value_size, unsigned max_entries);
+
+int bpf_map_update(int fd, const void *key, const void *value);
+
+/** Look up an element of a map.
+ *
+ * Per-CPU maps return one value for each possible CPU (see bpf_num_cpus()),
+ * each padded to a multiple of 8 bytes.
+ */
+int bpf_map_lookup(int fd, const void *key, void *value);
+
+/** The number of possible CPUs which determines the size of the values of per-CPU maps. */
+int bpf_num_cpus(void);
+
+/** Load a program into the Kernel.
+ *
+ * @param log A buffer for the messages of the verifier or NULL.
+ * @return The file descriptor of the program or -1.
+ */
+int bpf_prog_load(enum bpf_prog_type type, const struct bpf_insn *insns, unsigned len, char *log, size_t loglen);
+
+/** Attach an XDP program to an interface.
+ *
+ * The program is detached once the returned link is closed.
+ *
+ * @param flags XDP_FLAGS_SKB_MODE for generic XDP or XDP_FLAGS_DRV_MODE.
+ * @return The file descriptor of the BPF link or -1.
+ */
+int bpf_xdp_attach(int prog, int ifindex, unsigned flags);
+
+#endif /* _BPF_H_ */
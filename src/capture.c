@@ -0,0 +1,380 @@
+/** Reader for packet captures in the pcap and pcapng format.
+ *
+ * The whole file is mapped into memory and walked record by record.
+ * Packets are never copied. Hence many cursors can share a single mapping.
+ *
+ * See: https://wiki.wireshark.org/Development/LibpcapFileFormat
+ *      https://datatracker.ietf.org/doc/draft-ietf-opsawg-pcapng/
+ *
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <byteswap.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "capture.h"
+
+#define PCAP_MAGIC		0xA1B2C3D4
+#define PCAP_MAGIC_NSEC		0xA1B23C4D
+
+#define PCAPNG_SHB		0x0A0D0D0A
+#define PCAPNG_IDB		0x00000001
+#define PCAPNG_OPB		0x00000002
+#define PCAPNG_EPB		0x00000006
+#define PCAPNG_BOM		0x1A2B3C4D
+
+#define PCAPNG_OPT_END		0
+#define PCAPNG_OPT_TSRESOL	9
+
+/* Link types (see pcap-linktype(7)) */
+#define LINKTYPE_NULL		0
+#define LINKTYPE_ETHERNET	1
+#define LINKTYPE_RAW_OLD	12
+#define LINKTYPE_RAW_BSD	14
+#define LINKTYPE_RAW		101
+#define LINKTYPE_LOOP		108
+#define LINKTYPE_LINUX_SLL	113
+#define LINKTYPE_IPV4		228
+#define LINKTYPE_LINUX_SLL2	276
+
+static uint16_t capture_u16(const struct capture_cursor *k, const uint8_t *p)
+{
+	uint16_t v;
+
+	memcpy(&v, p, sizeof(v));
+
+	return k->swapped ? bswap_16(v) : v;
+}
+
+static uint32_t capture_u32(const struct capture_cursor *k, const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+
+	return k->swapped ? bswap_32(v) : v;
+}
+
+/** Network byte order fields of the link layer headers. */
+static uint16_t capture_be16(const uint8_t *p)
+{
+	return p[0] << 8 | p[1];
+}
+
+static struct timespec capture_ts(uint64_t secs, uint64_t frac, uint64_t units)
+{
+	struct timespec ts = {
+		.tv_sec = secs,
+		.tv_nsec = units == 1000000000 ? frac : frac * 1e9 / units
+	};
+
+	return ts;
+}
+
+/** Skip the link layer header of a packet.
+ *
+ * @retval 0 The packet is an IPv4 packet.
+ */
+static int capture_link(uint16_t linktype, struct capture_packet *p)
+{
+	unsigned hdrlen;
+	uint32_t family;
+
+	switch (linktype) {
+		case LINKTYPE_ETHERNET:
+			hdrlen = 14;
+			if (p->len < hdrlen)
+				return -1;
+
+			/* 802.1Q and 802.1ad tags */
+			while (capture_be16(p->data + hdrlen - 2) == 0x8100 || capture_be16(p->data + hdrlen - 2) == 0x88A8) {
+				hdrlen += 4;
+				if (p->len < hdrlen)
+					return -1;
+			}
+
+			if (capture_be16(p->data + hdrlen - 2) != 0x0800)
+				return -1;
+			break;
+
+		case LINKTYPE_LINUX_SLL:
+			hdrlen = 16;
+			if (p->len < hdrlen || capture_be16(p->data + 14) != 0x0800)
+				return -1;
+			break;
+
+		case LINKTYPE_LINUX_SLL2:
+			hdrlen = 20;
+			if (p->len < hdrlen || capture_be16(p->data) != 0x0800)
+				return -1;
+			break;
+
+		case LINKTYPE_NULL:
+		case LINKTYPE_LOOP:
+			/* AF_INET in the byte order of the capturing host */
+			hdrlen = 4;
+			if (p->len < hdrlen)
+				return -1;
+
+			memcpy(&family, p->data, sizeof(family));
+			if (family != 2 && family != bswap_32(2))
+				return -1;
+			break;
+
+		case LINKTYPE_RAW_OLD:
+		case LINKTYPE_RAW_BSD:
+		case LINKTYPE_RAW:
+		case LINKTYPE_IPV4:
+			hdrlen = 0;
+			break;
+
+		default:
+			return -1;
+	}
+
+	p->data += hdrlen;
+	p->len -= hdrlen;
+
+	return p->len >= 20 && p->data[0] >> 4 == 4 ? 0 : -1;
+}
+
+int capture_open(struct capture *c, const char *path)
+{
+	int fd;
+	struct stat st;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st))
+		goto fail;
+
+	c->len = st.st_size;
+	c->map = mmap(NULL, c->len, PROT_READ, MAP_SHARED, fd, 0);
+	if (c->map == MAP_FAILED)
+		goto fail;
+
+	/* The mapping keeps the file open */
+	close(fd);
+
+	/* The advice is a single value, not a set of flags. Read ahead, but do not load the whole capture at once */
+	madvise((void *) c->map, c->len, MADV_SEQUENTIAL);
+
+	return 0;
+
+fail:	close(fd);
+
+	return -1;
+}
+
+void capture_close(struct capture *c)
+{
+	munmap((void *) c->map, c->len);
+}
+
+int capture_cursor_init(struct capture_cursor *k, const struct capture *c)
+{
+	uint32_t magic;
+
+	memset(k, 0, sizeof(struct capture_cursor));
+
+	k->capture = c;
+
+	if (c->len < 24)
+		return -1;
+
+	memcpy(&magic, c->map, sizeof(magic));
+
+	if (magic == PCAPNG_SHB) {
+		/* The sections are parsed by capture_next() */
+		k->format = CAPTURE_PCAPNG;
+
+		return 0;
+	}
+
+	k->format = CAPTURE_PCAP;
+	k->swapped = magic == bswap_32(PCAP_MAGIC) || magic == bswap_32(PCAP_MAGIC_NSEC);
+
+	magic = capture_u32(k, c->map);
+	if (magic != PCAP_MAGIC && magic != PCAP_MAGIC_NSEC)
+		return -1;
+
+	/* The upper bits of the link type carry the FCS length */
+	k->ifaces[0].linktype = capture_u32(k, c->map + 20);
+	k->ifaces[0].units = magic == PCAP_MAGIC_NSEC ? 1000000000 : 1000000;
+	k->nifaces = 1;
+	k->offset = 24;
+
+	return 0;
+}
+
+static int capture_next_pcap(struct capture_cursor *k, struct capture_packet *p)
+{
+	const struct capture *c = k->capture;
+
+	while (k->offset < c->len) {
+		const uint8_t *rec = c->map + k->offset;
+
+		if (c->len - k->offset < 16)
+			return -1;
+
+		uint32_t caplen = capture_u32(k, rec + 8);
+		if (caplen > c->len - k->offset - 16)
+			return -1;
+
+		k->offset += 16 + caplen;
+
+		p->data = rec + 16;
+		p->len = caplen;
+
+		if (capture_link(k->ifaces[0].linktype, p))
+			continue;
+
+		p->ts = capture_ts(capture_u32(k, rec), capture_u32(k, rec + 4), k->ifaces[0].units);
+
+		return 1;
+	}
+
+	return 0;
+}
+
+/** Start a new section and forget its interfaces. */
+static int capture_shb(struct capture_cursor *k, const uint8_t *blk, uint32_t len)
+{
+	uint32_t bom;
+
+	if (len < 28)
+		return -1;
+
+	memcpy(&bom, blk + 8, sizeof(bom));
+	if (bom != PCAPNG_BOM && bom != bswap_32(PCAPNG_BOM))
+		return -1;
+
+	k->swapped = bom != PCAPNG_BOM;
+	k->nifaces = 0;
+
+	return 0;
+}
+
+static void capture_idb(struct capture_cursor *k, const uint8_t *blk, uint32_t len)
+{
+	const uint8_t *opt, *end = blk + len - 4;
+
+	if (k->nifaces == CAPTURE_MAX_IFACES || len < 20)
+		return;
+
+	k->ifaces[k->nifaces].linktype = capture_u16(k, blk + 8);
+	k->ifaces[k->nifaces].units = 1000000;
+
+	for (opt = blk + 16; opt + 4 <= end;) {
+		uint16_t code = capture_u16(k, opt);
+		uint16_t optlen = capture_u16(k, opt + 2);
+
+		if (code == PCAPNG_OPT_END || opt + 4 + optlen > end)
+			break;
+
+		if (code == PCAPNG_OPT_TSRESOL && optlen >= 1) {
+			uint8_t res = opt[4], exp = res & 0x7F;
+			uint64_t units = 1;
+
+			/* Powers of two or ten */
+			while (exp--)
+				units *= res & 0x80 ? 2 : 10;
+
+			k->ifaces[k->nifaces].units = units;
+		}
+
+		opt += 4 + ((optlen + 3) & ~3);
+	}
+
+	k->nifaces++;
+}
+
+static int capture_next_pcapng(struct capture_cursor *k, struct capture_packet *p)
+{
+	const struct capture *c = k->capture;
+
+	while (k->offset < c->len) {
+		const uint8_t *blk = c->map + k->offset;
+		uint32_t type, len, iface, caplen;
+		const uint8_t *hdr;
+
+		if (c->len - k->offset < 12)
+			return -1;
+
+		memcpy(&type, blk, sizeof(type));
+
+		/* The byte order of a section is only known after its header */
+		if (type == PCAPNG_SHB && capture_shb(k, blk, c->len - k->offset))
+			return -1;
+
+		type = capture_u32(k, blk);
+		len = capture_u32(k, blk + 4);
+
+		if (len < 12 || len % 4 || len > c->len - k->offset)
+			return -1;
+
+		k->offset += len;
+
+		switch (type) {
+			case PCAPNG_IDB:
+				capture_idb(k, blk, len);
+				continue;
+
+			case PCAPNG_EPB:
+				if (len < 32)
+					return -1;
+
+				iface = capture_u32(k, blk + 8);
+				hdr = blk + 12;
+				break;
+
+			case PCAPNG_OPB:
+				if (len < 32)
+					return -1;
+
+				iface = capture_u16(k, blk + 8);
+				hdr = blk + 12;
+				break;
+
+			default:
+				continue;
+		}
+
+		caplen = capture_u32(k, hdr + 8);
+		if (caplen > len - 32 || iface >= k->nifaces)
+			continue;
+
+		p->data = hdr + 16;
+		p->len = caplen;
+
+		if (capture_link(k->ifaces[iface].linktype, p))
+			continue;
+
+		uint64_t units = k->ifaces[iface].units;
+		uint64_t ts = (uint64_t) capture_u32(k, hdr) << 32 | capture_u32(k, hdr + 4);
+
+		p->ts = capture_ts(ts / units, ts % units, units);
+
+		return 1;
+	}
+
+	return 0;
+}
+
+int capture_next(struct capture_cursor *k, struct capture_packet *p)
+{
+	return k->format == CAPTURE_PCAPNG
+		? capture_next_pcapng(k, p)
+		: capture_next_pcap(k, p);
+}
@@ -0,0 +1,82 @@
+/** Reader for packet captures in the pcap and pcapng format.
+ *
+ * @file
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+/** Maximum number of interfaces per section of a pcapng file. */
+#define CAPTURE_MAX_IFACES	64
+
+/** A capture file which is mapped into memory. */
+struct capture {
+	const uint8_t *map;
+	size_t len;
+};
+
+/** The position of a reader in a capture and the state of the current section.
+ *
+ * Multiple cursors can walk the same capture concurrently.
+ */
+struct capture_cursor {
+	const struct capture *capture;
+	size_t offset;
+
+	enum {
+		CAPTURE_PCAP,
+		CAPTURE_PCAPNG
+	} format;
+
+	/** The byte order of the file differs from ours. */
+	int swapped;
+
+	/** The link type and the timestamp resolution in units per second per interface.
+	 *  Classic pcap files have a single interface. */
+	struct {
+		uint16_t linktype;
+		uint64_t units;
+	} ifaces[CAPTURE_MAX_IFACES];
+	unsigned nifaces;
+};
+
+/** An IPv4 packet of the capture. */
+struct capture_packet {
+	/** The IP header within the mapping. */
+	const uint8_t *data;
+
+	/** The captured length starting at the IP header. */
+	unsigned len;
+
+	struct timespec ts;
+};
+
+/** Map a capture file into memory. */
+int capture_open(struct capture *c, const char *path);
+
+void capture_close(struct capture *c);
+
+/** Start to read a capture from its beginning.
+ *
+ * @retval -1 The file is neither a pcap nor a pcapng file.
+ */
+int capture_cursor_init(struct capture_cursor *k, const struct capture *c);
+
+/** Find the next IPv4 packet. All other packets are skipped.
+ *
+ * Packets are not copied. They are valid as long as the capture is open.
+ *
+ * @retval 1 A packet has been found.
+ * @retval 0 The end of the capture has been reached.
+ * @retval -1 The capture is corrupted or truncated at k->offset.
+ */
+int capture_next(struct capture_cursor *k, struct capture_packet *p);
+
+#endif /* _CAPTURE_H_ */
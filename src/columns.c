@@ -0,0 +1,451 @@
+/** Parser for a column of measurement files.
+ *
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#include <errno.h>
+#include <error.h>
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "columns.h"
+#include "utils.h"
+
+/** Powers of ten which are exactly representable as double. */
+static const double columns_pow10[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+	1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+	1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/** The column which is read and how it is selected. */
+struct columns_select {
+	const char *name;
+	int explicit;
+
+	/** Counting from 0. Negative until the column is found. */
+	int index;
+};
+
+struct columns_worker {
+	const char *begin;
+	const char *end;
+	int index;
+
+	struct columns values;
+};
+
+static int columns_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static int columns_sep(char c)
+{
+	return c == ',' || columns_space(c);
+}
+
+void columns_init(struct columns *c, double low, double high, int digits, double scale)
+{
+	hist_create(&c->hist, low, high, digits);
+
+	c->scale = scale;
+	c->shift = NAN;
+	c->sx = c->sy = c->syy = c->sxy = 0;
+	c->first = c->last = 0;
+}
+
+void columns_destroy(struct columns *c)
+{
+	hist_destroy(&c->hist);
+}
+
+/** Account the pair of the consecutive values prev and value. */
+static void columns_pair(struct columns *c, double prev, double value)
+{
+	c->sx  += value - c->shift;
+	c->sy  += prev - c->shift;
+	c->syy += (prev - c->shift) * (prev - c->shift);
+	c->sxy += (value - c->shift) * (prev - c->shift);
+}
+
+void columns_put(struct columns *c, double value)
+{
+	value *= c->scale;
+
+	if (isnan(c->shift))
+		c->shift = value;
+
+	if (c->hist.total == 0)
+		c->first = value;
+	else
+		columns_pair(c, c->last, value);
+
+	hist_put(&c->hist, value);
+
+	c->last = value;
+}
+
+void columns_join(struct columns *dst, const struct columns *src)
+{
+	if (src->hist.total == 0)
+		return;
+
+	if (dst->hist.total == 0) {
+		dst->first = src->first;
+		dst->shift = src->shift;
+	}
+	else
+		columns_pair(dst, dst->last, src->first);
+
+	dst->sx  += src->sx;
+	dst->sy  += src->sy;
+	dst->syy += src->syy;
+	dst->sxy += src->sxy;
+
+	dst->last = src->last;
+
+	if (hist_merge(&dst->hist, &src->hist))
+		error(-1, 0, "Histograms have different buckets");
+}
+
+double columns_rho(struct columns *c)
+{
+	struct hist *h = &c->hist;
+
+	if (h->total < 2)
+		return 0;
+
+	double n = h->total - 1;
+	double mu = hist_mean(h) - c->shift;
+	double top = c->sxy - mu * (c->sx + c->sy) + n * mu * mu;
+	double sigma2 = c->syy - 2 * mu * c->sy + n * mu * mu;
+
+	return sigma2 > 0 ? top / sigma2 : 0;
+}
+
+/** Fall back to strtod() for long mantissas, large exponents, nan and inf. */
+static const char * columns_strtod_slow(const char *str, const char *end, double *value)
+{
+	char buf[64], *tail;
+	size_t len;
+
+	for (len = 0; str + len < end && len < sizeof(buf) - 1 && !columns_sep(str[len]); len++)
+		buf[len] = str[len];
+
+	buf[len] = '\0';
+
+	*value = strtod(buf, &tail);
+
+	return tail == buf ? NULL : str + (tail - buf);
+}
+
+const char * columns_strtod(const char *str, const char *end, double *value)
+{
+	const char *p = str;
+	uint64_t mantissa = 0;
+	int digits = 0, exponent = 0, seen = 0, negative = 0;
+
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+
+	for (; p < end && isdigit((unsigned char) *p); p++, seen++) {
+		if (digits < 19) {
+			mantissa = mantissa * 10 + (*p - '0');
+			digits += mantissa > 0;
+		}
+		else
+			exponent++;
+	}
+
+	if (p < end && *p == '.') {
+		for (p++; p < end && isdigit((unsigned char) *p); p++, seen++) {
+			if (digits < 19) {
+				mantissa = mantissa * 10 + (*p - '0');
+				digits += mantissa > 0;
+				exponent--;
+			}
+		}
+	}
+
+	if (!seen)
+		return columns_strtod_slow(str, end, value);
+
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		const char *q = p + 1;
+		int e = 0, eneg = 0;
+
+		if (q < end && (*q == '-' || *q == '+'))
+			eneg = *q++ == '-';
+
+		if (q < end && isdigit((unsigned char) *q)) {
+			for (; q < end && isdigit((unsigned char) *q); q++) {
+				if (e < 10000)
+					e = e * 10 + (*q - '0');
+			}
+
+			exponent += eneg ? -e : e;
+			p = q;
+		}
+	}
+
+	/* Both the mantissa and the power of ten are exact. Hence a single rounding (Clinger's fast path) */
+	if (digits > 15 || exponent < -22 || exponent > 22)
+		return columns_strtod_slow(str, end, value);
+
+	double v = mantissa;
+	v = exponent < 0 ? v / columns_pow10[-exponent] : v * columns_pow10[exponent];
+
+	*value = negative ? -v : v;
+
+	return p;
+}
+
+/** Find field index of the line [p, end).
+ *
+ * Every comma ends a field, so empty fields are counted. Whitespaces
+ * around the fields are skipped, and runs of them separate fields, too.
+ */
+static const char * columns_field(const char *p, const char *end, int index)
+{
+	while (p < end && columns_space(*p))
+		p++;
+
+	for (int i = 0; i < index && p < end; i++) {
+		while (p < end && !columns_sep(*p))
+			p++;
+		while (p < end && columns_space(*p))
+			p++;
+
+		if (p < end && *p == ',') {
+			p++;
+
+			while (p < end && columns_space(*p))
+				p++;
+		}
+	}
+
+	return p < end ? p : NULL;
+}
+
+static void columns_select_init(struct columns_select *s, const char *column)
+{
+	char *endptr;
+
+	s->name = column ? column : COLUMNS_DEFAULT;
+	s->explicit = column != NULL;
+	s->index = -1;
+
+	if (column && isdigit((unsigned char) column[0])) {
+		long n = strtol(column, &endptr, 10);
+		if (*endptr || n < 1)
+			error(-1, 0, "Invalid column: %s", column);
+
+		s->index = n - 1;
+	}
+}
+
+/** Look for the name of the column in the comment line [p, end). */
+static void columns_select_header(struct columns_select *s, const char *p, const char *end)
+{
+	size_t len = strlen(s->name);
+	const char *f, *q;
+
+	if (s->index >= 0)
+		return;
+
+	/* Skip the '#' */
+	for (int i = 0; (f = columns_field(p + 1, end, i)); i++) {
+		for (q = f; q < end && !columns_sep(*q); q++);
+
+		if (q - f == len && !memcmp(f, s->name, len)) {
+			s->index = i;
+			return;
+		}
+	}
+}
+
+/** Called at the first value. The first column is read if there was no header. */
+static int columns_select_done(struct columns_select *s)
+{
+	if (s->index < 0) {
+		if (s->explicit)
+			return -1;
+
+		s->index = 0;
+	}
+
+	return 0;
+}
+
+static int columns_comment(const char *p, const char *end)
+{
+	return p == end || *p == '#' || *p == '\r' || *p == '\n';
+}
+
+static void * columns_worker_run(void *ctx)
+{
+	struct columns_worker *w = ctx;
+	const char *p, *nl, *f;
+	double value;
+
+	for (p = w->begin; p < w->end; p = nl + 1) {
+		nl = memchr(p, '\n', w->end - p);
+		if (!nl)
+			nl = w->end;
+
+		if (columns_comment(p, nl))
+			continue;
+
+		f = columns_field(p, nl, w->index);
+		if (f && columns_strtod(f, nl, &value))
+			columns_put(&w->values, value);
+	}
+
+	return NULL;
+}
+
+static int columns_read_stream(FILE *f, struct columns_select *s, struct columns *c)
+{
+	char *line = NULL;
+	size_t linelen = 0;
+	ssize_t len;
+	const char *p;
+	double value;
+	int ret = 0;
+
+	while ((len = getline(&line, &linelen, f)) > 0) {
+		if (columns_comment(line, line + len)) {
+			if (line[0] == '#')
+				columns_select_header(s, line, line + len);
+
+			continue;
+		}
+
+		if ((ret = columns_select_done(s)))
+			break;
+
+		p = columns_field(line, line + len, s->index);
+		if (p && columns_strtod(p, line + len, &value))
+			columns_put(c, value);
+	}
+
+	free(line);
+
+	return ret;
+}
+
+int columns_read(FILE *f, const char *column, int workers, struct columns *c)
+{
+	struct columns_select s;
+	struct stat st;
+	const char *map, *begin, *end, *p, *nl;
+	off_t offset;
+	int ret;
+
+	columns_select_init(&s, column);
+
+	offset = ftello(f);
+
+	if (fstat(fileno(f), &st) || !S_ISREG(st.st_mode) || offset < 0 || st.st_size <= offset)
+		return columns_read_stream(f, &s, c);
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+	if (map == MAP_FAILED)
+		return columns_read_stream(f, &s, c);
+
+	madvise((void *) map, st.st_size, MADV_SEQUENTIAL);
+
+	begin = map + offset;
+	end = map + st.st_size;
+
+	/* The header is in the comment lines before the first value */
+	for (p = begin; p < end; p = nl + 1) {
+		nl = memchr(p, '\n', end - p);
+		if (!nl)
+			nl = end;
+
+		if (!columns_comment(p, nl))
+			break;
+
+		if (*p == '#')
+			columns_select_header(&s, p, nl);
+	}
+
+	begin = MIN(p, end);
+
+	if ((ret = columns_select_done(&s)))
+		goto out;
+
+	/* The sums of all ranges are relative to the first value of the file */
+	for (p = begin; p < end && isnan(c->shift); p = nl + 1) {
+		nl = memchr(p, '\n', end - p);
+		if (!nl)
+			nl = end;
+
+		if (columns_comment(p, nl))
+			continue;
+
+		const char *f = columns_field(p, nl, s.index);
+		if (f && columns_strtod(f, nl, &c->shift))
+			c->shift *= c->scale;
+	}
+
+	workers = MAX(1, MIN(workers, (end - begin) / COLUMNS_MIN_RANGE));
+
+	struct columns_worker *ws = alloc(workers * sizeof(struct columns_worker));
+	pthread_t *threads = alloc(workers * sizeof(pthread_t));
+
+	/* Each range starts at the line after its nominal start */
+	for (int i = 0; i < workers; i++) {
+		p = begin + (end - begin) * i / workers;
+
+		if (i > 0) {
+			nl = memchr(p, '\n', end - p);
+			p = nl ? nl + 1 : end;
+			p = MAX(p, ws[i - 1].begin);
+
+			ws[i - 1].end = p;
+		}
+
+		ws[i].begin = p;
+		ws[i].end = end;
+		ws[i].index = s.index;
+
+		columns_init(&ws[i].values, c->hist.low, c->hist.high, c->hist.digits, c->scale);
+		ws[i].values.shift = c->shift;
+	}
+
+	for (int i = 0; i < workers; i++) {
+		ret = pthread_create(&threads[i], NULL, columns_worker_run, &ws[i]);
+		if (ret)
+			error(-1, ret, "Failed to create worker thread");
+	}
+
+	for (int i = 0; i < workers; i++) {
+		pthread_join(threads[i], NULL);
+
+		columns_join(c, &ws[i].values);
+		columns_destroy(&ws[i].values);
+	}
+
+	free(threads);
+	free(ws);
+
+out:	munmap((void *) map, st.st_size);
+
+	return ret;
+}
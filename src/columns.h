@@ -0,0 +1,86 @@
+/** Parser for a column of measurement files.
+ *
+ * Regular files are mapped into memory and split into line-aligned ranges
+ * which are parsed by several workers. Files which can not be mapped (e.g.
+ * pipes) are read line by line.
+ *
+ * @file
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#ifndef _COLUMNS_H_
+#define _COLUMNS_H_
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "hist.h"
+
+/** Files are not split into ranges of less bytes. */
+#define COLUMNS_MIN_RANGE	(1 << 20)
+
+/** The column which is read by default if the file has a header. */
+#define COLUMNS_DEFAULT		"current_rtt"
+
+/** The values of a column counted in a histogram.
+ *
+ * Besides the histogram, only the sums of the pairs of consecutive values
+ * for the lag-1 autocorrelation are kept. Hence the memory does not grow
+ * with the length of the file. The sums are relative to the first value
+ * of the file (#shift) to avoid cancellation.
+ */
+struct columns {
+	struct hist hist;
+
+	/** All values are multiplied by #scale. */
+	double scale;
+
+	double shift;
+	double sx, sy, syy, sxy;
+
+	/** The first and last value. Used to join the sums of adjacent ranges. */
+	double first, last;
+};
+
+/** Initialize c with an empty histogram of the layout of hist_create(). */
+void columns_init(struct columns *c, double low, double high, int digits, double scale);
+
+void columns_destroy(struct columns *c);
+
+void columns_put(struct columns *c, double value);
+
+/** Add the values of src which directly follow the ones of dst. */
+void columns_join(struct columns *dst, const struct columns *src);
+
+/** The lag-1 autocorrelation of the values (see arraystats()). */
+double columns_rho(struct columns *c);
+
+/** Parse a decimal number in [str, end) like strtod().
+ *
+ * Numbers with up to 15 significant digits and a small exponent are
+ * converted exactly without strtod(). The others fall back to strtod().
+ *
+ * @return A pointer behind the number or NULL if there is none.
+ */
+const char * columns_strtod(const char *str, const char *end, double *value);
+
+/** Count a column of a measurement file in c.
+ *
+ * The ranges of a mapped file are counted in histograms of their own which
+ * are merged by hist_merge(). Lines starting with '#' are skipped. The
+ * fields are separated by commas and / or whitespaces. Every comma ends a
+ * field, hence empty fields like in "a,,b" are counted.
+ *
+ * @param column Either the name of the column in the header (a comment line before the first value)
+ *               or its number counting from 1. If NULL, COLUMNS_DEFAULT is read or the first column
+ *               if the header has none.
+ * @param workers The number of threads which parse a mapped file.
+ * @param c Initialized by columns_init(). Its layout is used for the histograms of the ranges.
+ * @retval 0 on success.
+ * @retval -1 if the column is not found in the header.
+ */
+int columns_read(FILE *f, const char *column, int workers, struct columns *c);
+
+#endif /* _COLUMNS_H_ */
@@ -14,12 +14,39 @@ struct config {
 	struct {
 		enum {
 			PROBE_ICMP,
-			PROBE_TCP
+			PROBE_PING,
+			PROBE_TCP,
+			PROBE_UDP
 		} mode;
+		enum {
+			BACKEND_SOCKET,
+			BACKEND_URING,
+			BACKEND_RING,
+			BACKEND_XDP
+		} backend;
 		int payload;
 		int limit;
 		double rate;
+		double timeout;
 		int warmup;
+		char *targets;
+		char *pcap;
+		int workers;
+		int window;
+		double span;
+		enum {
+			AGING_WINDOW,
+			AGING_DECAY
+		} aging;
+		enum {
+			ARRIVAL_PERIODIC,
+			ARRIVAL_POISSON
+		} arrival;
+		double spin;
+		enum {
+			HOST_EXCLUDE,
+			HOST_INCLUDE
+		} host;
 	} probe;
 
 	struct {
@@ -28,13 +55,27 @@ struct config {
 			FORMAT_VILLAS
 		} format;
 		double scaling;
+		char *column;
 	} dist;
 
+	struct {
+		int priority;
+		char *cpus;
+	} rt;
+
 	struct {
 		int mark;
 		int mask;
 		char *dev;
 		int interval;
+		enum {
+			DELAY_RTT,
+			DELAY_ONEWAY
+		} delay;
+		enum {
+			LOSS_RANDOM,
+			LOSS_GEMODEL
+		} loss;
 	} emulate;
 };
 
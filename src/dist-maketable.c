@@ -24,44 +24,6 @@
 
 #include "dist-maketable.h"
 
-double * readdoubles(FILE *fp, int *number)
-{
-	struct stat info;
-	double *x;
-	int limit;
-	int n=0, i=0;
-
-	fstat(fileno(fp), &info);
-	if (info.st_size > 0)
-		limit = 2 * info.st_size / sizeof(double);	/* @@ approximate */
-	else
-		limit = 10000;
-
-	x = calloc(limit, sizeof(double));
-	if (!x)
-		perror("alloc");
-
-	size_t linelen = 0;
-	char *line = NULL;
-
-	for (i = 0; i < limit; i++) {
-		if (getline(&line, &linelen, fp) > 0) {
-			if (line[0] == '#' || line[0] == '\r' || line[0] == '\n')
-				continue;
-
-			sscanf(line, "%lf", &x[i]);
-
-			++n;
-		}
-		else if (feof(fp))
-			break;
-	}
-
-	*number = n;
-
-	return x;
-}
-
 void arraystats(double *x, int limit, double *mu, double *sigma, double *rho)
 {
 	int n = 0, i;
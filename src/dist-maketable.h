@@ -20,7 +20,7 @@
  * with granularity .00002.
  */
 
-#define TABLESIZE	16384/4
+#define TABLESIZE	(16384/4)
 #define TABLEFACTOR	8192
 
 #ifndef MINSHORT
@@ -35,8 +35,6 @@
 #define DISTTABLEGRANULARITY 50000
 #define DISTTABLESIZE (DISTTABLEDOMAIN*DISTTABLEGRANULARITY*2)
 
-double * readdoubles(FILE *fp, int *number);
-
 void arraystats(double *x, int limit, double *mu, double *sigma, double *rho);
 
 int * makedist(double *x, int limit, double mu, double sigma);
@@ -9,7 +9,7 @@
  * @license GPLv3
  *********************************************************************************/
 
-#define _POSIX_C_SOURCE 200112L
+#define _POSIX_C_SOURCE 200809L
 #include <netdb.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -18,18 +18,26 @@
 #include <error.h>
 #include <errno.h>
 #include <string.h>
+#include <math.h>
+#include <stdlib.h>
+#include <inttypes.h>
 #include <time.h>
 #include <unistd.h>
 
 #include <netlink/route/qdisc.h>
 #include <netlink/route/tc.h>
 #include <netlink/route/qdisc/netem.h>
+#include <netlink/version.h>
 
 #include "netlink-private.h"
 #include "dist-maketable.h"
+#include "columns.h"
+#include "hist.h"
 #include "tc.h"
 #include "config.h"
+#include "utils.h"
 
+#if LIBNL_VER_NUM < LIBNL_VER(3, 3)
 /**
  * Set the delay distribution. Latency/jitter must be set before applying.
  * @arg qdisc Netem qdisc.
@@ -55,31 +63,136 @@ int rtnl_netem_set_delay_distribution_data(struct rtnl_qdisc *qdisc, short *data
 
 	return 0;
 }
+#endif
 
-static short * dist_make(FILE *fp, double *mu, double *sigma, double *rho, int *cnt)
+/** The resolution and range of the histogram of the measurements in seconds and its significant digits. */
+#define DIST_LOW	1e-6
+#define DIST_HIGH	100
+#define DIST_DIGITS	4
+
+/** Read a column of the measurements and count them in a histogram.
+ *
+ * The column is parsed by cfg.probe.workers threads (see columns_read()).
+ * Only the buckets and a few sums are kept. Hence the memory does not grow
+ * with the length of the stream.
+ */
+static void dist_read(FILE *fp, struct hist *h, double *rho)
+{
+	struct columns c;
+
+	columns_init(&c, DIST_LOW, DIST_HIGH, DIST_DIGITS, 1);
+
+	if (columns_read(fp, cfg.dist.column, cfg.probe.workers, &c))
+		error(-1, 0, "Column not found in header: %s", cfg.dist.column);
+
+	*rho = columns_rho(&c);
+	*h = c.hist;
+}
+
+/** The range of the values in segment i of the histogram and their number.
+ *
+ * Segment -1 holds the negative values and segment h->length the ones above h->high.
+ */
+static hist_cnt_t dist_segment(struct hist *h, int i, double *lo, double *hi)
+{
+	if (i < 0) {
+		*lo = h->lowest;
+		*hi = MIN(0, h->highest);
+
+		return h->lower;
+	}
+	else if (i >= h->length) {
+		*lo = h->high;
+		*hi = h->highest;
+
+		return h->higher;
+	}
+
+	*lo = MAX(hist_value(h, i), h->lowest);
+	*hi = MIN(hist_value(h, i + 1), h->highest);
+
+	return h->data[i];
+}
+
+/** Build the inverse distribution table directly from the quantiles of a histogram.
+ *
+ * Entry j of the table is the normalized quantile (j + 0.5) / TABLESIZE.
+ * The values are assumed to be uniformly spread within their bucket.
+ * All quantiles are found in a single pass over the buckets.
+ */
+static short * dist_invert(struct hist *h, double scale, double mu, double sigma)
 {
-	double *measurements;
-	int *table;
 	short *inverse;
-	int total;
+	double lo, hi, rank, value;
+	int i = -1, index;
 
-	measurements = readdoubles(fp, cnt);
-	if (*cnt <= 0)
-		error(-1, 0, "Nothing much read!");
+	inverse = calloc(TABLESIZE, sizeof(short));
+	if (!inverse)
+		error(-1, errno, "Failed to allocate memory");
+
+	if (sigma <= 0)
+		return inverse;
+
+	hist_cnt_t seen = 0, count = dist_segment(h, i, &lo, &hi);
+
+	for (int j = 0; j < TABLESIZE; j++) {
+		rank = (j + 0.5) * h->total / TABLESIZE;
+
+		while (seen + count < rank && i < h->length) {
+			seen += count;
+			count = dist_segment(h, ++i, &lo, &hi);
+		}
+
+		value = count ? lo + (hi - lo) * (rank - seen) / count : hi;
 
-	for (int i = 0; i < *cnt; i++)
-		measurements[i] *= cfg.dist.scaling;
+		index = rint((value * scale - mu) / sigma * TABLEFACTOR);
+		if (index <= MINSHORT)
+			index = MINSHORT + 1;
+		if (index > MAXSHORT)
+			index = MAXSHORT;
 
-	arraystats(measurements, *cnt, mu, sigma, rho);
+		inverse[j] = index;
+	}
+
+	return inverse;
+}
 
-	table = makedist(measurements, *cnt, *mu, *sigma);
-	cumulativedist(table, DISTTABLESIZE, &total);
+/** Build the inverse distribution table of either a binary histogram (see 'netem hist') or the measurements.
+ *
+ * The measurements are streamed into a histogram. Hence arbitrary long inputs are read in constant memory.
+ * A histogram file does not keep the order of the values. Hence rho is zero.
+ */
+static short * dist_make(FILE *fp, double *mu, double *sigma, double *rho, hist_cnt_t *cnt)
+{
+	struct hist h;
+	short *inverse;
+	double scale;
+
+	int c = fgetc(fp);
+	ungetc(c, fp);
+
+	if (c == (unsigned char) HIST_MAGIC[0]) {
+		if (hist_load(&h, fp))
+			error(-1, 0, "Failed to read histogram");
+
+		*rho = 0;
+	}
+	else
+		dist_read(fp, &h, rho);
+
+	/* The histograms cover the measurements in seconds. Hence they are scaled after the quantiles */
+	scale = cfg.dist.scaling;
+
+	*cnt = h.total;
+	*mu = hist_mean(&h) * scale;
+	*sigma = hist_stddev(&h) * scale;
+
+	if (*cnt == 0)
+		error(-1, 0, "Nothing much read!");
 
-	inverse = inverttable(table, TABLESIZE, DISTTABLESIZE, total);
-	interpolatetable(inverse, TABLESIZE);
+	inverse = dist_invert(&h, scale, *mu, *sigma);
 
-	free((void *) measurements);
-	free((void *) table);
+	hist_destroy(&h);
 
 	return inverse;
 }
@@ -88,7 +201,7 @@ static int dist_generate(int argc, char *argv[])
 {
 	FILE *fp;
 	double mu, sigma, rho;
-	int cnt;
+	hist_cnt_t cnt;
 
 	if (argc == 1) {
 		if (!(fp = fopen(argv[0], "r")))
@@ -108,7 +221,7 @@ static int dist_generate(int argc, char *argv[])
 	getlogin_r(user, sizeof(user));
 
 	printf("# This is the distribution table for the experimental distribution.\n");
-	printf("#  Read %d values, mu %.6f, sigma %.6f, rho %.6f\n", cnt, mu, sigma, rho);
+	printf("#  Read %" PRIu64 " values, mu %.6f, sigma %.6f, rho %.6f\n", cnt, mu, sigma, rho);
     printf("#  Generated %s, by %s on %s\n", date, user, host);
 	printf("#\n");
 
@@ -142,7 +255,7 @@ static int dist_load(int argc, char *argv[])
 {
 	FILE *fp;
 	double mu, sigma, rho;
-	int cnt;
+	hist_cnt_t cnt;
 
 	if (argc == 1) {
 		if (!(fp = fopen(argv[0], "r")))
@@ -8,6 +8,10 @@
 #define _POSIX_C_SOURCE 200809L
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
 #include <errno.h>
 #include <error.h>
 #include <time.h>
@@ -17,9 +21,15 @@
 #include <netlink/route/qdisc/netem.h>
 #include <netlink/route/tc.h>
 
+#include <linux/pkt_sched.h>
+
 #include "tc.h"
 #include "config.h"
 #include "timing.h"
+#include "utils.h"
+#include "gemodel.h"
+#include "metrics.h"
+#include "rt.h"
 
 enum input_fields {
 	CURRENT_RTT,
@@ -34,25 +44,105 @@ enum input_fields {
 	CORRUPTION_CORR,
 	DUPLICATION_PROB,
 	DUPLICATION_CORR,
+	COUNTER_RX,
+	COUNTER,
 	MAXFIELDS
 };
 
-static int emulate_parse_line(char *line, struct rtnl_tc *tc)
+/** netem expects probabilities and correlations as fraction of UINT32_MAX. */
+static int emulate_prob(double p)
+{
+	if (p <= 0)
+		return 0;
+	else if (p >= 1)
+		return (int) UINT32_MAX;
+
+	return (int) (uint32_t) (p * UINT32_MAX);
+}
+
+/** Estimate the delay and jitter from the RTTs of the last -E seconds. */
+static void emulate_window(struct rtnl_qdisc *ne, struct metrics *m, double rtt)
 {
-	double val;
-	char *cur, *end = line;
-	int i = 0;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	metrics_delay(m, rtt, time_to_double(&now));
+
+	/* Halving the RTT also halves its standard deviation */
+	double scale = cfg.emulate.delay == DELAY_ONEWAY ? 1e6 : 1e6 / 2;
+
+	rtnl_netem_set_delay(ne, metrics_span_mean(m) * scale);
+	rtnl_netem_set_jitter(ne, metrics_span_stddev(m) * scale + 1);
+
+	printf("window mean %f ms sigma %f ms p50 %f ms p90 %f ms p99 %f ms p99.9 %f ms\n",
+		metrics_span_mean(m) * 1e3, metrics_span_stddev(m) * 1e3,
+		metrics_span_percentile(m, 50) * 1e3, metrics_span_percentile(m, 90) * 1e3,
+		metrics_span_percentile(m, 99) * 1e3, metrics_span_percentile(m, 99.9) * 1e3);
+}
+
+/** Fields are separated by commas and / or whitespaces. */
+static int emulate_separator(char c)
+{
+	return c == ',' || c == '\0' || isspace(c);
+}
+
+/** Parse a line of measurements and update the netem qdisc with it.
+ *
+ * @retval 0 The line has been parsed.
+ * @retval 1 The line belongs to another target than the first one and is skipped.
+ * @retval -1 The line is malformed.
+ */
+static int emulate_parse_line(char *line, struct rtnl_tc *tc, struct gemodel *ge, struct metrics *m)
+{
+	/* The target of the first line which is prefixed with one (probe -T) */
+	static char target[64];
+
+	double val, rtt = 0;
+	char *cur, *end;
+	size_t len;
+	int i;
 
 	struct rtnl_qdisc *ne = (struct rtnl_qdisc *) tc;
 
-	do {
+	/* A first field which is not a number is the name of a target. Only the first target is emulated */
+	cur = line + strspn(line, " \t");
+	strtod(cur, &end);
+	if (cur == end || !emulate_separator(*end)) {
+		len = strcspn(cur, ",");
+		if (len == 0 || len >= sizeof(target))
+			return -1;
+
+		if (!target[0])
+			memcpy(target, cur, len);
+		else if (strncmp(target, cur, len) || target[len])
+			return 1;
+
+		end = cur + len;
+	}
+	else
+		end = line;
+
+	for (i = 0; i < MAXFIELDS; i++) {
+		while (*end == ',' || isspace(*end))
+			end++;
+
 		cur = end;
 		val = strtod(cur, &end);
+		if (cur == end)
+			break;
+
+		/* E.g. a target name in a later field */
+		if (!emulate_separator(*end))
+			return -1;
 
 		switch (i) {
 			case CURRENT_RTT:
-				rtnl_netem_set_delay(ne, val * 1e6 / 2);
-				break; /* we approximate: delay = RTT / 2 */
+				rtt = val;
+
+				/* Without one-way measurements we approximate: delay = RTT / 2 */
+				rtnl_netem_set_delay(ne, cfg.emulate.delay == DELAY_ONEWAY ? val * 1e6 : val * 1e6 / 2);
+				break;
 			case MEAN:
 				break; /* ignored */
 			case SIGMA:
@@ -62,35 +152,69 @@ static int emulate_parse_line(char *line, struct rtnl_tc *tc)
 				rtnl_netem_set_gap(ne, val);
 				break;
 			case LOSS_PROB:
-				rtnl_netem_set_loss(ne, val);
+				rtnl_netem_set_loss(ne, emulate_prob(val));
 				break;
 			case LOSS_CORR:
-				rtnl_netem_set_loss_correlation(ne, val);
+				rtnl_netem_set_loss_correlation(ne, emulate_prob(val));
 				break;
 			case REORDER_PROB:
-				rtnl_netem_set_reorder_probability(ne, val);
+				rtnl_netem_set_reorder_probability(ne, emulate_prob(val));
 				break;
 			case REORDER_CORR:
-				rtnl_netem_set_reorder_correlation(ne, val);
+				rtnl_netem_set_reorder_correlation(ne, emulate_prob(val));
 				break;
 			case CORRUPTION_PROB:
-				rtnl_netem_set_corruption_probability(ne, val);
+				rtnl_netem_set_corruption_probability(ne, emulate_prob(val));
 				break;
 			case CORRUPTION_CORR:
-				rtnl_netem_set_corruption_correlation(ne, val);
+				rtnl_netem_set_corruption_correlation(ne, emulate_prob(val));
 				break;
 			case DUPLICATION_PROB:
-				rtnl_netem_set_duplicate(ne, val);
+				rtnl_netem_set_duplicate(ne, emulate_prob(val));
 				break;
 			case DUPLICATION_CORR:
-				rtnl_netem_set_duplicate_correlation(ne, val);
+				rtnl_netem_set_duplicate_correlation(ne, emulate_prob(val));
+				break;
+			case COUNTER_RX:
+				break; /* ignored */
+			case COUNTER:
+				gemodel_counter(ge, val);
 				break;
 		}
-	} while (cur != end && ++i < MAXFIELDS);
+	}
+
+	/* Lines with only the RTT are collected in our own window */
+	if (i == 1) {
+		emulate_window(ne, m, rtt);
+		return 0;
+	}
 
 	return (i >= 3) ? 0 : -1; /* we need at least 3 fields: rtt + jitter */
 }
 
+/** Fit the loss model to all probes seen so far and update the netem qdisc with it. */
+static int emulate_gemodel(struct nl_sock *sock, struct rtnl_link *link, struct rtnl_tc *tc, struct gemodel *ge)
+{
+	struct gemodel_params m;
+
+	/* Without enough probes we start with a loss-free link */
+	if (gemodel_fit(ge, &m)) {
+		m.p = m.k1 = 0;
+		m.r = m.h = 1;
+	}
+
+	struct tc_netem_gemodel gm = {
+		.p = emulate_prob(m.p),
+		.r = emulate_prob(m.r),
+		.h = emulate_prob(m.h),
+		.k1 = emulate_prob(m.k1)
+	};
+
+	printf("loss gemodel p %f%% r %f%% 1-h %f%% 1-k %f%%\n", m.p * 100, m.r * 100, (1 - m.h) * 100, m.k1 * 100);
+
+	return tc_netem_gemodel(sock, link, tc, &gm);
+}
+
 int emulate(int argc, char *argv[])
 {
 	int ret, tfd, run = 0;
@@ -104,6 +228,13 @@ int emulate(int argc, char *argv[])
 
 	struct tc_statistics stats_netem;
 
+	struct gemodel ge;
+	struct metrics m;
+
+	gemodel_init(&ge);
+	/* A single window for lines with only an RTT */
+	metrics_init(&m, cfg.probe.window, cfg.probe.span > 0 ? cfg.probe.span : METRICS_SPAN_DEFAULT, cfg.probe.aging == AGING_DECAY);
+
 	/* Create connection to netlink */
 	sock = nl_socket_alloc();
 	nl_connect(sock, NETLINK_ROUTE);
@@ -138,10 +269,14 @@ int emulate(int argc, char *argv[])
 	if ((tfd = timerfd_init(cfg.probe.rate)) < 0)
 		error(-1, errno, "Failed to initilize timer");
 
-	char *line = NULL;
-	size_t linelen = 0;
+	/* getline() only grows the buffer for longer lines */
+	size_t linelen = 1024;
+	char *line = alloc(linelen);
 	ssize_t len;
 
+	rt_thread("emulate", rt_cpu(0));
+	rt_lock();
+
 	do {
 #if 0
 		struct nl_dump_params dp_param = {
@@ -166,10 +301,16 @@ next_line:	len = getline(&line, &linelen, stdin);
 		if (line[0] == '#' || line[0] == '\r' || line[0] == '\n')
 			goto next_line;
 
-		if (emulate_parse_line(line, qdisc_netem))
-			error(-1, 0, "Failed to parse stdin");
+		ret = emulate_parse_line(line, qdisc_netem, &ge, &m);
+		if (ret < 0)
+			error(-1, 0, "Failed to parse stdin: %.*s", (int) strcspn(line, "\n"), line);
+		else if (ret > 0)
+			goto next_line;
 
-		ret = tc_netem(sock, link, &qdisc_netem);
+		if (cfg.emulate.loss == LOSS_GEMODEL)
+			ret = emulate_gemodel(sock, link, qdisc_netem, &ge);
+		else
+			ret = tc_netem(sock, link, &qdisc_netem);
 		if (ret)
 			error(-1, 0, "Failed to update TC: netem qdisc: %s", nl_geterror(ret));
 
@@ -179,6 +320,8 @@ next_line:	len = getline(&line, &linelen, stdin);
 	/* Shutdown */
 	free(line);
 
+	metrics_destroy(&m);
+
 	nl_close(sock);
 	nl_socket_free(sock);
 
@@ -0,0 +1,105 @@
+/** Classic BPF socket filters.
+ *
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <error.h>
+#include <string.h>
+
+#include <sys/socket.h>
+
+#include "utils.h"
+#include "filter.h"
+
+void filter_init(struct filter *f)
+{
+	f->length = 0;
+	f->allocated = 64;
+	f->insns = alloc(f->allocated * sizeof(struct sock_filter));
+}
+
+void filter_destroy(struct filter *f)
+{
+	free(f->insns);
+}
+
+unsigned filter_insn(struct filter *f, uint16_t code, uint8_t jt, uint8_t jf, uint32_t k)
+{
+	if (f->length == f->allocated) {
+		f->allocated *= 2;
+		f->insns = realloc(f->insns, f->allocated * sizeof(struct sock_filter));
+		if (!f->insns)
+			error(-1, 0, "Failed to allocate memory");
+	}
+
+	f->insns[f->length] = (struct sock_filter) BPF_STMT(code, k);
+	f->insns[f->length].jt = jt;
+	f->insns[f->length].jf = jf;
+
+	return f->length++;
+}
+
+void filter_require(struct filter *f, uint16_t op, uint32_t k)
+{
+	filter_insn(f, BPF_JMP | op | BPF_K, 1, 0, k);
+	filter_insn(f, BPF_RET | BPF_K, 0, 0, 0);
+}
+
+void filter_reject(struct filter *f, uint16_t op, uint32_t k)
+{
+	filter_insn(f, BPF_JMP | op | BPF_K, 0, 1, k);
+	filter_insn(f, BPF_RET | BPF_K, 0, 0, 0);
+}
+
+static int filter_cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+void filter_ranges(struct filter *f, uint32_t *values, unsigned n)
+{
+	unsigned i, j, ranges = 0, start = f->length;
+
+	qsort(values, n, sizeof(uint32_t), filter_cmp);
+
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n && values[j] - values[j - 1] <= 1; j++);
+
+		ranges++;
+	}
+
+	if (ranges > FILTER_MAX_RANGES)
+		return;
+
+	/* Every range jumps to the end of the check on a match */
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n && values[j] - values[j - 1] <= 1; j++);
+
+		filter_insn(f, BPF_JMP | BPF_JGE | BPF_K, 0, 2, values[i]);
+		filter_insn(f, BPF_JMP | BPF_JGT | BPF_K, 1, 0, values[j - 1]);
+		filter_insn(f, BPF_JMP | BPF_JA, 0, 0, 0);
+	}
+
+	filter_insn(f, BPF_RET | BPF_K, 0, 0, 0);
+
+	/* Patch the jumps */
+	for (i = start + 2; i < f->length; i += 3)
+		f->insns[i].k = f->length - i - 1;
+}
+
+int filter_attach(struct filter *f, int sd)
+{
+	struct sock_fprog prog = {
+		.len = f->length,
+		.filter = f->insns
+	};
+
+	return setsockopt(sd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+}
@@ -0,0 +1,61 @@
+/** Classic BPF socket filters.
+ *
+ * @file
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#ifndef _FILTER_H_
+#define _FILTER_H_
+
+#include <stdint.h>
+
+#include <linux/filter.h>
+
+/** Maximum number of ranges which are matched by filter_ranges(). */
+#define FILTER_MAX_RANGES	512
+
+/** A classic BPF program which is assembled at runtime. */
+struct filter {
+	struct sock_filter *insns;
+
+	/** Number of instructions in #insns. */
+	unsigned length;
+	/** Number of allocated slots in #insns. */
+	unsigned allocated;
+};
+
+void filter_init(struct filter *f);
+
+void filter_destroy(struct filter *f);
+
+/** Append a single instruction.
+ *
+ * @return The index of the instruction.
+ */
+unsigned filter_insn(struct filter *f, uint16_t code, uint8_t jt, uint8_t jf, uint32_t k);
+
+/** Drop the packet unless the comparison of the accumulator with k is true.
+ *
+ * @param op One of BPF_JEQ, BPF_JGT, BPF_JGE or BPF_JSET.
+ */
+void filter_require(struct filter *f, uint16_t op, uint32_t k);
+
+/** Drop the packet if the comparison of the accumulator with k is true. */
+void filter_reject(struct filter *f, uint16_t op, uint32_t k);
+
+/** Drop the packet unless the accumulator equals one of the values.
+ *
+ * Consecutive values are merged into ranges.
+ * If there are more than FILTER_MAX_RANGES ranges, the check is omitted.
+ * Hence the filter might pass more packets than requested but never less.
+ *
+ * @param values The values which are sorted in place.
+ */
+void filter_ranges(struct filter *f, uint32_t *values, unsigned n);
+
+/** Attach the filter to a socket, replacing a previously attached one (SO_ATTACH_FILTER). */
+int filter_attach(struct filter *f, int sd);
+
+#endif /* _FILTER_H_ */
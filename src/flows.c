@@ -0,0 +1,153 @@
+/** Table of pending TCP segments and ICMP echo requests with bounded memory.
+ *
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "flows.h"
+#include "utils.h"
+
+static uint32_t flows_hash(const struct flows_key *k)
+{
+	uint64_t h = ((uint64_t) k->saddr << 32 | k->daddr) ^
+		     ((uint64_t) k->sport << 48 | (uint64_t) k->dport << 32 | k->value) * 0x9E3779B97F4A7C15ULL ^
+		     k->kind;
+
+	/* Finalizer of MurmurHash3 */
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+
+	return h;
+}
+
+static uint32_t * flows_bucket(struct flows *f, const struct flows_key *key)
+{
+	return &f->buckets[flows_hash(key) & f->mask];
+}
+
+static void flows_unlink(struct flows *f, uint32_t idx)
+{
+	struct flows_entry *e = &f->entries[idx];
+
+	if (e->older != FLOWS_NONE)
+		f->entries[e->older].newer = e->newer;
+	else
+		f->oldest = e->newer;
+
+	if (e->newer != FLOWS_NONE)
+		f->entries[e->newer].older = e->older;
+	else
+		f->newest = e->older;
+}
+
+static void flows_link(struct flows *f, uint32_t idx)
+{
+	struct flows_entry *e = &f->entries[idx];
+
+	e->older = f->newest;
+	e->newer = FLOWS_NONE;
+
+	if (f->newest != FLOWS_NONE)
+		f->entries[f->newest].newer = idx;
+	else
+		f->oldest = idx;
+
+	f->newest = idx;
+}
+
+void flows_init(struct flows *f, uint32_t capacity)
+{
+	f->capacity = capacity;
+	f->entries = alloc(capacity * sizeof(struct flows_entry));
+
+	/* Keep the chains short */
+	for (f->mask = 1; f->mask < capacity; f->mask = 2 * f->mask + 1);
+
+	f->buckets = alloc((f->mask + 1) * sizeof(uint32_t));
+	memset(f->buckets, 0xFF, (f->mask + 1) * sizeof(uint32_t));
+
+	for (uint32_t i = 0; i < capacity; i++)
+		f->entries[i].next = i + 1 < capacity ? i + 1 : FLOWS_NONE;
+
+	f->free = 0;
+	f->length = 0;
+	f->oldest = f->newest = FLOWS_NONE;
+	f->evictions = 0;
+}
+
+void flows_destroy(struct flows *f)
+{
+	free(f->entries);
+	free(f->buckets);
+}
+
+struct flows_entry * flows_lookup(struct flows *f, const struct flows_key *key)
+{
+	for (uint32_t i = *flows_bucket(f, key); i != FLOWS_NONE; i = f->entries[i].next) {
+		if (!memcmp(&f->entries[i].key, key, sizeof(*key)))
+			return &f->entries[i];
+	}
+
+	return NULL;
+}
+
+struct flows_entry * flows_add(struct flows *f, const struct flows_key *key, const struct timespec *ts)
+{
+	uint32_t idx, *head;
+	struct flows_entry *e = flows_lookup(f, key);
+
+	if (e) {
+		idx = e - f->entries;
+
+		flows_unlink(f, idx);
+		flows_link(f, idx);
+
+		return e;
+	}
+
+	if (f->free == FLOWS_NONE) {
+		flows_remove(f, &f->entries[f->oldest]);
+		f->evictions++;
+	}
+
+	idx = f->free;
+	e = &f->entries[idx];
+	f->free = e->next;
+
+	e->key = *key;
+	e->ts = *ts;
+	e->data = 0;
+
+	head = flows_bucket(f, key);
+	e->next = *head;
+	*head = idx;
+
+	flows_link(f, idx);
+
+	f->length++;
+
+	return e;
+}
+
+void flows_remove(struct flows *f, struct flows_entry *e)
+{
+	uint32_t idx = e - f->entries, *i;
+
+	for (i = flows_bucket(f, &e->key); *i != idx; i = &f->entries[*i].next);
+
+	*i = e->next;
+
+	flows_unlink(f, idx);
+
+	e->next = f->free;
+	f->free = idx;
+
+	f->length--;
+}
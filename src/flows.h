@@ -0,0 +1,98 @@
+/** Table of pending TCP segments and ICMP echo requests with bounded memory.
+ *
+ * @file
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#ifndef _FLOWS_H_
+#define _FLOWS_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#define FLOWS_NONE	UINT32_MAX
+
+/** What has been seen and waits for its answer in the opposite direction. */
+enum flows_kind {
+	FLOWS_SYN,	/**< A SYN with initial sequence number #flows_key::value. */
+	FLOWS_TSVAL,	/**< The first segment with TSval #flows_key::value. */
+	FLOWS_ECHO,	/**< An ICMP echo request with identifier #flows_key::sport and sequence number #flows_key::value. */
+	FLOWS_ECHO_SEQ,	/**< The highest sequence number of the echo replies with identifier #flows_key::sport in #flows_entry::data. */
+	FLOWS_TSVAL_LAST /**< The last TSval of a direction of a TCP flow in #flows_entry::data. */
+};
+
+/** A direction of a TCP flow and a value which is echoed by the opposite direction.
+ *
+ * ICMP uses the identifier as source port and zero as destination port.
+ */
+struct flows_key {
+	uint32_t saddr;
+	uint32_t daddr;
+	uint16_t sport;
+	uint16_t dport;
+	uint32_t value;
+	uint32_t kind;
+};
+
+struct flows_entry {
+	struct flows_key key;
+
+	/** The time at which the key has been seen first. */
+	struct timespec ts;
+
+	/** Additional state which is owned by the caller. Zero for new entries. */
+	uint32_t data;
+
+	/** The next entry in the same bucket or in the free list. */
+	uint32_t next;
+
+	/** Neighbours in the list of entries ordered by their last use. */
+	uint32_t older, newer;
+};
+
+/** A hash table with a fixed number of entries.
+ *
+ * If the table is full, the least recently used entry is evicted.
+ */
+struct flows {
+	struct flows_entry *entries;
+	uint32_t capacity;
+	uint32_t length;
+	uint32_t free;
+
+	/** Heads of the chains of entries with the same hash. */
+	uint32_t *buckets;
+	uint32_t mask;
+
+	/** The least and the most recently used entries. */
+	uint32_t oldest, newest;
+
+	/** Number of entries which have been evicted before they were answered. */
+	uint64_t evictions;
+};
+
+void flows_init(struct flows *f, uint32_t capacity);
+
+void flows_destroy(struct flows *f);
+
+/** Find an entry or return NULL if there is none. */
+struct flows_entry * flows_lookup(struct flows *f, const struct flows_key *key);
+
+/** Add a key which has been seen at time ts.
+ *
+ * If the key already exists, it keeps its time but counts as recently used.
+ */
+struct flows_entry * flows_add(struct flows *f, const struct flows_key *key, const struct timespec *ts);
+
+/** Remove an entry which has been answered. */
+void flows_remove(struct flows *f, struct flows_entry *e);
+
+/** Return the least recently used entry or NULL if the table is empty. */
+static inline struct flows_entry * flows_oldest(struct flows *f)
+{
+	return f->oldest != FLOWS_NONE ? &f->entries[f->oldest] : NULL;
+}
+
+#endif /* _FLOWS_H_ */
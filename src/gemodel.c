@@ -0,0 +1,127 @@
+/** Online fitting of the Gilbert-Elliott loss model.
+ *
+ * The model has a good and a bad state. We assume that no probes are lost in the
+ * good state (k1 = 0) which is the original model of Gilbert. Its remaining three
+ * parameters follow from the first moments of the loss sequence:
+ *
+ *     a = P(1),  b = P(1 | 1),  c = P(1 at t+1 | 1 at t and t+2)
+ *
+ *     1 - r = (a * c - b^2) / (2 * a * c - b * (a + c))
+ *     1 - h = b / (1 - r)
+ *     p     = a * r / (1 - h - a)
+ *
+ * See: E. N. Gilbert, "Capacity of a Burst-Noise Channel", 1960.
+ *
+ * If the sequence does not fit these estimates, we fall back to the Simple Gilbert
+ * model (h = 0) whose transition probabilities are directly observable.
+ *
+ * All counts are cumulative. Hence the fit is updated in O(1) per probe.
+ *
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#include <string.h>
+
+#include "gemodel.h"
+
+void gemodel_init(struct gemodel *g)
+{
+	memset(g, 0, sizeof(*g));
+}
+
+void gemodel_put(struct gemodel *g, int lost)
+{
+	lost = !!lost;
+
+	if (g->samples >= 1) {
+		int prev = g->history & 1;
+
+		if (!prev)
+			lost ? g->n01++ : g->n00++;
+		else if (lost)
+			g->n11++;
+	}
+
+	if (g->samples >= 2) {
+		int prev = g->history & 1;
+		int prev2 = (g->history >> 1) & 1;
+
+		if (prev2 && lost) {
+			g->n1x1++;
+
+			if (prev)
+				g->n111++;
+		}
+	}
+
+	g->n1 += lost;
+	g->samples++;
+	g->history = ((g->history << 1) | lost) & 3;
+}
+
+void gemodel_counter(struct gemodel *g, uint64_t counter)
+{
+	if (g->samples && counter <= g->counter)
+		return;
+
+	/* The counters of the lost probes are missing in the sequence */
+	if (g->samples)
+		for (uint64_t c = g->counter + 1; c < counter; c++)
+			gemodel_put(g, 1);
+
+	gemodel_put(g, 0);
+
+	g->counter = counter;
+}
+
+static int gemodel_valid(double v)
+{
+	return v > 0 && v <= 1;
+}
+
+int gemodel_fit(struct gemodel *g, struct gemodel_params *m)
+{
+	if (g->samples < 2)
+		return -1;
+
+	m->k1 = 0;
+
+	/* There is no bad state without losses */
+	if (g->n1 == 0) {
+		m->p = 0;
+		m->r = 1;
+		m->h = 1;
+
+		return 0;
+	}
+
+	double a = (double) g->n1 / g->samples;
+	double b = (double) g->n11 / g->n1;
+	double c = g->n1x1 ? (double) g->n111 / g->n1x1 : 0;
+
+	double d = 2 * a * c - b * (a + c);
+	if (d != 0) {
+		double r = 1 - (a * c - b * b) / d;
+		double h = 1 - b / (1 - r);
+		double p = a * r / (1 - h - a);
+
+		if (gemodel_valid(r) && r < 1 && gemodel_valid(1 - h) && gemodel_valid(p)) {
+			m->p = p;
+			m->r = r;
+			m->h = h;
+
+			return 0;
+		}
+	}
+
+	/* Simple Gilbert: every probe in the bad state is lost */
+	uint64_t n0 = g->n00 + g->n01;
+
+	m->p = n0 ? (double) g->n01 / n0 : 1;
+	m->r = 1 - b;
+	m->h = 0;
+
+	return 0;
+}
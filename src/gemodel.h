@@ -0,0 +1,62 @@
+/** Online fitting of the Gilbert-Elliott loss model.
+ *
+ * @file
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#ifndef _GEMODEL_H_
+#define _GEMODEL_H_
+
+#include <stdint.h>
+
+/** Statistics of a loss sequence from which the model is fitted. */
+struct gemodel {
+	/** The last two samples (bit 0 is the most recent one). */
+	unsigned history;
+
+	/** Number of samples seen so far. */
+	uint64_t samples;
+
+	/** Number of losses and of the loss patterns 11, 1x1 and 111. */
+	uint64_t n1;
+	uint64_t n11;
+	uint64_t n1x1;
+	uint64_t n111;
+
+	/** Number of transitions from success to success and to loss. */
+	uint64_t n00;
+	uint64_t n01;
+
+	/** The highest probe counter seen by gemodel_counter(). */
+	uint64_t counter;
+};
+
+/** The parameters of the model as used by netem (see tc-netem(8)). */
+struct gemodel_params {
+	double p;	/**< Transition probability from the good to the bad state. */
+	double r;	/**< Transition probability from the bad to the good state. */
+	double h;	/**< Probability that a probe is delivered in the bad state. */
+	double k1;	/**< Probability that a probe is lost in the good state. */
+};
+
+void gemodel_init(struct gemodel *g);
+
+/** Account the next probe of the sequence. */
+void gemodel_put(struct gemodel *g, int lost);
+
+/** Account a received probe counter. Gaps in the sequence of counters are accounted as losses.
+ *
+ * Counters which are not higher than the previous one (reordered or duplicated probes) are ignored.
+ */
+void gemodel_counter(struct gemodel *g, uint64_t counter);
+
+/** Estimate the parameters of the model from all samples seen so far.
+ *
+ * @retval 0 The parameters have been estimated.
+ * @retval -1 There are not enough samples.
+ */
+int gemodel_fit(struct gemodel *g, struct gemodel_params *m);
+
+#endif /* _GEMODEL_H_ */
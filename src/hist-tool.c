@@ -0,0 +1,196 @@
+/** Create, merge and print binary histograms of delay measurements.
+ *
+ * Histograms of many hosts or runs are combined by hist_merge() which is
+ * associative. Hence the files are split among the workers (-j) which each
+ * merge their share. The partial results are merged at the end.
+ *
+ * The output of 'hist create' and 'hist merge' can be read by 'dist generate'
+ * and 'dist load' instead of the measurements themselves.
+ *
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <error.h>
+
+#include <pthread.h>
+
+#include "config.h"
+#include "utils.h"
+#include "hist.h"
+#include "columns.h"
+
+/** The range of the delay histograms in seconds and their significant digits. */
+#define HIST_DELAY_LOW		1e-6
+#define HIST_DELAY_HIGH		100
+#define HIST_DELAY_DIGITS	3
+
+struct hist_merger {
+	char **files;
+	int length;
+
+	/** Merge every #stride-th file starting at #offset. */
+	int offset;
+	int stride;
+
+	struct hist hist;
+	int empty;
+};
+
+/** Open the file given as first argument or STDIN. */
+static FILE * hist_open(int argc, char *argv[])
+{
+	FILE *f;
+
+	if (argc < 1 || !strcmp(argv[0], "-"))
+		return stdin;
+
+	if (!(f = fopen(argv[0], "r")))
+		error(-1, errno, "Failed to open file: %s", argv[0]);
+
+	return f;
+}
+
+/** Read the delays of the probe sub-command and write their histogram. */
+static int hist_create_cmd(int argc, char *argv[])
+{
+	struct columns c;
+
+	FILE *f = hist_open(argc, argv);
+
+	columns_init(&c, HIST_DELAY_LOW, HIST_DELAY_HIGH, HIST_DELAY_DIGITS, 1);
+
+	if (columns_read(f, cfg.dist.column, cfg.probe.workers, &c))
+		error(-1, 0, "Column not found in header: %s", cfg.dist.column);
+
+	if (hist_save(&c.hist, stdout))
+		error(-1, errno, "Failed to write histogram");
+
+	columns_destroy(&c);
+
+	if (f != stdin)
+		fclose(f);
+
+	return 0;
+}
+
+static void * hist_merge_run(void *ctx)
+{
+	struct hist_merger *m = ctx;
+	struct hist h;
+
+	m->empty = 1;
+
+	for (int i = m->offset; i < m->length; i += m->stride) {
+		FILE *f = fopen(m->files[i], "r");
+		if (!f)
+			error(-1, errno, "Failed to open file: %s", m->files[i]);
+
+		if (hist_load(&h, f))
+			error(-1, 0, "Failed to read histogram: %s", m->files[i]);
+
+		fclose(f);
+
+		if (m->empty) {
+			m->hist = h;
+			m->empty = 0;
+		}
+		else {
+			if (hist_merge(&m->hist, &h))
+				error(-1, 0, "Histogram has different buckets: %s", m->files[i]);
+
+			hist_destroy(&h);
+		}
+	}
+
+	return NULL;
+}
+
+static int hist_merge_cmd(int argc, char *argv[])
+{
+	int ret;
+
+	if (argc < 1)
+		error(-1, 0, "usage: netem hist merge FILE...");
+
+	int workers = MAX(1, MIN(cfg.probe.workers, argc));
+
+	struct hist_merger *ms = alloc(workers * sizeof(struct hist_merger));
+	pthread_t *threads = alloc(workers * sizeof(pthread_t));
+
+	for (int i = 0; i < workers; i++) {
+		ms[i].files = argv;
+		ms[i].length = argc;
+		ms[i].offset = i;
+		ms[i].stride = workers;
+
+		ret = pthread_create(&threads[i], NULL, hist_merge_run, &ms[i]);
+		if (ret)
+			error(-1, ret, "Failed to create worker thread");
+	}
+
+	for (int i = 0; i < workers; i++)
+		pthread_join(threads[i], NULL);
+
+	for (int i = 1; i < workers; i++) {
+		if (hist_merge(&ms[0].hist, &ms[i].hist))
+			error(-1, 0, "Histograms have different buckets");
+
+		hist_destroy(&ms[i].hist);
+	}
+
+	if (hist_save(&ms[0].hist, stdout))
+		error(-1, errno, "Failed to write histogram");
+
+	hist_destroy(&ms[0].hist);
+
+	free(threads);
+	free(ms);
+
+	return 0;
+}
+
+static int hist_print_cmd(int argc, char *argv[])
+{
+	struct hist h;
+
+	FILE *f = hist_open(argc, argv);
+
+	if (hist_load(&h, f))
+		error(-1, 0, "Failed to read histogram");
+
+	hist_print(&h, stdout);
+
+	hist_destroy(&h);
+
+	if (f != stdin)
+		fclose(f);
+
+	return 0;
+}
+
+int hist(int argc, char *argv[])
+{
+	char *subcmd = argv[0];
+
+	if (argc < 1)
+		error(-1, 0, "Missing sub-command");
+
+	if      (!strcmp(subcmd, "create"))
+		return hist_create_cmd(argc-1, argv+1);
+	else if (!strcmp(subcmd, "merge"))
+		return hist_merge_cmd(argc-1, argv+1);
+	else if (!strcmp(subcmd, "print"))
+		return hist_print_cmd(argc-1, argv+1);
+	else
+		return -1;
+}
@@ -9,6 +9,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
+#include <error.h>
 #include <float.h>
 #include <math.h>
 #include <time.h>
@@ -16,17 +18,78 @@
 #include "hist.h"
 #include "utils.h"
 
-#define VAL(h, i)	((h)->low + (i) * (h)->resolution)
-#define INDEX(h, v)	round((v - (h)->low) / (h)->resolution)
+/** The bucket of a value which is a multiple of h->low.
+ *
+ * The position of the highest set bit selects the power-of-two interval and
+ * the next h->magnitude bits the sub-bucket within it. No division is needed.
+ */
+static inline int hist_index(const struct hist *h, uint64_t v)
+{
+	int bucket = 64 - __builtin_clzll(v | h->mask) - (h->magnitude + 1);
+
+	return ((bucket + 1) << h->magnitude) + (v >> bucket) - (1 << h->magnitude);
+}
+
+/** The lower bound and the width of bucket i as multiples of h->low. */
+static uint64_t hist_index_value(const struct hist *h, int i, uint64_t *width)
+{
+	int bucket = (i >> h->magnitude) - 1;
+	uint64_t sub = (i & ((1 << h->magnitude) - 1)) + (1 << h->magnitude);
+
+	if (bucket < 0) {
+		sub -= 1 << h->magnitude;
+		bucket = 0;
+	}
+
+	*width = 1ULL << bucket;
+
+	return sub << bucket;
+}
+
+/** The number of buckets up to the highest one which is not empty. */
+static int hist_used(struct hist *h)
+{
+	int n;
+
+	for (n = h->length; n > 0 && !h->data[n - 1]; n--);
+
+	return n;
+}
 
-void hist_create(struct hist *h, double low, double high, double resolution)
+/** Calculate the layout of the buckets without allocating them. */
+static void hist_layout(struct hist *h, double low, double high, int digits)
 {
+	int buckets, magnitude;
+	uint64_t single, untrackable;
+
+	if (low <= 0 || high <= low || digits < 1 || digits > 5)
+		error(-1, 0, "Invalid histogram range: %g - %g with %d digits", low, high, digits);
+
 	h->low = low;
 	h->high = high;
-	h->resolution = resolution;
-	h->length = (high - low) / resolution;
-	h->data = alloc(h->length * sizeof(unsigned));
-	
+	h->digits = digits;
+	h->scale = 1 / low;
+	h->max = high * h->scale;
+
+	/* All values below 2 * 10^digits are counted exactly */
+	for (single = 2; digits--; single *= 10);
+	for (magnitude = 0; (1ULL << magnitude) < single; magnitude++);
+
+	h->magnitude = magnitude - 1;
+	h->mask = (1ULL << magnitude) - 1;
+
+	for (buckets = 1, untrackable = 1ULL << magnitude; untrackable <= h->max; untrackable <<= 1)
+		buckets++;
+
+	h->length = (buckets + 1) << h->magnitude;
+}
+
+void hist_create(struct hist *h, double low, double high, int digits)
+{
+	hist_layout(h, low, high, digits);
+
+	h->data = alloc(h->length * sizeof(hist_cnt_t));
+
 	hist_reset(h);
 }
 
@@ -37,39 +100,27 @@ void hist_destroy(struct hist *h)
 
 void hist_put(struct hist *h, double value)
 {
-	int idx = INDEX(h, value);
-	
 	/* Update min/max */
 	if (value > h->highest)
 		h->highest = value;
 	if (value < h->lowest)
 		h->lowest = value;
-	
+
+	h->total++;
+	h->sum += value;
+	h->sum2 += value * value;
+
 	/* Check bounds and increment */
-	if      (idx >= h->length)
-		h->higher++;
-	else if (idx < 0)
+	if (value < 0)
 		h->lower++;
-	else
-		h->data[idx]++;
-	
-	h->total++;
-	
-	/* Online / running calculation of variance and mean
-	 *  by Donald Knuth’s Art of Computer Programming, Vol 2, page 232, 3rd edition */
-	if (h->total == 1) {
-		h->_m[1] = h->_m[0] = value;
-		h->_s[1] = 0.0;
-	}
 	else {
-		h->_m[0] = h->_m[1] + (value - h->_m[1]) / h->total;
-		h->_s[0] = h->_s[1] + (value - h->_m[1]) * (value - h->_m[0]);
-   
-		// set up for next iteration
-		h->_m[1] = h->_m[0]; 
-		h->_s[1] = h->_s[0];
+		uint64_t v = value * h->scale;
+
+		if (v > h->max)
+			h->higher++;
+		else
+			h->data[hist_index(h, v)]++;
 	}
-	
 }
 
 void hist_reset(struct hist *h)
@@ -77,21 +128,30 @@ void hist_reset(struct hist *h)
 	h->total = 0;
 	h->higher = 0;
 	h->lower = 0;
-	
-	h->highest = DBL_MIN;
+
+	h->sum = 0;
+	h->sum2 = 0;
+
+	h->highest = -DBL_MAX;
 	h->lowest = DBL_MAX;
-	
-	memset(h->data, 0, h->length * sizeof(unsigned));
+
+	memset(h->data, 0, h->length * sizeof(hist_cnt_t));
 }
 
 double hist_mean(struct hist *h)
 {
-	return (h->total > 0) ? h->_m[0] : 0.0;
+	return (h->total > 0) ? h->sum / h->total : 0.0;
 }
 
 double hist_var(struct hist *h)
 {
-	return (h->total > 1) ? h->_s[0] / (h->total - 1) : 0.0;
+	if (h->total < 2)
+		return 0.0;
+
+	double var = (h->sum2 - h->sum * h->sum / h->total) / (h->total - 1);
+
+	/* Rounding errors */
+	return var > 0 ? var : 0.0;
 }
 
 double hist_stddev(struct hist *h)
@@ -99,21 +159,58 @@ double hist_stddev(struct hist *h)
 	return sqrt(hist_var(h));
 }
 
+double hist_value(struct hist *h, int i)
+{
+	uint64_t width;
+
+	return hist_index_value(h, i, &width) / h->scale;
+}
+
+double hist_percentile(struct hist *h, double percentile)
+{
+	uint64_t width, v;
+	hist_cnt_t rank, seen = h->lower;
+
+	if (h->total == 0)
+		return 0.0;
+
+	rank = ceil(percentile / 100 * h->total);
+	if (rank < 1)
+		rank = 1;
+
+	if (rank <= seen)
+		return h->lowest;
+
+	for (int i = 0; i < h->length; i++) {
+		seen += h->data[i];
+
+		if (seen >= rank) {
+			v = hist_index_value(h, i, &width);
+
+			return MIN((v + width) / h->scale, h->highest);
+		}
+	}
+
+	return h->highest;
+}
+
 void hist_print(struct hist *h, FILE *f)
 {
-	fprintf(f, "Total: %u values\n", h->total);
+	fprintf(f, "Total: %" PRIu64 " values\n", h->total);
 	fprintf(f, "Highest value: %f\n", h->highest);
 	fprintf(f, "Lowest  value: %f\n", h->lowest);
 	fprintf(f, "Mean: %f\n", hist_mean(h));
 	fprintf(f, "Variance: %f\n", hist_var(h));
 	fprintf(f, "Standard derivation: %f\n", hist_stddev(h));
+	fprintf(f, "Percentiles: p50 %f, p90 %f, p99 %f, p99.9 %f\n",
+		hist_percentile(h, 50), hist_percentile(h, 90), hist_percentile(h, 99), hist_percentile(h, 99.9));
 	if (h->higher > 0)
-		fprintf(f, "Missed:  %u values above %f\n", h->higher, h->high);
+		fprintf(f, "Missed:  %" PRIu64 " values above %f\n", h->higher, h->high);
 	if (h->lower > 0)
-		fprintf(f, "Missed:  %u values below %f\n", h->lower,  h->low);
-	
+		fprintf(f, "Missed:  %" PRIu64 " values below %f\n", h->lower,  0.0);
+
 	if (h->total - h->higher - h->lower > 0) {
-		char buf[(h->length + 1) * 8];
+		char buf[(hist_used(h) + 1) * 22];
 		hist_dump(h, buf, sizeof(buf));
 		fprintf(f, "Matlab data: %s\n", buf);
 
@@ -125,50 +222,513 @@ void hist_plot(struct hist *h, FILE *f)
 {
 	char buf[HIST_HEIGHT];
 	memset(buf, '#', sizeof(buf));
-	
-	hist_cnt_t max = 1;
 
-	/* Get highest bar */
-	for (int i = 0; i < h->length; i++) {
-		if (h->data[i] > max)
-			max = h->data[i];
+	int first, last = hist_used(h);
+	for (first = 0; first < last && !h->data[first]; first++);
+
+	/* Combine adjacent buckets to at most HIST_ROWS rows */
+	int rows = MIN(last - first, HIST_ROWS);
+	int step = rows ? (last - first + rows - 1) / rows : 1;
+
+	hist_cnt_t max = 1, occur[rows + 1];
+
+	for (int r = 0; r < rows; r++) {
+		occur[r] = 0;
+
+		for (int i = first + r * step; i < MIN(first + (r + 1) * step, last); i++)
+			occur[r] += h->data[i];
+
+		/* Get highest bar */
+		if (occur[r] > max)
+			max = occur[r];
 	}
-	
+
 	/* Print plot */
 	fprintf(f, "%3s | %9s | %5s | %s\n", "#", "Value", "Occur", "Plot");
 	fprintf(f, "--------------------------------------------------------------------------------\n");
 
-	for (int i = 0; i < h->length; i++) {
-		int bar = HIST_HEIGHT * ((double) h->data[i] / max);
-		
-		fprintf(f, "%3u | %+5.2e | "     "%5u"  " | %.*s\n", i, VAL(h, i), h->data[i], bar, buf);
+	for (int r = 0; r < rows && first + r * step < last; r++) {
+		int bar = HIST_HEIGHT * ((double) occur[r] / max);
+
+		fprintf(f, "%3u | %+5.2e | "     "%5" PRIu64 " | %.*s\n", r, hist_value(h, first + r * step), occur[r], bar, buf);
 	}
 }
 
 void hist_dump(struct hist *h, char *buf, int len)
 {
-	*buf = 0;
+	int off, used = hist_used(h);
 
-	strap(buf, len, "[ ");
+	/* Keep track of the end of the string instead of searching it for every bucket like strap() */
+	off = snprintf(buf, len, "[ ");
 
-	for (int i = 0; i < h->length; i++)
-		strap(buf, len, "%u ", h->data[i]);
+	for (int i = 0; i < used && off < len; i++)
+		off += snprintf(buf + off, len - off, "%" PRIu64 " ", h->data[i]);
 
-	strap(buf, len, "]");
+	if (off < len)
+		snprintf(buf + off, len - off, "]");
 }
 
 void hist_matlab(struct hist *h, FILE *f)
 {
-	char buf[h->length * 8];
+	char buf[(hist_used(h) + 1) * 22];
 	hist_dump(h, buf, sizeof(buf));
-	
+
 	fprintf(f, "%lu = struct( ", time(NULL));
-	fprintf(f, "'min', %f, 'max', %f, ", h->low, h->high);
-	fprintf(f, "'ok', %u, too_high', %u, 'too_low', %u, ", h->total, h->higher, h->lower);
+	fprintf(f, "'min', %f, 'max', %f, 'digits', %d, ", h->low, h->high, h->digits);
+	fprintf(f, "'ok', %" PRIu64 ", too_high', %" PRIu64 ", 'too_low', %" PRIu64 ", ", h->total, h->higher, h->lower);
 	fprintf(f, "'highest', %f, 'lowest', %f, ", h->highest, h->lowest);
 	fprintf(f, "'mean', %f, ", hist_mean(h));
 	fprintf(f, "'var', %f, ", hist_var(h));
 	fprintf(f, "'stddev', %f, ", hist_stddev(h));
+	fprintf(f, "'p50', %f, 'p90', %f, 'p99', %f, 'p999', %f, ",
+		hist_percentile(h, 50), hist_percentile(h, 90), hist_percentile(h, 99), hist_percentile(h, 99.9));
 	fprintf(f, "'hist', %s ", buf);
 	fprintf(f, "),\n");
 }
+
+/** Little endian and variable length integers of the binary format. */
+static uint8_t * hist_put_u64(uint8_t *p, uint64_t v)
+{
+	for (int i = 0; i < 8; i++)
+		*p++ = v >> (8 * i);
+
+	return p;
+}
+
+static const uint8_t * hist_get_u64(const uint8_t *p, uint64_t *v)
+{
+	*v = 0;
+
+	for (int i = 0; i < 8; i++)
+		*v |= (uint64_t) *p++ << (8 * i);
+
+	return p;
+}
+
+static uint8_t * hist_put_double(uint8_t *p, double d)
+{
+	uint64_t v;
+
+	memcpy(&v, &d, sizeof(v));
+
+	return hist_put_u64(p, v);
+}
+
+static const uint8_t * hist_get_double(const uint8_t *p, double *d)
+{
+	uint64_t v;
+
+	p = hist_get_u64(p, &v);
+	memcpy(d, &v, sizeof(v));
+
+	return p;
+}
+
+/** ZigZag encoded LEB128 (see Protocol Buffers). */
+static uint8_t * hist_put_varint(uint8_t *p, int64_t s)
+{
+	uint64_t v = (uint64_t) s << 1 ^ (uint64_t) (s >> 63);
+
+	for (; v >= 0x80; v >>= 7)
+		*p++ = v | 0x80;
+
+	*p++ = v;
+
+	return p;
+}
+
+static const uint8_t * hist_get_varint(const uint8_t *p, const uint8_t *end, int64_t *s)
+{
+	uint64_t v = 0;
+
+	for (int shift = 0; p < end && shift < 64; shift += 7) {
+		v |= (uint64_t) (*p & 0x7F) << shift;
+
+		if (!(*p++ & 0x80)) {
+			*s = (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+
+			return p;
+		}
+	}
+
+	return NULL;
+}
+
+int hist_save(struct hist *h, FILE *f)
+{
+	int ret, used = hist_used(h);
+	uint8_t *buf, *p, *payload;
+
+	/* Every bucket needs at most 10 bytes */
+	buf = alloc(HIST_HEADER_LEN + 10 * used);
+
+	memcpy(buf, HIST_MAGIC, 4);
+	buf[4] = HIST_VERSION;
+	buf[5] = h->digits;
+
+	p = buf + 8;
+	p = hist_put_double(p, h->low);
+	p = hist_put_double(p, h->high);
+	p = hist_put_double(p, h->highest);
+	p = hist_put_double(p, h->lowest);
+	p = hist_put_double(p, h->sum);
+	p = hist_put_double(p, h->sum2);
+	p = hist_put_u64(p, h->total);
+	p = hist_put_u64(p, h->higher);
+	p = hist_put_u64(p, h->lower);
+	p = hist_put_u64(p, used);
+
+	/* Runs of empty buckets are stored as their negative length */
+	payload = p += 8;
+
+	for (int i = 0, j; i < used; i = j) {
+		if (h->data[i]) {
+			p = hist_put_varint(p, h->data[i]);
+			j = i + 1;
+		}
+		else {
+			for (j = i + 1; j < used && !h->data[j]; j++);
+
+			p = hist_put_varint(p, -(int64_t) (j - i));
+		}
+	}
+
+	hist_put_u64(payload - 8, p - payload);
+
+	ret = fwrite(buf, p - buf, 1, f) == 1 ? 0 : -1;
+
+	free(buf);
+
+	return ret;
+}
+
+int hist_load(struct hist *h, FILE *f)
+{
+	int digits;
+	uint64_t total, higher, lower, used, len;
+	double low, high;
+	uint8_t hdr[HIST_HEADER_LEN];
+	const uint8_t *p = hdr + 8;
+
+	if (fread(hdr, sizeof(hdr), 1, f) != 1)
+		return -1;
+
+	if (memcmp(hdr, HIST_MAGIC, 4) || hdr[4] != HIST_VERSION)
+		return -1;
+
+	digits = hdr[5];
+
+	p = hist_get_double(p, &low);
+	p = hist_get_double(p, &high);
+
+	if (low <= 0 || high <= low || digits < 1 || digits > 5)
+		return -1;
+
+	hist_create(h, low, high, digits);
+
+	p = hist_get_double(p, &h->highest);
+	p = hist_get_double(p, &h->lowest);
+	p = hist_get_double(p, &h->sum);
+	p = hist_get_double(p, &h->sum2);
+	p = hist_get_u64(p, &total);
+	p = hist_get_u64(p, &higher);
+	p = hist_get_u64(p, &lower);
+	p = hist_get_u64(p, &used);
+	p = hist_get_u64(p, &len);
+
+	h->total = total;
+	h->higher = higher;
+	h->lower = lower;
+
+	if (used > h->length || len > 10 * used)
+		goto fail;
+
+	uint8_t *payload = alloc(len + 1);
+
+	if (len && fread(payload, len, 1, f) != 1)
+		goto fail_payload;
+
+	const uint8_t *q = payload, *end = payload + len;
+
+	for (uint64_t i = 0; i < used;) {
+		int64_t v;
+
+		q = hist_get_varint(q, end, &v);
+		if (!q)
+			goto fail_payload;
+
+		if (v < 0)
+			i += -v;
+		else if (v > 0)
+			h->data[i++] = v;
+	}
+
+	free(payload);
+
+	return 0;
+
+fail_payload:
+	free(payload);
+fail:
+	hist_destroy(h);
+
+	return -1;
+}
+
+int hist_merge(struct hist *dst, const struct hist *src)
+{
+	if (dst->low != src->low || dst->digits != src->digits)
+		return -1;
+
+	/* Both use the same layout. Only the number of buckets differs */
+	if (src->length > dst->length) {
+		dst->data = realloc(dst->data, src->length * sizeof(hist_cnt_t));
+		if (!dst->data)
+			error(-1, 0, "Failed to allocate memory");
+
+		memset(dst->data + dst->length, 0, (src->length - dst->length) * sizeof(hist_cnt_t));
+
+		dst->length = src->length;
+		dst->high = src->high;
+		dst->max = src->max;
+	}
+
+	for (int i = 0; i < src->length; i++)
+		dst->data[i] += src->data[i];
+
+	if (src->highest > dst->highest)
+		dst->highest = src->highest;
+	if (src->lowest < dst->lowest)
+		dst->lowest = src->lowest;
+
+	dst->total += src->total;
+	dst->higher += src->higher;
+	dst->lower += src->lower;
+
+	dst->sum += src->sum;
+	dst->sum2 += src->sum2;
+
+	return 0;
+}
+
+void hist_window_create(struct hist_window *w, double span, unsigned slots, double low, double high, int digits)
+{
+	if (span <= 0 || slots < 1)
+		error(-1, 0, "Invalid histogram window: %g seconds in %u slots", span, slots);
+
+	w->length = slots;
+	w->slots = alloc(slots * sizeof(struct hist));
+
+	for (unsigned i = 0; i < slots; i++)
+		hist_create(&w->slots[i], low, high, digits);
+
+	hist_create(&w->hist, low, high, digits);
+
+	w->head = 0;
+	w->interval = span / slots;
+	w->end = 0;
+}
+
+void hist_window_destroy(struct hist_window *w)
+{
+	for (unsigned i = 0; i < w->length; i++)
+		hist_destroy(&w->slots[i]);
+
+	hist_destroy(&w->hist);
+
+	free(w->slots);
+}
+
+/** Recalculate the counters and moments of the window from its slots.
+ *
+ * This also gets rid of the rounding errors of the sums.
+ */
+static void hist_window_sum(struct hist_window *w)
+{
+	struct hist *h = &w->hist;
+
+	h->total = h->higher = h->lower = 0;
+	h->sum = h->sum2 = 0;
+	h->highest = -DBL_MAX;
+	h->lowest = DBL_MAX;
+
+	for (unsigned i = 0; i < w->length; i++) {
+		struct hist *s = &w->slots[i];
+
+		h->total += s->total;
+		h->higher += s->higher;
+		h->lower += s->lower;
+		h->sum += s->sum;
+		h->sum2 += s->sum2;
+
+		if (s->highest > h->highest)
+			h->highest = s->highest;
+		if (s->lowest < h->lowest)
+			h->lowest = s->lowest;
+	}
+}
+
+void hist_window_rotate(struct hist_window *w, double now)
+{
+	unsigned n;
+
+	if (!w->end) {
+		w->end = now + w->interval;
+		return;
+	}
+
+	for (n = 0; now >= w->end && n < w->length; n++) {
+		w->head = (w->head + 1) % w->length;
+		w->end += w->interval;
+
+		struct hist *s = &w->slots[w->head];
+		if (!s->total)
+			continue;
+
+		for (int i = 0; i < s->length; i++)
+			w->hist.data[i] -= s->data[i];
+
+		hist_reset(s);
+	}
+
+	/* All slots are empty after a pause which is longer than the window */
+	if (now >= w->end)
+		w->end += (floor((now - w->end) / w->interval) + 1) * w->interval;
+
+	if (n)
+		hist_window_sum(w);
+}
+
+void hist_window_put(struct hist_window *w, double value, double now)
+{
+	hist_window_rotate(w, now);
+
+	hist_put(&w->slots[w->head], value);
+	hist_put(&w->hist, value);
+}
+
+/** Weights above this limit are rescaled before they overflow. */
+#define HIST_DECAY_RESCALE	1e100
+
+void hist_decay_create(struct hist_decay *d, double tau, double low, double high, int digits)
+{
+	if (tau <= 0)
+		error(-1, 0, "Invalid time constant of histogram: %g", tau);
+
+	hist_layout(&d->hist, low, high, digits);
+
+	d->hist.data = NULL;
+	d->hist.highest = -DBL_MAX;
+	d->hist.lowest = DBL_MAX;
+
+	d->data = alloc(d->hist.length * sizeof(double));
+	d->total = d->higher = d->lower = 0;
+	d->sum = d->sum2 = 0;
+
+	d->tau = tau;
+	d->landmark = 0;
+}
+
+void hist_decay_destroy(struct hist_decay *d)
+{
+	free(d->data);
+}
+
+/** Move the landmark to now so that new values weigh one again. */
+static void hist_decay_rescale(struct hist_decay *d, double now)
+{
+	double factor = exp(-(now - d->landmark) / d->tau);
+
+	for (int i = 0; i < d->hist.length; i++)
+		d->data[i] *= factor;
+
+	d->total *= factor;
+	d->higher *= factor;
+	d->lower *= factor;
+	d->sum *= factor;
+	d->sum2 *= factor;
+
+	d->landmark = now;
+}
+
+void hist_decay_put(struct hist_decay *d, double value, double now)
+{
+	struct hist *h = &d->hist;
+
+	if (!d->landmark)
+		d->landmark = now;
+
+	double weight = exp((now - d->landmark) / d->tau);
+	if (weight > HIST_DECAY_RESCALE) {
+		hist_decay_rescale(d, now);
+		weight = 1;
+	}
+
+	if (value > h->highest)
+		h->highest = value;
+	if (value < h->lowest)
+		h->lowest = value;
+
+	d->total += weight;
+	d->sum += weight * value;
+	d->sum2 += weight * value * value;
+
+	if (value < 0)
+		d->lower += weight;
+	else {
+		uint64_t v = value * h->scale;
+
+		if (v > h->max)
+			d->higher += weight;
+		else
+			d->data[hist_index(h, v)] += weight;
+	}
+}
+
+double hist_decay_mean(struct hist_decay *d)
+{
+	return d->total > 0 ? d->sum / d->total : 0.0;
+}
+
+double hist_decay_stddev(struct hist_decay *d)
+{
+	double mean = hist_decay_mean(d);
+
+	if (d->total <= 0)
+		return 0.0;
+
+	double var = d->sum2 / d->total - mean * mean;
+
+	/* Rounding errors */
+	return var > 0 ? sqrt(var) : 0.0;
+}
+
+double hist_decay_percentile(struct hist_decay *d, double percentile)
+{
+	struct hist *h = &d->hist;
+	uint64_t width, v;
+	double rank, seen = d->lower;
+
+	if (d->total <= 0)
+		return 0.0;
+
+	rank = percentile / 100 * d->total;
+
+	if (d->lower > 0 && rank <= seen)
+		return h->lowest;
+
+	for (int i = 0; i < h->length; i++) {
+		if (d->data[i] <= 0)
+			continue;
+
+		seen += d->data[i];
+
+		if (seen >= rank) {
+			v = hist_index_value(h, i, &width);
+
+			return MIN((v + width) / h->scale, h->highest);
+		}
+	}
+
+	return h->highest;
+}
@@ -1,4 +1,11 @@
 /** Histogram functions.
+ *
+ * The buckets are log-linear like the ones of HdrHistogram: the range is split
+ * into power-of-two intervals which are each split into the same number of
+ * linear sub-buckets. Hence every value is counted with a relative error below
+ * 10^-digits and a range of many orders of magnitude needs only a few KB.
+ *
+ * See: http://hdrhistogram.org/
  *
  * @file
  * @author Steffen Vogel <post@steffenvogel.de>
@@ -10,46 +17,123 @@
 #define _HIST_H_
 
 #include <stdio.h>
+#include <stdint.h>
 
 #define HIST_HEIGHT	75
 #define HIST_SEQ	17
 
-typedef unsigned hist_cnt_t;
+/** The binary format of hist_save(): a header of HIST_HEADER_LEN bytes followed by the counts of the buckets. */
+#define HIST_MAGIC	"\x93NPH"
+#define HIST_VERSION	1
+#define HIST_HEADER_LEN	(8 + 6 * 8 + 5 * 8)
+
+/** Maximum number of rows of hist_plot(). Adjacent buckets are combined into a single row. */
+#define HIST_ROWS	40
+
+/** Counts of merged histograms exceed 32 bits easily. The binary format stores 64 bits anyway. */
+typedef uint64_t hist_cnt_t;
 
 /** Histogram structure used to collect statistics. */
 struct hist {
-	/** The distance between two adjacent buckets. */
-	double resolution;
-	
-	/** The value of the highest bucket. */
-	double high;
-	/** The value of the lowest bucket. */
+	/** The smallest value which is told apart from zero. Values are counted as integer multiples of it. */
 	double low;
-	
+	/** The highest value which is counted in a bucket. */
+	double high;
+
+	/** The number of significant decimal digits of the bucket values. */
+	int digits;
+
+	/** The inverse of #low. */
+	double scale;
+
 	/** The highest value observed (may be higher than #high). */
 	double highest;
-	/** The lowest value observed (may be lower than #low). */
+	/** The lowest value observed (may be lower than zero). */
 	double lowest;
-	
+
 	/** The number of buckets in #data. */
 	int length;
 
-	/** Total number of counted values between #low and #high. */
+	/** Total number of counted values including the ones in #higher and #lower. */
 	hist_cnt_t total;
-	/** The number of values which are higher than #high. */ 
+	/** The number of values which are higher than #high. */
 	hist_cnt_t higher;
-	/** The number of values which are lower than #low. */
+	/** The number of values which are lower than zero. */
 	hist_cnt_t lower;
 
 	/** Pointer to dynamically allocated array of size length. */
 	hist_cnt_t *data;
-	
-	/** Private variables for online variance calculation */
-	double _m[2], _s[2];
+
+	/** The sum and the sum of the squares of all values. */
+	double sum;
+	double sum2;
+
+	/** Layout of the buckets: each power of two below #max is split into 2^#magnitude sub-buckets. */
+	int magnitude;
+	uint64_t mask;
+
+	/** #high as multiple of #low. */
+	uint64_t max;
+};
+
+/** The histogram of the values of the last #length intervals.
+ *
+ * Every interval has its own histogram. The counts of the oldest one are
+ * subtracted from the merged histogram #hist when it is reused. Hence moving
+ * the window does not depend on the number of values in it.
+ */
+struct hist_window {
+	/** All values of the window. Use hist_percentile(), hist_mean() etc. to query it. */
+	struct hist hist;
+
+	/** Ring buffer of #length histograms. */
+	struct hist *slots;
+	unsigned length;
+
+	/** The histogram of the current interval in #slots. */
+	unsigned head;
+
+	/** The length of a single interval in seconds. */
+	double interval;
+
+	/** The end of the current interval. Zero before the first value. */
+	double end;
+};
+
+/** A histogram whose counts decay exponentially with the age of the values.
+ *
+ * Values which have been counted #tau seconds ago weigh 1/e. Instead of
+ * decaying all buckets, the weight of a new value grows with e^(t / tau)
+ * (forward decay). The buckets are only rescaled when the weights get too
+ * large.
+ */
+struct hist_decay {
+	/** The layout of the buckets and the highest and lowest value. Its counts are not used. */
+	struct hist hist;
+
+	/** The weights of the buckets and of the values outside of them. */
+	double *data;
+	double total;
+	double higher;
+	double lower;
+
+	/** The weighted sum and sum of the squares of all values. */
+	double sum;
+	double sum2;
+
+	double tau;
+
+	/** The time at which a new value weighs one. Zero before the first value. */
+	double landmark;
 };
 
-/** Initialize struct hist with supplied values and allocate memory for buckets. */
-void hist_create(struct hist *h, double start, double end, double resolution);
+/** Initialize struct hist and allocate memory for buckets.
+ *
+ * @param low The smallest value which is told apart from zero.
+ * @param high The highest value which is counted in a bucket.
+ * @param digits The number of significant decimal digits (1 to 5).
+ */
+void hist_create(struct hist *h, double low, double high, int digits);
 
 /** Free the dynamically allocated memory. */
 void hist_destroy(struct hist *h);
@@ -69,6 +153,15 @@ double hist_mean(struct hist *h);
 /** Calculate the standard derivation of all counted values. */
 double hist_stddev(struct hist *h);
 
+/** Return the value below or at which percentile percent of all counted values are.
+ *
+ * The result is the upper bound of the bucket. Hence it is accurate to #digits digits.
+ */
+double hist_percentile(struct hist *h, double percentile);
+
+/** Return the lower bound of bucket i. */
+double hist_value(struct hist *h, int i);
+
 /** Print all statistical properties of distribution including a graphilcal plot of the histogram. */
 void hist_print(struct hist *h, FILE *f);
 
@@ -81,4 +174,51 @@ void hist_dump(struct hist *h, char *buf, int len);
 /** Prints Matlab struct containing all infos to file. */
 void hist_matlab(struct hist *h, FILE *f);
 
+/** Write the histogram in a compact binary format.
+ *
+ * The header holds the range, the moments and the counters outside of the buckets.
+ * The counts of the buckets follow as ZigZag varints. Runs of empty buckets are
+ * stored as a single negative length. All integers are little endian.
+ */
+int hist_save(struct hist *h, FILE *f);
+
+/** Read a histogram which has been written by hist_save() and allocate its buckets. */
+int hist_load(struct hist *h, FILE *f);
+
+/** Add all values of src to dst.
+ *
+ * The merge is associative and commutative. Hence partial results can be merged in any order.
+ * Both histograms need the same #low and #digits. The buckets of dst grow if src has a higher range.
+ *
+ * @retval -1 The buckets of both histograms do not match.
+ */
+int hist_merge(struct hist *dst, const struct hist *src);
+
+/** Initialize a window of span seconds which is split into slots intervals.
+ *
+ * All slots have the layout of hist_create().
+ */
+void hist_window_create(struct hist_window *w, double span, unsigned slots, double low, double high, int digits);
+
+void hist_window_destroy(struct hist_window *w);
+
+/** Drop all intervals which ended before now from the window. */
+void hist_window_rotate(struct hist_window *w, double now);
+
+/** Count a value which has been observed at now seconds. */
+void hist_window_put(struct hist_window *w, double value, double now);
+
+/** Initialize a decaying histogram with time constant tau seconds and the layout of hist_create(). */
+void hist_decay_create(struct hist_decay *d, double tau, double low, double high, int digits);
+
+void hist_decay_destroy(struct hist_decay *d);
+
+/** Count a value which has been observed at now seconds. */
+void hist_decay_put(struct hist_decay *d, double value, double now);
+
+/** The weighted mean, standard deviation and percentiles like the ones of struct hist. */
+double hist_decay_mean(struct hist_decay *d);
+double hist_decay_stddev(struct hist_decay *d);
+double hist_decay_percentile(struct hist_decay *d, double percentile);
+
 #endif /* _HIST_H_ */
@@ -0,0 +1,241 @@
+/** Table of in-flight probes with timeouts.
+ *
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdlib.h>
+#include <string.h>
+#include <error.h>
+
+#include "inflight.h"
+#include "utils.h"
+
+static uint64_t inflight_tick(const struct timespec *ts)
+{
+	return ((uint64_t) ts->tv_sec * 1000000000 + ts->tv_nsec) / INFLIGHT_RESOLUTION;
+}
+
+static uint32_t inflight_hash(uint16_t id, uint16_t seq, uint64_t counter)
+{
+	uint64_t h = ((uint64_t) id << 16 | seq) ^ (counter * 0x9E3779B97F4A7C15ULL);
+
+	/* Finalizer of MurmurHash3 */
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+
+	return h;
+}
+
+static void inflight_table_insert(uint32_t *table, uint32_t mask, uint32_t hash, uint32_t idx)
+{
+	uint32_t i = hash & mask;
+
+	while (table[i] != INFLIGHT_NONE)
+		i = (i + 1) & mask;
+
+	table[i] = idx;
+}
+
+/** Make room for n entries. */
+static void inflight_grow(struct inflight *f, uint32_t n)
+{
+	uint32_t old_mask = f->table_mask, *old = f->table;
+
+	/* Keep the load factor of the hash table below 50% */
+	if (2 * n > f->table_mask + 1) {
+		while (2 * n > f->table_mask + 1)
+			f->table_mask = 2 * (f->table_mask + 1) - 1;
+
+		f->table = alloc((f->table_mask + 1) * sizeof(uint32_t));
+		memset(f->table, 0xFF, (f->table_mask + 1) * sizeof(uint32_t));
+
+		for (uint32_t i = 0; i <= old_mask; i++) {
+			if (old[i] != INFLIGHT_NONE) {
+				struct inflight_entry *e = &f->entries[old[i]];
+
+				inflight_table_insert(f->table, f->table_mask, inflight_hash(e->id, e->seq, e->counter), old[i]);
+			}
+		}
+
+		free(old);
+	}
+
+	/* Entries are referenced by index. Hence we can move the pool */
+	if (n > f->allocated) {
+		uint32_t old_allocated = f->allocated;
+
+		while (n > f->allocated)
+			f->allocated *= 2;
+
+		f->entries = realloc(f->entries, f->allocated * sizeof(struct inflight_entry));
+		if (!f->entries)
+			error(-1, 0, "Failed to allocate memory");
+
+		/* Touch the new entries now and not when they are used */
+		memset(f->entries + old_allocated, 0, (f->allocated - old_allocated) * sizeof(struct inflight_entry));
+
+		for (uint32_t i = old_allocated; i < f->allocated; i++)
+			f->entries[i].next = i + 1 < f->allocated ? i + 1 : f->free;
+
+		f->free = old_allocated;
+	}
+}
+
+void inflight_init(struct inflight *f, double timeout)
+{
+	f->timeout = timeout * 1e9 / INFLIGHT_RESOLUTION + 1;
+
+	/* The wheel must span the timeout. Later deadlines would wrap around */
+	f->wheel_mask = 1;
+	while (f->wheel_mask <= f->timeout + 1)
+		f->wheel_mask = 2 * (f->wheel_mask + 1) - 1;
+
+	f->wheel = alloc((f->wheel_mask + 1) * sizeof(uint32_t));
+	memset(f->wheel, 0xFF, (f->wheel_mask + 1) * sizeof(uint32_t));
+	f->wheel_tick = 0;
+
+	f->table_mask = 63;
+	f->table = alloc((f->table_mask + 1) * sizeof(uint32_t));
+	memset(f->table, 0xFF, (f->table_mask + 1) * sizeof(uint32_t));
+
+	f->length = 0;
+	f->allocated = 32;
+	f->entries = alloc(f->allocated * sizeof(struct inflight_entry));
+
+	for (uint32_t i = 0; i < f->allocated; i++)
+		f->entries[i].next = i + 1 < f->allocated ? i + 1 : INFLIGHT_NONE;
+
+	f->free = 0;
+}
+
+void inflight_reserve(struct inflight *f, uint32_t n)
+{
+	inflight_grow(f, n);
+}
+
+void inflight_destroy(struct inflight *f)
+{
+	free(f->entries);
+	free(f->table);
+	free(f->wheel);
+}
+
+struct inflight_entry * inflight_add(struct inflight *f, uint16_t id, uint16_t seq, uint64_t counter, const struct timespec *ts, const struct timespec *mono)
+{
+	uint32_t idx, *head;
+	struct inflight_entry *e;
+
+	inflight_grow(f, f->length + 1);
+
+	idx = f->free;
+	e = &f->entries[idx];
+	f->free = e->next;
+
+	e->id = id;
+	e->seq = seq;
+	e->counter = counter;
+	e->ts = *ts;
+	e->target = NULL;
+	e->flags = 0;
+	e->deadline = inflight_tick(mono) + f->timeout;
+
+	/* Start the wheel with the first probe */
+	if (f->length == 0)
+		f->wheel_tick = inflight_tick(mono);
+
+	if (e->deadline < f->wheel_tick)
+		e->deadline = f->wheel_tick;
+
+	head = &f->wheel[e->deadline & f->wheel_mask];
+
+	e->prev = INFLIGHT_NONE;
+	e->next = *head;
+	if (*head != INFLIGHT_NONE)
+		f->entries[*head].prev = idx;
+	*head = idx;
+
+	inflight_table_insert(f->table, f->table_mask, inflight_hash(id, seq, counter), idx);
+
+	f->length++;
+
+	return e;
+}
+
+struct inflight_entry * inflight_lookup(struct inflight *f, uint16_t id, uint16_t seq, uint64_t counter)
+{
+	uint32_t i = inflight_hash(id, seq, counter) & f->table_mask;
+
+	for (; f->table[i] != INFLIGHT_NONE; i = (i + 1) & f->table_mask) {
+		struct inflight_entry *e = &f->entries[f->table[i]];
+
+		if (e->id == id && e->seq == seq && e->counter == counter)
+			return e;
+	}
+
+	return NULL;
+}
+
+void inflight_remove(struct inflight *f, struct inflight_entry *e)
+{
+	uint32_t idx = e - f->entries;
+	uint32_t i, j, k;
+
+	/* Unlink from timer wheel */
+	if (e->prev != INFLIGHT_NONE)
+		f->entries[e->prev].next = e->next;
+	else
+		f->wheel[e->deadline & f->wheel_mask] = e->next;
+
+	if (e->next != INFLIGHT_NONE)
+		f->entries[e->next].prev = e->prev;
+
+	/* Remove from hash table by shifting back the following cluster */
+	for (i = inflight_hash(e->id, e->seq, e->counter) & f->table_mask; f->table[i] != idx; i = (i + 1) & f->table_mask);
+
+	for (j = (i + 1) & f->table_mask; f->table[j] != INFLIGHT_NONE; j = (j + 1) & f->table_mask) {
+		struct inflight_entry *o = &f->entries[f->table[j]];
+
+		k = inflight_hash(o->id, o->seq, o->counter) & f->table_mask;
+
+		/* Move o into the hole if its home slot k is not within (i, j] */
+		if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j))) {
+			f->table[i] = f->table[j];
+			i = j;
+		}
+	}
+
+	f->table[i] = INFLIGHT_NONE;
+
+	/* Return to pool */
+	e->target = NULL;
+	e->next = f->free;
+	f->free = idx;
+
+	f->length--;
+}
+
+struct inflight_entry * inflight_expire(struct inflight *f, const struct timespec *now)
+{
+	uint64_t tick = inflight_tick(now);
+
+	/* Each slot needs to be visited only once */
+	if (tick > f->wheel_mask && f->wheel_tick < tick - f->wheel_mask)
+		f->wheel_tick = tick - f->wheel_mask;
+
+	for (; f->length > 0 && f->wheel_tick <= tick; f->wheel_tick++) {
+		uint32_t i = f->wheel[f->wheel_tick & f->wheel_mask];
+
+		/* Skip probes of later laps */
+		for (; i != INFLIGHT_NONE; i = f->entries[i].next) {
+			if (f->entries[i].deadline <= tick)
+				return &f->entries[i];
+		}
+	}
+
+	return NULL;
+}
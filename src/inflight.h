@@ -0,0 +1,122 @@
+/** Table of in-flight probes with timeouts.
+ *
+ * @file
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#ifndef _INFLIGHT_H_
+#define _INFLIGHT_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include "target.h"
+
+#define INFLIGHT_NONE		UINT32_MAX
+
+/** The send time is preliminary until the Kernel TX timestamp arrives. */
+#define INFLIGHT_TX_PENDING	(1 << 0)
+/** A reply has been received while the TX timestamp was pending. */
+#define INFLIGHT_RX_DONE	(1 << 1)
+/** The reply carries the receive and send time of the reflector. */
+#define INFLIGHT_REMOTE		(1 << 2)
+/** The probe has a Kernel TX timestamp from before the qdisc. */
+#define INFLIGHT_TX_SCHED	(1 << 3)
+/** The send time is the Kernel TX timestamp from the driver. */
+#define INFLIGHT_TX_SND		(1 << 4)
+
+/** The granularity of the timer wheel in nanoseconds. */
+#define INFLIGHT_RESOLUTION	1000000
+
+/** A probe which has been sent and not yet been answered. */
+struct inflight_entry {
+	/** The key of the probe. */
+	uint16_t id;
+	uint16_t seq;
+	uint64_t counter;
+
+	/** The target to which the probe was sent. */
+	struct target *target;
+
+	/** The send time of the probe. */
+	struct timespec ts;
+	/** The time at which the probe was due to be sent. */
+	struct timespec ts_sched;
+	/** The time at which the probe entered the qdisc (only valid with INFLIGHT_TX_SCHED). */
+	struct timespec ts_qdisc;
+	/** The user space send time and the user space arrival time of the reply. */
+	struct timespec ts_user[2];
+	/** The receive time of the reply (only valid with INFLIGHT_RX_DONE). */
+	struct timespec ts_rx;
+	/** The receive and send time of the reflector (only valid with INFLIGHT_REMOTE). */
+	struct timespec ts_remote[2];
+
+	/** See INFLIGHT_TX_PENDING, INFLIGHT_RX_DONE, INFLIGHT_REMOTE, INFLIGHT_TX_SCHED and INFLIGHT_TX_SND. */
+	int flags;
+
+	/** The tick of the timer wheel in which the probe expires.
+	 *  Unlike the timestamps above, it is on CLOCK_MONOTONIC. */
+	uint64_t deadline;
+
+	/** Links to the neighbours in the same slot of the timer wheel.
+	 *  Unused entries are linked into a free list by #next. */
+	uint32_t prev, next;
+};
+
+/** A hash table of in-flight probes which are expired by a timer wheel.
+ *
+ * All memory grows with the number of concurrently outstanding probes.
+ */
+struct inflight {
+	/** Pool of entries. Entries are referenced by their index. */
+	struct inflight_entry *entries;
+	uint32_t allocated;
+	uint32_t length;
+	uint32_t free;
+
+	/** Open addressing hash table of entry indices. */
+	uint32_t *table;
+	uint32_t table_mask;
+
+	/** Heads of the per-tick lists of entries. */
+	uint32_t *wheel;
+	uint32_t wheel_mask;
+
+	/** The next tick which has not yet been completely expired. */
+	uint64_t wheel_tick;
+
+	/** Number of ticks after which a probe is considered lost. */
+	uint64_t timeout;
+};
+
+/** Initialize an empty table for probes which time out after timeout seconds. */
+void inflight_init(struct inflight *f, double timeout);
+
+/** Allocate memory for n outstanding probes up front. */
+void inflight_reserve(struct inflight *f, uint32_t n);
+
+/** Free all memory of the table. */
+void inflight_destroy(struct inflight *f);
+
+/** Add a new probe with send time ts to the table.
+ *
+ * @param mono The send time on CLOCK_MONOTONIC from which the timeout counts.
+ *             Unlike ts, it does not jump when the wall clock is set.
+ */
+struct inflight_entry * inflight_add(struct inflight *f, uint16_t id, uint16_t seq, uint64_t counter, const struct timespec *ts, const struct timespec *mono);
+
+/** Find an outstanding probe. Returns NULL if there is none. */
+struct inflight_entry * inflight_lookup(struct inflight *f, uint16_t id, uint16_t seq, uint64_t counter);
+
+/** Remove a probe from the table. */
+void inflight_remove(struct inflight *f, struct inflight_entry *e);
+
+/** Return a probe which is expired at time now (on CLOCK_MONOTONIC) or NULL if there is none.
+ *
+ * The entry stays in the table until it is removed by inflight_remove().
+ */
+struct inflight_entry * inflight_expire(struct inflight *f, const struct timespec *now);
+
+#endif /* _INFLIGHT_H_ */
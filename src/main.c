@@ -18,6 +18,7 @@
 
 #include <errno.h>
 #include <error.h>
+#include <getopt.h>
 
 #include "config.h"
 
@@ -28,8 +29,12 @@ struct config cfg = {
 	.probe = {
 		.payload = 0,
 		.rate = 1,
+		.timeout = 1,
 		.warmup = 200,
-		.limit = 100
+		.limit = 100,
+		.workers = 1,
+		.window = 1000,
+		.span = 0
 	},
 	.dist = {
 		.format = FORMAT_TC,
@@ -45,6 +50,10 @@ struct config cfg = {
 int probe(int argc, char *argv[]);
 int emulate(int argc, char *argv[]);
 int dist(int argc, char *argv[]);
+int hist(int argc, char *argv[]);
+int reflect(int argc, char *argv[]);
+int xdp_reflect(int argc, char *argv[]);
+int observe(int argc, char *argv[]);
 
 void quit(int sig, siginfo_t *si, void *ptr)
 {
@@ -58,14 +67,29 @@ int main(int argc, char *argv[])
 		printf( "usage: %s CMD [OPTIONS]\n"
 			"  CMD     can be one of:\n\n"
 			"    probe IP PORT    Start TCP SYN+ACK RTT probes and write measurements data to STDOUT\n"
+			"    probe -T FILE    Probe all targets listed in FILE (one 'IP [PORT]' per line, '-' for STDIN)\n"
+			"                        and prefix each measurement with its target.\n"
 			"    emulate          Read measurement data from STDIN and configure Kernel (tc-netem(8)) on-the-fly.\n"
 			"                        This mode only uses the mean and standard deviation of of the previous samples\n"
 			"                        to configure the netem qdisc. This can be used to interactively replicate a network link.\n"
+			"                        Lines with only an RTT are collected in a window of -E seconds instead.\n"
+			"    reflect [PORT]   Answer UDP probes (-P udp) on PORT (default 862) and stamp them with the receive and send time\n"
+			"    xdp-reflect IF [PORT]\n"
+			"                     Answer UDP probes in the Kernel with an XDP or tc-bpf program attached to interface IF\n"
+			"                        and print the number of reflected probes every -i seconds.\n"
+			"    observe IF       Derive RTT samples passively from the ICMP echoes, TCP handshakes and timestamp options (RFC 7323)\n"
+			"                        of the traffic on interface IF. -j, -l and -t apply to the samples.\n"
 			"\n"
 			"    dist generate    Read measurement data from STDIN and write distribution file to STDOUT (see /usr/lib/tc/*.dist)\n"
 			"    dist load        Read measurement data from STDIN and configure Kernel (tc-netem(8))\n"
 			"                        These modes generate an inverse cumulated probability function (CDF) from the previously\n"
 			"                        recorded measurements. This iCDF can either be used by tc(8) or 'netem table'\n"
+			"                        Both also accept a histogram of 'hist create' or 'hist merge' instead of the measurements.\n"
+			"\n"
+			"    hist create      Read measurement data from STDIN and write a binary histogram of the delays to STDOUT\n"
+			"    hist merge FILE...\n"
+			"                     Combine the histograms of many hosts or runs with -j threads and write the result to STDOUT\n"
+			"    hist print       Read a binary histogram from STDIN and print its statistics and percentiles\n"
 			"\n"
 			"  OPTIONS:\n\n"
 			"    -m  N      apply emulation only to packet buffers with mark N\n"
@@ -77,7 +101,30 @@ int main(int argc, char *argv[])
 			"    -d IF      network interface\n"
 			"    -s FACTOR  a scaling factor for the dist subcommands\n"
 			"    -f FMT     the output format of the distribution tables\n"
+			"    -F COL     the column of the measurements which is read by dist and hist: a name from the header\n"
+			"                 (default current_rtt, or the first column without header) or its number counting from 1\n"
 			"    -p SZ      payload size for ICMP messages\n"
+			"    -T FILE    a list of targets which are probed concurrently\n"
+			"    -C FILE, --pcap FILE\n"
+			"               derive the samples of probe from the ICMP echoes and TCP handshakes and timestamps in a pcap or pcapng capture\n"
+			"    -P PROTO   the probe protocol: 'icmp' (default), 'ping' (unprivileged ICMP), 'tcp' or 'udp' (netem reflect)\n"
+			"    -j NUM     number of worker threads which share the targets or parse the measurements of dist and hist\n"
+			"    -B NAME    the backend of the probe loop: 'socket' (default), 'uring', 'ring' (AF_PACKET RX ring)\n"
+			"                 or 'xdp' (AF_XDP, single worker, ICMP only)\n"
+			"    -t SECS    probes which are not answered within SECS seconds are reported as lost\n"
+			"    -W NUM     number of probes over which the loss, reordering, corruption and duplication are estimated\n"
+			"    -E SECS    estimate the delay percentiles of probe and observe over the last SECS seconds (default none)\n"
+			"                 and the span of the window of emulate (default 60)\n"
+			"    -K AGING   how old delays are forgotten: 'window' (default, sliding window of -E seconds)\n"
+			"                 or 'decay' (exponentially decayed histogram with a time constant of -E seconds)\n"
+			"    -D DELAY   the delay which is read by emulate: 'rtt' (default, halved) or 'oneway' (e.g. the forward delay of UDP probes)\n"
+			"    -A PROC    the send times of the probes: 'periodic' (default) or 'poisson' (exponentially distributed gaps)\n"
+			"    -S USECS   busy-wait the last USECS microseconds before each probe for a more precise send time\n"
+			"    -H MODE    the delay in our own host: 'exclude' (default, Kernel timestamps) or 'include' (user space send and receive time)\n"
+			"    -R PRIO    real-time mode: run with SCHED_FIFO priority PRIO, lock all memory and busy-poll the sockets\n"
+			"    -c CPUS    pin the threads round-robin to a list of CPUs like '2,4-7'\n"
+			"    -L MODEL   the loss model of emulate: 'random' (default, loss_prob and loss_corr) or 'gemodel'\n"
+			"                 (Gilbert-Elliott model fitted to the gaps in the counter field)\n"
 			"\n"
 			"NetPlika %s (built on %s %s)\n"
 			" Copyright 2016-2018, Steffen Vogel <post@steffenvogel.de>\n", argv[0], VERSION, __DATE__, __TIME__);
@@ -99,8 +146,13 @@ int main(int argc, char *argv[])
 	srand(time(NULL));
 
 	/* Parse Arguments */
+	struct option long_options[] = {
+		{ "pcap", required_argument, NULL, 'C' },
+		{ NULL }
+	};
+
 	char c, *endptr;
-	while ((c = getopt(argc, argv, "h:m:M:i:l:d:r:s:f:w:p:")) != -1) {
+	while ((c = getopt_long(argc, argv, "h:m:M:i:l:d:r:s:f:F:w:p:T:t:B:P:j:D:W:E:K:L:A:S:R:c:H:C:", long_options, NULL)) != -1) {
 		switch (c) {
 			case 'm':
 				cfg.emulate.mark = strtoul(optarg, &endptr, 0);
@@ -129,6 +181,37 @@ int main(int argc, char *argv[])
 			case 'p':
 				cfg.probe.payload = strtoul(optarg, &endptr, 10);
 				goto check;
+			case 't':
+				cfg.probe.timeout = strtod(optarg, &endptr);
+				goto check;
+			case 'j':
+				cfg.probe.workers = strtoul(optarg, &endptr, 10);
+				goto check;
+			case 'W':
+				cfg.probe.window = strtoul(optarg, &endptr, 10);
+				goto check;
+			case 'E':
+				cfg.probe.span = strtod(optarg, &endptr);
+				goto check;
+			case 'K':
+				if (strcmp(optarg, "window") == 0)
+					cfg.probe.aging = AGING_WINDOW;
+				else if (strcmp(optarg, "decay") == 0)
+					cfg.probe.aging = AGING_DECAY;
+				else {
+					error(-1, 0, "Unknown aging: %s.", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'T':
+				cfg.probe.targets = strdup(optarg);
+				break;
+			case 'C':
+				cfg.probe.pcap = strdup(optarg);
+				break;
+			case 'F':
+				cfg.dist.column = strdup(optarg);
+				break;
 			case 'f':
 				if (strcmp(optarg, "villas") == 0)
 					cfg.dist.format = FORMAT_VILLAS;
@@ -139,6 +222,83 @@ int main(int argc, char *argv[])
 					exit(EXIT_FAILURE);
 				}
 				break;
+			case 'B':
+				if (strcmp(optarg, "socket") == 0)
+					cfg.probe.backend = BACKEND_SOCKET;
+				else if (strcmp(optarg, "uring") == 0)
+					cfg.probe.backend = BACKEND_URING;
+				else if (strcmp(optarg, "ring") == 0)
+					cfg.probe.backend = BACKEND_RING;
+				else if (strcmp(optarg, "xdp") == 0)
+					cfg.probe.backend = BACKEND_XDP;
+				else {
+					error(-1, 0, "Unknown backend: %s.", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'D':
+				if (strcmp(optarg, "rtt") == 0)
+					cfg.emulate.delay = DELAY_RTT;
+				else if (strcmp(optarg, "oneway") == 0)
+					cfg.emulate.delay = DELAY_ONEWAY;
+				else {
+					error(-1, 0, "Unknown delay: %s.", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'A':
+				if (strcmp(optarg, "periodic") == 0)
+					cfg.probe.arrival = ARRIVAL_PERIODIC;
+				else if (strcmp(optarg, "poisson") == 0)
+					cfg.probe.arrival = ARRIVAL_POISSON;
+				else {
+					error(-1, 0, "Unknown arrival process: %s.", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'S':
+				cfg.probe.spin = strtod(optarg, &endptr) / 1e6;
+				goto check;
+			case 'H':
+				if (strcmp(optarg, "exclude") == 0)
+					cfg.probe.host = HOST_EXCLUDE;
+				else if (strcmp(optarg, "include") == 0)
+					cfg.probe.host = HOST_INCLUDE;
+				else {
+					error(-1, 0, "Unknown host delay mode: %s.", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'R':
+				cfg.rt.priority = strtoul(optarg, &endptr, 10);
+				goto check;
+			case 'c':
+				cfg.rt.cpus = strdup(optarg);
+				break;
+			case 'L':
+				if (strcmp(optarg, "random") == 0)
+					cfg.emulate.loss = LOSS_RANDOM;
+				else if (strcmp(optarg, "gemodel") == 0)
+					cfg.emulate.loss = LOSS_GEMODEL;
+				else {
+					error(-1, 0, "Unknown loss model: %s.", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'P':
+				if (strcmp(optarg, "icmp") == 0)
+					cfg.probe.mode = PROBE_ICMP;
+				else if (strcmp(optarg, "ping") == 0)
+					cfg.probe.mode = PROBE_PING;
+				else if (strcmp(optarg, "tcp") == 0)
+					cfg.probe.mode = PROBE_TCP;
+				else if (strcmp(optarg, "udp") == 0)
+					cfg.probe.mode = PROBE_UDP;
+				else {
+					error(-1, 0, "Unknown protocol: %s.", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
 			case '?':
 				if (optopt == 'c')
 					error(-1, 0, "Option -%c requires an argument.", optopt);
@@ -166,6 +326,14 @@ check:
 		return emulate(argc-optind-1, argv+optind+1);
 	else if (!strcmp(cmd, "dist"))
 		return dist(argc-optind-1, argv+optind+1);
+	else if (!strcmp(cmd, "hist"))
+		return hist(argc-optind-1, argv+optind+1);
+	else if (!strcmp(cmd, "reflect"))
+		return reflect(argc-optind-1, argv+optind+1);
+	else if (!strcmp(cmd, "xdp-reflect"))
+		return xdp_reflect(argc-optind-1, argv+optind+1);
+	else if (!strcmp(cmd, "observe"))
+		return observe(argc-optind-1, argv+optind+1);
 	else
 		error(-1, 0, "Unknown command: %s", cmd);
 
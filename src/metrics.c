@@ -0,0 +1,278 @@
+/** Streaming estimation of loss, reordering, corruption and duplication.
+ *
+ * Each metric is a stream of binary samples which is kept in a sliding window.
+ * The number of events and of consecutive pairs of events in the window are
+ * updated when a sample enters or leaves the window. The lag-1 autocorrelation
+ * follows from both:
+ *
+ *     p = events / n
+ *     r = (pairs / (n - 1) - p^2) / (p * (1 - p))
+ *
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "utils.h"
+#include "metrics.h"
+
+static inline int metrics_window_get(struct metrics_window *w, unsigned i)
+{
+	return (w->bits[i / 64] >> (i % 64)) & 1;
+}
+
+void metrics_window_init(struct metrics_window *w, unsigned size)
+{
+	/* A pair needs at least two samples */
+	w->size = MAX(size, 2);
+	w->bits = alloc((w->size + 63) / 64 * sizeof(uint64_t));
+
+	w->length = 0;
+	w->head = 0;
+	w->events = 0;
+	w->pairs = 0;
+}
+
+void metrics_window_destroy(struct metrics_window *w)
+{
+	free(w->bits);
+}
+
+void metrics_window_put(struct metrics_window *w, int event)
+{
+	unsigned i = w->head;
+
+	event = !!event;
+
+	/* The oldest sample and its pair with the second oldest leave the window */
+	if (w->length == w->size) {
+		int oldest = metrics_window_get(w, i);
+		int second = metrics_window_get(w, (i + 1) % w->size);
+
+		w->events -= oldest;
+		w->pairs -= oldest && second;
+	}
+	else
+		w->length++;
+
+	if (w->length > 1)
+		w->pairs += event && metrics_window_get(w, (i + w->size - 1) % w->size);
+
+	w->events += event;
+
+	if (event)
+		w->bits[i / 64] |= 1ULL << (i % 64);
+	else
+		w->bits[i / 64] &= ~(1ULL << (i % 64));
+
+	w->head = (i + 1) % w->size;
+}
+
+double metrics_window_prob(struct metrics_window *w)
+{
+	return w->length ? (double) w->events / w->length : 0;
+}
+
+double metrics_window_corr(struct metrics_window *w)
+{
+	double p = metrics_window_prob(w);
+
+	if (w->length < 2 || p <= 0 || p >= 1)
+		return 0;
+
+	double r = ((double) w->pairs / (w->length - 1) - p * p) / (p * (1 - p));
+
+	return r < 0 ? 0 : r > 1 ? 1 : r;
+}
+
+void metrics_series_init(struct metrics_series *s, unsigned size)
+{
+	s->size = MAX(size, 1);
+	s->values = alloc(s->size * sizeof(double));
+
+	s->length = 0;
+	s->head = 0;
+	s->sum = 0;
+	s->sum2 = 0;
+}
+
+void metrics_series_destroy(struct metrics_series *s)
+{
+	free(s->values);
+}
+
+void metrics_series_put(struct metrics_series *s, double value)
+{
+	if (s->length == s->size) {
+		double oldest = s->values[s->head];
+
+		s->sum -= oldest;
+		s->sum2 -= oldest * oldest;
+	}
+	else
+		s->length++;
+
+	s->values[s->head] = value;
+	s->sum += value;
+	s->sum2 += value * value;
+
+	s->head = (s->head + 1) % s->size;
+
+	/* Recalculate the sums once per window to get rid of accumulated rounding errors */
+	if (s->head == 0 && s->length == s->size) {
+		s->sum = s->sum2 = 0;
+
+		for (unsigned i = 0; i < s->size; i++) {
+			s->sum += s->values[i];
+			s->sum2 += s->values[i] * s->values[i];
+		}
+	}
+}
+
+double metrics_series_mean(struct metrics_series *s)
+{
+	return s->length ? s->sum / s->length : 0;
+}
+
+double metrics_series_stddev(struct metrics_series *s)
+{
+	double mean = metrics_series_mean(s);
+
+	if (s->length < 2)
+		return 0;
+
+	double var = (s->sum2 - s->length * mean * mean) / (s->length - 1);
+
+	return var > 0 ? sqrt(var) : 0;
+}
+
+void metrics_init(struct metrics *m, unsigned size, double span, int decayed)
+{
+	metrics_window_init(&m->loss, size);
+	metrics_window_init(&m->reorder, size);
+	metrics_window_init(&m->corruption, size);
+	metrics_window_init(&m->duplication, size);
+
+	metrics_series_init(&m->delay, size);
+
+	m->highest = 0;
+	m->received = 0;
+
+	m->spanned = span > 0;
+	m->decayed = decayed;
+	if (!m->spanned)
+		return;
+	else if (decayed)
+		hist_decay_create(&m->span.decay, span, METRICS_SPAN_LOW, METRICS_SPAN_HIGH, METRICS_SPAN_DIGITS);
+	else
+		hist_window_create(&m->span.window, span, METRICS_SPAN_SLOTS, METRICS_SPAN_LOW, METRICS_SPAN_HIGH, METRICS_SPAN_DIGITS);
+}
+
+void metrics_destroy(struct metrics *m)
+{
+	metrics_window_destroy(&m->loss);
+	metrics_window_destroy(&m->reorder);
+	metrics_window_destroy(&m->corruption);
+	metrics_window_destroy(&m->duplication);
+
+	metrics_series_destroy(&m->delay);
+
+	if (!m->spanned)
+		return;
+	else if (m->decayed)
+		hist_decay_destroy(&m->span.decay);
+	else
+		hist_window_destroy(&m->span.window);
+}
+
+int metrics_arrival(struct metrics *m, uint64_t counter, int corrupt)
+{
+	int duplicate = 0, reordered = 0;
+
+	/* The counter of a corrupted reply can not be trusted. A flipped high bit would move #highest far ahead */
+	if (corrupt) {
+		metrics_window_put(&m->corruption, 1);
+		return 0;
+	}
+
+	/* Keep track of the last 64 probes like the anti-replay window of IPsec */
+	if (!m->received || counter > m->highest) {
+		uint64_t shift = counter - m->highest;
+
+		m->received = m->received && shift < 64 ? m->received << shift : 0;
+		m->received |= 1;
+		m->highest = counter;
+	}
+	else {
+		uint64_t age = m->highest - counter;
+
+		if (age >= 64)
+			reordered = 1; /* too old to tell whether we have seen it before */
+		else if (m->received & (1ULL << age))
+			duplicate = 1;
+		else {
+			m->received |= 1ULL << age;
+			reordered = 1;
+		}
+	}
+
+	metrics_window_put(&m->duplication, duplicate);
+
+	if (!duplicate) {
+		metrics_window_put(&m->reorder, reordered);
+		metrics_window_put(&m->corruption, 0);
+	}
+
+	return duplicate;
+}
+
+void metrics_delay(struct metrics *m, double delay, double now)
+{
+	metrics_window_put(&m->loss, 0);
+	metrics_series_put(&m->delay, delay);
+
+	if (!m->spanned)
+		return;
+	else if (m->decayed)
+		hist_decay_put(&m->span.decay, delay, now);
+	else
+		hist_window_put(&m->span.window, delay, now);
+}
+
+void metrics_loss(struct metrics *m)
+{
+	metrics_window_put(&m->loss, 1);
+}
+
+double metrics_span_mean(struct metrics *m)
+{
+	if (!m->spanned)
+		return 0;
+
+	return m->decayed
+		? hist_decay_mean(&m->span.decay)
+		: hist_mean(&m->span.window.hist);
+}
+
+double metrics_span_stddev(struct metrics *m)
+{
+	if (!m->spanned)
+		return 0;
+
+	return m->decayed
+		? hist_decay_stddev(&m->span.decay)
+		: hist_stddev(&m->span.window.hist);
+}
+
+double metrics_span_percentile(struct metrics *m, double percentile)
+{
+	if (!m->spanned)
+		return 0;
+
+	return m->decayed
+		? hist_decay_percentile(&m->span.decay, percentile)
+		: hist_percentile(&m->span.window.hist, percentile);
+}
@@ -0,0 +1,138 @@
+/** Streaming estimation of loss, reordering, corruption and duplication.
+ *
+ * @file
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stdint.h>
+
+#include "hist.h"
+
+/** The resolution and range of the delay percentiles in seconds and their significant digits. */
+#define METRICS_SPAN_LOW	1e-6
+#define METRICS_SPAN_HIGH	10
+#define METRICS_SPAN_DIGITS	2
+
+/** The number of intervals of the sliding window of the delay percentiles. */
+#define METRICS_SPAN_SLOTS	6
+
+/** The span of the window of emulate if none is configured (-E). */
+#define METRICS_SPAN_DEFAULT	60
+
+/** A sliding window over a stream of binary events (e.g. probe lost or not).
+ *
+ * The probability of an event and the lag-1 autocorrelation of the stream
+ * are updated in O(1) per sample.
+ */
+struct metrics_window {
+	/** Ring buffer of the last #size samples, one bit each. */
+	uint64_t *bits;
+
+	unsigned size;
+	unsigned length;
+
+	/** Index of the next sample in #bits. */
+	unsigned head;
+
+	/** Number of events and of pairs of consecutive events in the window. */
+	unsigned events;
+	unsigned pairs;
+};
+
+/** A sliding window over a stream of values with its mean and standard deviation. */
+struct metrics_series {
+	/** Ring buffer of the last #size values. */
+	double *values;
+
+	unsigned size;
+	unsigned length;
+	unsigned head;
+
+	double sum;
+	double sum2;
+};
+
+/** The estimators of a single target. */
+struct metrics {
+	struct metrics_window loss;
+	struct metrics_window reorder;
+	struct metrics_window corruption;
+	struct metrics_window duplication;
+
+	struct metrics_series delay;
+
+	/** The delays of the last seconds: either a sliding window or an exponentially decayed histogram.
+	 *  Only allocated if #spanned is set, as a window takes about 128 KiB. */
+	int spanned;
+	int decayed;
+	union {
+		struct hist_window window;
+		struct hist_decay decay;
+	} span;
+
+	/** The highest probe counter which has been received so far. */
+	uint64_t highest;
+
+	/** Bit n is set if a reply for the probe #highest - n has been received. */
+	uint64_t received;
+};
+
+/** Initialize the estimators with sliding windows of size samples.
+ *
+ * The percentiles of the delay are estimated over the last span seconds.
+ * If span is zero, no percentiles are estimated and they are reported as zero.
+ *
+ * @param decayed If non-zero, the delays decay exponentially with the time constant span instead.
+ */
+void metrics_init(struct metrics *m, unsigned size, double span, int decayed);
+
+/** Free all memory of the estimators. */
+void metrics_destroy(struct metrics *m);
+
+/** Account a reply which has arrived for the probe counter.
+ *
+ * Replies are reordered if a reply to a later probe has been received before.
+ * The Kernel discards most corrupted packets. Hence corruption can only
+ * be detected for replies whose checksum is verified by ourself.
+ *
+ * @param corrupt Non-zero if the reply did not pass its checksum.
+ *                Such replies only count as corrupted, as their counter may be corrupted too.
+ * @retval 1 The reply is a duplicate.
+ * @retval 0 Otherwise.
+ */
+int metrics_arrival(struct metrics *m, uint64_t counter, int corrupt);
+
+/** Account a probe which has been answered with delay seconds at time now or which got lost. */
+void metrics_delay(struct metrics *m, double delay, double now);
+void metrics_loss(struct metrics *m);
+
+/** The mean, standard deviation and percentiles of the delays of the last span seconds. */
+double metrics_span_mean(struct metrics *m);
+double metrics_span_stddev(struct metrics *m);
+double metrics_span_percentile(struct metrics *m, double percentile);
+
+void metrics_window_init(struct metrics_window *w, unsigned size);
+void metrics_window_destroy(struct metrics_window *w);
+void metrics_window_put(struct metrics_window *w, int event);
+
+/** The probability of an event in the window. */
+double metrics_window_prob(struct metrics_window *w);
+
+/** The lag-1 autocorrelation of the events in the window.
+ *
+ * Negative correlations are reported as zero as they can not be emulated by netem.
+ */
+double metrics_window_corr(struct metrics_window *w);
+
+void metrics_series_init(struct metrics_series *s, unsigned size);
+void metrics_series_destroy(struct metrics_series *s);
+void metrics_series_put(struct metrics_series *s, double value);
+double metrics_series_mean(struct metrics_series *s);
+double metrics_series_stddev(struct metrics_series *s);
+
+#endif /* _METRICS_H_ */
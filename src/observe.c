@@ -0,0 +1,663 @@
+/** Passive RTT measurements of TCP and ICMP traffic.
+ *
+ * Packets are read either live from the memory mapped receive ring of an AF_PACKET
+ * socket or offline from a pcap or pcapng capture (see capture.h). RTT samples are
+ * derived from:
+ *
+ *  - the time between a SYN and its SYN+ACK
+ *  - the time between the first segment with a TSval and the first segment of
+ *    the opposite direction which echoes it in its TSecr (RFC 7323)
+ *  - the time between an ICMP echo request and its reply
+ *
+ * All of them measure the RTT between the observation point and the host which answers.
+ * SYNs and echo requests which are not answered within the timeout are lost.
+ * Echo replies are reordered if a reply to a later request has been seen before.
+ * The pending SYNs, TSvals and echo requests are kept in a table of bounded size (see flows.h).
+ *
+ * With multiple workers, each one has its own table. Live, each worker has its own
+ * ring to which the Kernel distributes the packets by a symmetric flow hash.
+ * Offline, each worker walks the whole capture but only handles the packets of its
+ * share of the same hash. Hence both directions of a flow meet in the same table.
+ *
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <errno.h>
+#include <error.h>
+
+#include <pthread.h>
+#include <sys/poll.h>
+#include <sys/socket.h>
+
+#include <net/if.h>
+#include <arpa/inet.h>
+
+#include <linux/ip.h>
+#include <linux/if_ether.h>
+#include <linux/icmp.h>
+#include <linux/tcp.h>
+
+#include "config.h"
+#include "utils.h"
+#include "timing.h"
+#include "filter.h"
+#include "metrics.h"
+#include "flows.h"
+#include "ring.h"
+#include "capture.h"
+#include "rt.h"
+#include "observe.h"
+
+/** Bytes of each packet which are copied to the ring: the IP and TCP headers including their options. */
+#define OBSERVE_SNAPLEN		(60 + 60)
+
+/** Number of pending SYNs, TSvals and echo requests per worker. */
+#define OBSERVE_ENTRIES		(1 << 18)
+
+#define TCPOPT_EOL		0
+#define TCPOPT_NOP		1
+#define TCPOPT_TIMESTAMP	8
+
+/** Marks the highest sequence number in the data of a FLOWS_ECHO_SEQ entry as valid. */
+#define OBSERVE_SEQ_VALID	(1 << 16)
+
+/** State of a single worker. */
+struct observe {
+	int worker;
+	int cpu;
+
+	/** Only packets whose flow hash modulo #shards equals #worker are handled (offline). */
+	int shards;
+
+	/** Stop after this number of samples or never if zero. */
+	int limit;
+
+	/** Packets are either read from the ring or from the capture. */
+	struct ring ring;
+	const struct capture *capture;
+
+	struct flows flows;
+
+	/** The estimators of the RTT, loss and reordering (see metrics.h). */
+	struct metrics metrics;
+
+	/** Number of RTT samples of this worker. */
+	uint64_t samples;
+
+	/** Number of entries of #flows which have been reported as evicted. */
+	uint64_t evictions_reported;
+
+	/** Number of packets dropped by the Kernel because the ring was full. */
+	uint32_t drops;
+	uint32_t drops_reported;
+};
+
+/** Pass the headers of IPv4 packets which are not fragmented and either
+ *  ICMP messages or TCP segments which carry a SYN or options. */
+static int observe_filter(struct observe *o)
+{
+	int ret;
+	unsigned icmp;
+	struct filter f;
+
+	filter_init(&f);
+
+	/* The ring is bound to all protocols (see ring_bind()) */
+	filter_insn(&f, BPF_LD | BPF_H | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_PROTOCOL);
+	filter_require(&f, BPF_JEQ, ETH_P_IP);
+
+	/* The packets of the SOCK_DGRAM ring start with the IP header */
+	filter_insn(&f, BPF_LD | BPF_H | BPF_ABS, 0, 0, offsetof(struct iphdr, frag_off));
+	filter_reject(&f, BPF_JSET, 0x1FFF);
+
+	filter_insn(&f, BPF_LD | BPF_B | BPF_ABS, 0, 0, offsetof(struct iphdr, protocol));
+	icmp = filter_insn(&f, BPF_JMP | BPF_JEQ | BPF_K, 0, 0, IPPROTO_ICMP);
+	filter_require(&f, BPF_JEQ, IPPROTO_TCP);
+
+	/* X = length of IP header */
+	filter_insn(&f, BPF_LDX | BPF_B | BPF_MSH, 0, 0, 0);
+
+	/* SYN: skip the check of the data offset */
+	filter_insn(&f, BPF_LD | BPF_B | BPF_IND, 0, 0, 13);
+	filter_insn(&f, BPF_JMP | BPF_JSET | BPF_K, 3, 0, 0x02);
+
+	/* Data offset > 5 words */
+	filter_insn(&f, BPF_LD | BPF_B | BPF_IND, 0, 0, 12);
+	filter_require(&f, BPF_JGE, 0x60);
+
+	f.insns[icmp].jt = filter_insn(&f, BPF_RET | BPF_K, 0, 0, OBSERVE_SNAPLEN) - icmp - 1;
+
+	ret = filter_attach(&f, o->ring.sd);
+
+	filter_destroy(&f);
+
+	return ret;
+}
+
+/** Print the names of the fields of observe_print(). */
+static void observe_print_header(void)
+{
+	/* The same fields as the probe sub-command. Only the delay, loss and reordering are known */
+	printf("# current_rtt,mean,sigma,gap,loss_prob,loss_corr,reorder_prob,reorder_corr,"
+	       "corruption_prob,corruption_corr,duplication_prob,duplication_corr,counter_rx,counter,lag,tx_stack,tx_qdisc,rx_stack,p50,p90,p99,p999\n");
+}
+
+/** The counters of the output are shared by all workers like the ones of a single target.
+ *  They are advanced under the lock of stdout. Hence they increase from line to line. */
+static struct {
+	uint64_t samples;
+	uint64_t events;
+} observe_counters;
+
+/** Print a sample in the format of the probe sub-command. */
+static void observe_print(struct observe *o, double rtt)
+{
+	struct metrics *m = &o->metrics;
+
+	flockfile(stdout);
+
+	uint64_t counter_rx = observe_counters.samples++;
+	uint64_t counter = observe_counters.events++;
+
+	printf("%.10e,%.10e,%.10e,%d,%f,%f,%f,%f,%f,%f,%f,%f,%" PRIu64 ",%" PRIu64 ",%.10e,%.10e,%.10e,%.10e,%.10e,%.10e,%.10e,%.10e\n", rtt,
+		metrics_series_mean(&m->delay), metrics_series_stddev(&m->delay), 0,
+		metrics_window_prob(&m->loss), metrics_window_corr(&m->loss),
+		metrics_window_prob(&m->reorder), metrics_window_corr(&m->reorder),
+		0.0, 0.0, 0.0, 0.0,
+		counter_rx, counter, 0.0, 0.0, 0.0, 0.0,
+		metrics_span_percentile(m, 50), metrics_span_percentile(m, 90),
+		metrics_span_percentile(m, 99), metrics_span_percentile(m, 99.9));
+
+	funlockfile(stdout);
+}
+
+/** Loss records are comments like the ones of the probe sub-command. */
+static void observe_print_loss(struct observe *o)
+{
+	flockfile(stdout);
+
+	printf("#%" PRIu64 ",%" PRIu64 ",lost\n", observe_counters.samples, observe_counters.events++);
+
+	funlockfile(stdout);
+}
+
+/** Account an RTT sample which ends at time ts for a packet which has been seen at e->ts. */
+static void observe_sample(struct observe *o, struct flows_entry *e, const struct timespec *ts)
+{
+	double rtt = time_delta(&e->ts, ts);
+
+	flows_remove(&o->flows, e);
+
+	/* Samples which are older than the timeout are stale */
+	if (rtt < 0 || rtt > cfg.probe.timeout)
+		return;
+
+	/* A block may contain more samples than requested */
+	if (o->limit && o->samples >= o->limit)
+		return;
+
+	o->samples++;
+
+	metrics_delay(&o->metrics, rtt, time_to_double(ts));
+
+	observe_print(o, rtt);
+}
+
+/** Remove all entries which have not been answered until time now.
+ *
+ * SYNs and echo requests are reported as lost.
+ */
+static void observe_expire(struct observe *o, const struct timespec *now)
+{
+	struct flows_entry *e;
+
+	while ((e = flows_oldest(&o->flows)) && time_delta(&e->ts, now) > cfg.probe.timeout) {
+		if (e->key.kind == FLOWS_SYN || e->key.kind == FLOWS_ECHO) {
+			metrics_loss(&o->metrics);
+			observe_print_loss(o);
+		}
+
+		flows_remove(&o->flows, e);
+	}
+}
+
+/** Report the SYNs, TSvals and echo requests which have been evicted from the full table of flows.
+ *
+ * Their answers can not be matched anymore. Evicted SYNs and echo requests are neither samples nor lost.
+ */
+static void observe_evictions(struct observe *o)
+{
+	if (o->flows.evictions == o->evictions_reported)
+		return;
+
+	printf("#evicted,%" PRIu64 "\n", o->flows.evictions - o->evictions_reported);
+
+	o->evictions_reported = o->flows.evictions;
+}
+
+/** Find the timestamp option of a TCP header.
+ *
+ * @retval 0 The option has been found.
+ * @retval -1 Otherwise.
+ */
+static int observe_tsopt(const uint8_t *opt, unsigned len, uint32_t *tsval, uint32_t *tsecr)
+{
+	for (unsigned i = 0; i < len;) {
+		if (opt[i] == TCPOPT_EOL)
+			break;
+		else if (opt[i] == TCPOPT_NOP) {
+			i++;
+			continue;
+		}
+
+		if (i + 1 >= len || opt[i + 1] < 2 || i + opt[i + 1] > len)
+			break;
+
+		if (opt[i] == TCPOPT_TIMESTAMP && opt[i + 1] == 10) {
+			memcpy(tsval, opt + i + 2, 4);
+			memcpy(tsecr, opt + i + 6, 4);
+
+			*tsval = ntohl(*tsval);
+			*tsecr = ntohl(*tsecr);
+
+			return 0;
+		}
+
+		i += opt[i + 1];
+	}
+
+	return -1;
+}
+
+static void observe_tcp(struct observe *o, const struct iphdr *ip, const struct tcphdr *tcp, unsigned optlen, const struct timespec *ts)
+{
+	uint32_t tsval, tsecr;
+	struct flows_entry *e;
+
+	/* The key of this direction and of the opposite one */
+	struct flows_key key = {
+		.saddr = ip->saddr,
+		.daddr = ip->daddr,
+		.sport = tcp->source,
+		.dport = tcp->dest
+	};
+	struct flows_key rev = {
+		.saddr = ip->daddr,
+		.daddr = ip->saddr,
+		.sport = tcp->dest,
+		.dport = tcp->source
+	};
+
+	if (tcp->syn) {
+		if (tcp->ack) {
+			rev.kind = FLOWS_SYN;
+			rev.value = ntohl(tcp->ack_seq) - 1;
+
+			e = flows_lookup(&o->flows, &rev);
+			if (e)
+				observe_sample(o, e, ts);
+		}
+		else {
+			key.kind = FLOWS_SYN;
+			key.value = ntohl(tcp->seq);
+
+			flows_add(&o->flows, &key, ts);
+		}
+	}
+
+	if (observe_tsopt((const uint8_t *) (tcp + 1), optlen, &tsval, &tsecr))
+		return;
+
+	/* The SYN+ACK echoes the TSval of the SYN which has already been sampled */
+	if (tsecr && !tcp->syn) {
+		rev.kind = FLOWS_TSVAL;
+		rev.value = tsecr;
+
+		e = flows_lookup(&o->flows, &rev);
+		if (e)
+			observe_sample(o, e, ts);
+	}
+
+	/* Many segments carry the same TSval if the RTT is shorter than the tick of the peer.
+	 * Only the first one is added. Otherwise, a TSval whose sample has already been taken
+	 * would be added again with a later time and yield a sample which is too small. */
+	key.kind = FLOWS_TSVAL_LAST;
+	key.value = 0;
+
+	e = flows_add(&o->flows, &key, ts);
+	e->ts = *ts;
+
+	/* New entries start with zero. Hence a TSval of zero is never added */
+	if (e->data == tsval)
+		return;
+
+	e->data = tsval;
+
+	key.kind = FLOWS_TSVAL;
+	key.value = tsval;
+
+	flows_add(&o->flows, &key, ts);
+}
+
+static void observe_icmp(struct observe *o, const struct iphdr *ip, const struct icmphdr *icmp, const struct timespec *ts)
+{
+	int reordered;
+	struct flows_entry *e, *s;
+	uint16_t seq = ntohs(icmp->un.echo.sequence);
+
+	struct flows_key key = {
+		.saddr = ip->saddr,
+		.daddr = ip->daddr,
+		.sport = icmp->un.echo.id,
+		.kind = FLOWS_ECHO,
+		.value = seq
+	};
+
+	if (icmp->type == ICMP_ECHO) {
+		flows_add(&o->flows, &key, ts);
+
+		return;
+	}
+	else if (icmp->type != ICMP_ECHOREPLY)
+		return;
+
+	/* The highest sequence number which has been answered so far.
+	 * It is added before the request is looked up as adding might evict the request */
+	struct flows_key highest = key;
+
+	highest.saddr = ip->saddr;
+	highest.daddr = ip->daddr;
+	highest.kind = FLOWS_ECHO_SEQ;
+	highest.value = 0;
+
+	s = flows_add(&o->flows, &highest, ts);
+
+	key.saddr = ip->daddr;
+	key.daddr = ip->saddr;
+
+	e = flows_lookup(&o->flows, &key);
+	if (!e)
+		return;
+
+	s->ts = *ts;
+
+	reordered = s->data & OBSERVE_SEQ_VALID && (int16_t) (seq - s->data) < 0;
+	if (!reordered)
+		s->data = seq | OBSERVE_SEQ_VALID;
+
+	metrics_window_put(&o->metrics.reorder, reordered);
+
+	observe_sample(o, e, ts);
+}
+
+/** A hash of the addresses and ports of a packet which is the same for both directions. */
+static uint32_t observe_hash(const struct iphdr *ip, const uint8_t *l4)
+{
+	uint32_t ports;
+
+	if (ip->protocol == IPPROTO_TCP)
+		ports = ((const struct tcphdr *) l4)->source ^ ((const struct tcphdr *) l4)->dest;
+	else
+		ports = ((const struct icmphdr *) l4)->un.echo.id;
+
+	uint64_t h = (uint64_t) (ip->saddr ^ ip->daddr) << 16 ^ ports;
+
+	h *= 0x9E3779B97F4A7C15ULL;
+
+	return h >> 32;
+}
+
+static void observe_packet(struct observe *o, const uint8_t *buf, unsigned len, const struct timespec *ts)
+{
+	const struct iphdr *ip = (const struct iphdr *) buf;
+	if (len < sizeof(struct iphdr) || ip->ihl < 5 || len < ip->ihl * 4 + sizeof(struct icmphdr))
+		return;
+
+	/* Captures are not filtered */
+	if (ntohs(ip->frag_off) & 0x1FFF)
+		return;
+
+	const uint8_t *l4 = buf + ip->ihl * 4;
+	unsigned l4len = len - ip->ihl * 4;
+
+	if (ip->protocol == IPPROTO_TCP) {
+		if (l4len < sizeof(struct tcphdr))
+			return;
+	}
+	else if (ip->protocol != IPPROTO_ICMP)
+		return;
+
+	if (o->shards > 1 && observe_hash(ip, l4) % o->shards != o->worker)
+		return;
+
+	observe_expire(o, ts);
+
+	if (ip->protocol == IPPROTO_TCP) {
+		const struct tcphdr *tcp = (const struct tcphdr *) l4;
+		unsigned optlen = MIN(tcp->doff * 4, l4len) - MIN(tcp->doff * 4, sizeof(struct tcphdr));
+
+		observe_tcp(o, ip, tcp, optlen, ts);
+	}
+	else
+		observe_icmp(o, ip, (const struct icmphdr *) l4, ts);
+}
+
+static void observe_rx(struct observe *o)
+{
+	struct tpacket_block_desc *b;
+	struct tpacket_stats_v3 stats;
+	socklen_t len = sizeof(stats);
+
+	while ((b = ring_block(&o->ring))) {
+		struct tpacket3_hdr *h = (struct tpacket3_hdr *) ((uint8_t *) b + b->hdr.bh1.offset_to_first_pkt);
+
+		for (unsigned i = 0; i < b->hdr.bh1.num_pkts; i++) {
+			struct timespec ts = { h->tp_sec, h->tp_nsec };
+
+			observe_packet(o, (uint8_t *) h + h->tp_net, h->tp_snaplen, &ts);
+
+			h = (struct tpacket3_hdr *) ((uint8_t *) h + h->tp_next_offset);
+		}
+
+		/* The Kernel had to drop packets because the ring was full */
+		if (b->hdr.bh1.block_status & TP_STATUS_LOSING &&
+		    !getsockopt(o->ring.sd, SOL_PACKET, PACKET_STATISTICS, &stats, &len))
+			o->drops += stats.tp_drops;
+
+		ring_release(&o->ring, b);
+	}
+
+	if (o->drops != o->drops_reported) {
+		printf("#dropped,%u\n", o->drops - o->drops_reported);
+
+		o->drops_reported = o->drops;
+	}
+
+	observe_evictions(o);
+}
+
+static void * observe_run(void *ctx)
+{
+	char name[32];
+	struct observe *o = ctx;
+	struct pollfd pfd = { .fd = o->ring.sd, .events = POLLIN };
+
+	snprintf(name, sizeof(name), "worker %d", o->worker);
+
+	rt_thread(name, o->cpu);
+
+	while (!o->limit || o->samples < o->limit) {
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+			error(-1, errno, "Failed to poll");
+
+		observe_rx(o);
+	}
+
+	return NULL;
+}
+
+static void * observe_run_capture(void *ctx)
+{
+	int ret;
+	char name[32];
+	struct observe *o = ctx;
+	struct capture_cursor k;
+	struct capture_packet p;
+
+	snprintf(name, sizeof(name), "worker %d", o->worker);
+
+	rt_thread(name, o->cpu);
+
+	if (capture_cursor_init(&k, o->capture))
+		error(-1, 0, "Unknown capture format");
+
+	while ((ret = capture_next(&k, &p)) > 0)
+		observe_packet(o, p.data, p.len, &p.ts);
+
+	observe_evictions(o);
+
+	if (ret < 0 && o->worker == 0)
+		fprintf(stderr, "Capture is truncated or corrupted at offset %zu\n", k.offset);
+
+	return NULL;
+}
+
+/** Run the workers in their own threads unless there is only one. */
+static void observe_start(struct observe *os, int workers, void * (*run)(void *))
+{
+	int ret;
+
+	if (workers == 1) {
+		run(&os[0]);
+
+		return;
+	}
+
+	pthread_t *threads = alloc(workers * sizeof(pthread_t));
+
+	for (int i = 0; i < workers; i++) {
+		ret = pthread_create(&threads[i], NULL, run, &os[i]);
+		if (ret)
+			error(-1, ret, "Failed to create worker thread");
+	}
+
+	for (int i = 0; i < workers; i++)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+}
+
+int observe(int argc, char *argv[])
+{
+	int ifindex;
+
+	if (argc != 1)
+		error(-1, 0, "usage: netem observe IFACE");
+
+	ifindex = if_nametoindex(argv[0]);
+	if (!ifindex)
+		error(-1, errno, "Unknown interface: %s", argv[0]);
+
+	int workers = MAX(1, cfg.probe.workers);
+
+	struct observe *os = alloc(workers * sizeof(struct observe));
+
+	for (int i = 0; i < workers; i++) {
+		struct observe *o = &os[i];
+
+		o->worker = i;
+		o->cpu = rt_cpu(i);
+		o->shards = 1;
+		o->limit = cfg.probe.limit;
+
+		if (ring_init(&o->ring))
+			error(-1, errno, "Failed to setup AF_PACKET ring");
+
+		/* Filter before binding so that no other packets are queued */
+		if (observe_filter(o))
+			error(-1, errno, "Failed to attach socket filter");
+
+		/* Both directions of the flows are needed */
+		if (ring_bind(&o->ring, ifindex, 1))
+			error(-1, errno, "Failed to bind to interface: %s", argv[0]);
+
+		if (workers > 1 && ring_fanout(&o->ring, getpid() & 0xFFFF, NULL))
+			error(-1, errno, "Failed to join fanout group");
+
+		flows_init(&o->flows, OBSERVE_ENTRIES);
+		metrics_init(&o->metrics, cfg.probe.window, cfg.probe.span, cfg.probe.aging == AGING_DECAY);
+
+		char name[32];
+		snprintf(name, sizeof(name), "worker %d", i);
+
+		rt_busy_poll(name, o->ring.sd);
+	}
+
+	rt_lock();
+
+	observe_print_header();
+
+	observe_start(os, workers, observe_run);
+
+	for (int i = 0; i < workers; i++) {
+		flows_destroy(&os[i].flows);
+		metrics_destroy(&os[i].metrics);
+		ring_destroy(&os[i].ring);
+	}
+
+	free(os);
+
+	return 0;
+}
+
+int observe_capture(const char *path)
+{
+	struct capture c;
+
+	if (capture_open(&c, path))
+		error(-1, errno, "Failed to open capture: %s", path);
+
+	int workers = MAX(1, cfg.probe.workers);
+
+	struct observe *os = alloc(workers * sizeof(struct observe));
+
+	for (int i = 0; i < workers; i++) {
+		struct observe *o = &os[i];
+
+		o->worker = i;
+		o->cpu = rt_cpu(i);
+		o->shards = workers;
+		o->capture = &c;
+
+		flows_init(&o->flows, OBSERVE_ENTRIES);
+		metrics_init(&o->metrics, cfg.probe.window, cfg.probe.span, cfg.probe.aging == AGING_DECAY);
+	}
+
+	rt_lock();
+
+	observe_print_header();
+
+	observe_start(os, workers, observe_run_capture);
+
+	for (int i = 0; i < workers; i++) {
+		flows_destroy(&os[i].flows);
+		metrics_destroy(&os[i].metrics);
+	}
+
+	free(os);
+
+	capture_close(&c);
+
+	return 0;
+}
@@ -0,0 +1,18 @@
+/** Passive RTT measurements of TCP and ICMP traffic.
+ *
+ * @file
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#ifndef _OBSERVE_H_
+#define _OBSERVE_H_
+
+/** Derive RTT, loss and reordering samples from a pcap or pcapng capture.
+ *
+ * The samples are written to STDOUT in the format of the probe sub-command.
+ */
+int observe_capture(const char *path);
+
+#endif /* _OBSERVE_H_ */
@@ -0,0 +1,107 @@
+/** ICMP echo probes.
+ *
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stddef.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+
+#include <linux/ip.h>
+#include <linux/icmp.h>
+
+#include "config.h"
+#include "utils.h"
+#include "filter.h"
+#include "probe.h"
+
+uint16_t probe_icmp_build(struct probe *p, struct target *t, char *buf)
+{
+	uint16_t seq = p->sequence++;
+
+	memset(buf, 0, p->len);
+
+	struct icmphdr *ichdr = (struct icmphdr *) buf;
+	struct icmppl *icpl = (struct icmppl *) (ichdr + 1);
+
+	ichdr->type = ICMP_ECHO;
+	ichdr->code = 0;
+	ichdr->checksum = 0;
+	ichdr->un.echo.id = htons(t->id);
+	ichdr->un.echo.sequence = htons(seq);
+
+	icpl->counter = t->counter_tx++;
+	icpl->id = t->id;
+
+	/* Ping sockets calculate the checksum themselves */
+	if (cfg.probe.mode != PROBE_PING)
+		ichdr->checksum = chksum_rfc1071((char *) ichdr, p->len);
+
+	return seq;
+}
+
+void probe_icmp_handle(struct probe *p, char *buf, ssize_t len, const struct timespec *ts)
+{
+	struct iphdr *ihdr = (struct iphdr *) buf;
+	struct icmphdr *ichdr = (struct icmphdr *) (buf + ihdr->ihl * 4);
+	struct icmppl *icpl = (struct icmppl *) (ichdr + 1);
+
+	/* The raw socket receives all ICMP packets of this host */
+	if (len < ihdr->ihl * 4 + sizeof(struct icmphdr) + sizeof(struct icmppl) || ichdr->type != ICMP_ECHOREPLY)
+		return;
+
+	struct target *t = target_list_lookup(&p->targets, ntohs(ichdr->un.echo.id));
+	if (!t || t->addr.sin_addr.s_addr != ihdr->saddr)
+		return;
+
+	/* Raw sockets receive ICMP messages before the Kernel verifies their checksum.
+	 * Truncated replies can not be verified. */
+	int corrupt = len == ntohs(ihdr->tot_len) && chksum_rfc1071((char *) ichdr, len - ihdr->ihl * 4);
+
+	probe_reply(p, t, ntohs(ichdr->un.echo.sequence), icpl->counter, ts, NULL, corrupt);
+}
+
+void probe_ping_handle(struct probe *p, char *buf, ssize_t len, const struct sockaddr_in *from, const struct timespec *ts)
+{
+	struct icmphdr *ichdr = (struct icmphdr *) buf;
+	struct icmppl *icpl = (struct icmppl *) (ichdr + 1);
+
+	/* The Kernel delivers only replies to our echo identifier */
+	if (len < sizeof(struct icmphdr) + sizeof(struct icmppl) || ichdr->type != ICMP_ECHOREPLY)
+		return;
+
+	struct target *t = target_list_lookup(&p->targets, icpl->id);
+	if (!t || t->addr.sin_addr.s_addr != from->sin_addr.s_addr)
+		return;
+
+	/* The Kernel discards messages with an invalid checksum */
+	probe_reply(p, t, ntohs(ichdr->un.echo.sequence), icpl->counter, ts, NULL, 0);
+}
+
+void probe_icmp_filter(struct probe *p, struct filter *f)
+{
+	uint32_t addrs[p->targets.length];
+
+	/* X = length of IP header */
+	filter_insn(f, BPF_LDX | BPF_B | BPF_MSH, 0, 0, 0);
+
+	filter_insn(f, BPF_LD | BPF_B | BPF_IND, 0, 0, offsetof(struct icmphdr, type));
+	filter_require(f, BPF_JEQ, ICMP_ECHOREPLY);
+
+	/* The echo identifier must belong to one of our targets */
+	filter_insn(f, BPF_LD | BPF_H | BPF_IND, 0, 0, offsetof(struct icmphdr, un.echo.id));
+	filter_insn(f, BPF_ALU | BPF_SUB | BPF_K, 0, 0, p->targets.id_base);
+	filter_insn(f, BPF_ALU | BPF_AND | BPF_K, 0, 0, 0xFFFF);
+	filter_reject(f, BPF_JGE, p->targets.length);
+
+	for (int i = 0; i < p->targets.length; i++)
+		addrs[i] = ntohl(p->targets.targets[i].addr.sin_addr.s_addr);
+
+	filter_insn(f, BPF_LD | BPF_W | BPF_ABS, 0, 0, offsetof(struct iphdr, saddr));
+	filter_ranges(f, addrs, p->targets.length);
+}
@@ -0,0 +1,217 @@
+/** Stateless TCP SYN probes.
+ *
+ * A SYN carries everything which is required to match its answer (SYN+ACK or RST):
+ *
+ *  - The source port is the identifier of the target (see target_list_lookup()).
+ *  - The initial sequence number is a cookie which is echoed by the
+ *    acknowledgement number of the answer:
+ *
+ *      31             16 15       8 7        0
+ *     +-----------------+----------+----------+
+ *     |     counter     |   time   |   MAC    |
+ *     +-----------------+----------+----------+
+ *
+ *    counter: the lower 16 bits of the per-target probe counter
+ *    time:    the send time in units of 2^24 ns (~16.8 ms), wraps after ~4.3 s
+ *    MAC:     SipHash of the addresses, ports, counter and time,
+ *             keyed by a secret which is drawn at startup
+ *
+ * Forged, stale or unrelated answers are discarded before the in-flight table
+ * is consulted. The Kernel answers SYN+ACKs with a RST as we never open a socket.
+ *
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stddef.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/socket.h>
+#include <sys/random.h>
+
+#include <arpa/inet.h>
+
+#include <linux/ip.h>
+#include <linux/tcp.h>
+
+#include "config.h"
+#include "utils.h"
+#include "filter.h"
+#include "probe.h"
+
+/** Resolution of the send time in the cookie (log2 of nanoseconds). */
+#define TCP_TIME_SHIFT	24
+
+struct phdr {
+	uint32_t source;
+	uint32_t destination;
+	uint8_t reserved;
+	uint8_t protocol;
+	uint16_t length;
+} __attribute__((packed));
+
+static uint8_t probe_tcp_time(const struct timespec *ts)
+{
+	uint64_t ns = ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+
+	return ns >> TCP_TIME_SHIFT;
+}
+
+static uint8_t probe_tcp_mac(struct probe *p, struct target *t, uint16_t seq, uint8_t time)
+{
+	struct {
+		uint32_t saddr;
+		uint32_t daddr;
+		uint16_t sport;
+		uint16_t dport;
+		uint16_t seq;
+		uint8_t time;
+	} __attribute__((packed)) msg = {
+		.saddr = t->saddr,
+		.daddr = t->addr.sin_addr.s_addr,
+		.sport = t->id,
+		.dport = t->addr.sin_port,
+		.seq = seq,
+		.time = time
+	};
+
+	return siphash(p->secret, &msg, sizeof(msg));
+}
+
+int probe_tcp_init(struct probe *p)
+{
+	int sd;
+	struct sockaddr_in dst, src;
+	socklen_t srclen;
+
+	if (getrandom(p->secret, sizeof(p->secret), 0) != sizeof(p->secret))
+		return -1;
+
+	/* The pseudo header requires the source address which the Kernel picks for each target */
+	sd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sd < 0)
+		return -1;
+
+	for (int i = 0; i < p->targets.length; i++) {
+		struct target *t = &p->targets.targets[i];
+
+		dst = t->addr;
+		dst.sin_port = htons(9); /* discard */
+
+		srclen = sizeof(src);
+		if (connect(sd, (struct sockaddr *) &dst, sizeof(dst)) ||
+		    getsockname(sd, (struct sockaddr *) &src, &srclen)) {
+			close(sd);
+			return -1;
+		}
+
+		t->saddr = src.sin_addr.s_addr;
+	}
+
+	close(sd);
+
+	return 0;
+}
+
+uint16_t probe_tcp_build(struct probe *p, struct target *t, char *buf)
+{
+	struct timespec now;
+	uint16_t seq = t->counter_tx++;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	uint8_t time = probe_tcp_time(&now);
+	uint32_t cookie = (uint32_t) seq << 16 | time << 8 | probe_tcp_mac(p, t, seq, time);
+
+	char pbuf[sizeof(struct phdr) + p->len];
+	struct phdr *phdr = (struct phdr *) pbuf;
+	struct tcphdr *thdr = (struct tcphdr *) (phdr + 1);
+
+	memset(pbuf, 0, sizeof(pbuf));
+
+	phdr->source = t->saddr;
+	phdr->destination = t->addr.sin_addr.s_addr;
+	phdr->protocol = IPPROTO_TCP;
+	phdr->length = htons(p->len);
+
+	thdr->source = htons(t->id);
+	thdr->dest = t->addr.sin_port;
+	thdr->seq = htonl(cookie);
+	thdr->syn = 1;
+	thdr->doff = sizeof(struct tcphdr) / 4;
+	thdr->window = htons(1024);
+	thdr->check = 0;
+
+	thdr->check = chksum_rfc1071(pbuf, sizeof(pbuf));
+
+	memcpy(buf, thdr, p->len);
+
+	return seq;
+}
+
+void probe_tcp_handle(struct probe *p, char *buf, ssize_t len, const struct timespec *ts)
+{
+	struct iphdr *ihdr = (struct iphdr *) buf;
+	struct tcphdr *thdr = (struct tcphdr *) (buf + ihdr->ihl * 4);
+
+	/* The raw socket receives all TCP segments of this host including our own SYNs */
+	if (len < ihdr->ihl * 4 + sizeof(struct tcphdr) || !thdr->ack || !(thdr->syn || thdr->rst))
+		return;
+
+	struct target *t = target_list_lookup(&p->targets, ntohs(thdr->dest));
+	if (!t || t->addr.sin_addr.s_addr != ihdr->saddr || t->addr.sin_port != thdr->source)
+		return;
+
+	uint32_t cookie = ntohl(thdr->ack_seq) - 1;
+	uint16_t seq = cookie >> 16;
+	uint8_t time = cookie >> 8;
+
+	if ((cookie & 0xFF) != probe_tcp_mac(p, t, seq, time))
+		return;
+
+	/* Answers which are older than the timeout can not be matched anymore */
+	unsigned age = (uint8_t) (probe_tcp_time(ts) - time);
+	if (age > cfg.probe.timeout * 1e9 / (1 << TCP_TIME_SHIFT) + 1)
+		return;
+
+	/* Reconstruct the full counter from its lower bits */
+	uint64_t counter = t->counter_tx - (uint16_t) (t->counter_tx - seq);
+
+	probe_reply(p, t, seq, counter, ts, NULL, 0);
+}
+
+void probe_tcp_filter(struct probe *p, struct filter *f)
+{
+	uint32_t values[p->targets.length];
+
+	/* X = length of IP header */
+	filter_insn(f, BPF_LDX | BPF_B | BPF_MSH, 0, 0, 0);
+
+	/* Only SYN+ACK or RST+ACK (flags are in byte 13 of the TCP header) */
+	filter_insn(f, BPF_LD | BPF_B | BPF_IND, 0, 0, 13);
+	filter_require(f, BPF_JSET, 0x10);
+	filter_require(f, BPF_JSET, 0x02 | 0x04);
+
+	/* The destination port must belong to one of our targets */
+	filter_insn(f, BPF_LD | BPF_H | BPF_IND, 0, 0, offsetof(struct tcphdr, dest));
+	filter_insn(f, BPF_ALU | BPF_SUB | BPF_K, 0, 0, p->targets.id_base);
+	filter_insn(f, BPF_ALU | BPF_AND | BPF_K, 0, 0, 0xFFFF);
+	filter_reject(f, BPF_JGE, p->targets.length);
+
+	for (int i = 0; i < p->targets.length; i++)
+		values[i] = ntohs(p->targets.targets[i].addr.sin_port);
+
+	filter_insn(f, BPF_LD | BPF_H | BPF_IND, 0, 0, offsetof(struct tcphdr, source));
+	filter_ranges(f, values, p->targets.length);
+
+	for (int i = 0; i < p->targets.length; i++)
+		values[i] = ntohl(p->targets.targets[i].addr.sin_addr.s_addr);
+
+	filter_insn(f, BPF_LD | BPF_W | BPF_ABS, 0, 0, offsetof(struct iphdr, saddr));
+	filter_ranges(f, values, p->targets.length);
+}
@@ -0,0 +1,59 @@
+/** UDP probes which are answered by 'netem reflect'.
+ *
+ * The reflector stamps its receive and send time into the payload (see struct udppl).
+ * This allows to subtract the time which a probe spent in the reflector from the RTT
+ * and to split the RTT into a forward and a reverse delay.
+ *
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <endian.h>
+
+#include <arpa/inet.h>
+
+#include "config.h"
+#include "probe.h"
+
+uint16_t probe_udp_build(struct probe *p, struct target *t, char *buf)
+{
+	uint16_t seq = p->sequence++;
+
+	memset(buf, 0, p->len);
+
+	struct udppl *upl = (struct udppl *) buf;
+
+	upl->magic = htonl(UDPPL_MAGIC);
+	upl->id = htons(t->id);
+	upl->seq = htons(seq);
+	upl->counter = t->counter_tx++;
+
+	return seq;
+}
+
+void probe_udp_handle(struct probe *p, char *buf, ssize_t len, const struct sockaddr_in *from, const struct timespec *ts)
+{
+	struct udppl *upl = (struct udppl *) buf;
+
+	if (len < sizeof(struct udppl) || upl->magic != htonl(UDPPL_MAGIC))
+		return;
+
+	struct target *t = target_list_lookup(&p->targets, ntohs(upl->id));
+	if (!t || t->addr.sin_addr.s_addr != from->sin_addr.s_addr || t->addr.sin_port != from->sin_port)
+		return;
+
+	uint64_t rx = be64toh(upl->ts_rx);
+	uint64_t tx = be64toh(upl->ts_tx);
+
+	struct timespec remote[2] = {
+		{ rx / 1000000000, rx % 1000000000 },
+		{ tx / 1000000000, tx % 1000000000 }
+	};
+
+	/* The Kernel discards datagrams with an invalid checksum */
+	probe_reply(p, t, ntohs(upl->seq), upl->counter, ts, remote, 0);
+}
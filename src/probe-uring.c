@@ -0,0 +1,335 @@
+/** io_uring(7) backend of the probe loop.
+ *
+ * Sends, TX timestamp reads from the error queue, receives and timer waits
+ * are all queued to a single ring. A single io_uring_enter(2) submits a whole
+ * tick of probes and waits for the next completions.
+ *
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <error.h>
+
+#include <sys/socket.h>
+#include <sys/poll.h>
+#include <netinet/in.h>
+
+#include <linux/errqueue.h>
+
+#include "probe.h"
+#include "uring.h"
+#include "ts.h"
+#include "timing.h"
+#include "config.h"
+#include "utils.h"
+
+/* The upper half of the user_data identifies the type of a request, the lower half its slot */
+#define URING_RX		(1ULL << 32)
+#define URING_ERR		(2ULL << 32)
+#define URING_TX		(3ULL << 32)
+#define URING_TIMER		(4ULL << 32)
+#define URING_POLL		(5ULL << 32)
+
+#define URING_TYPE(ud)		((ud) & ~0xFFFFFFFFULL)
+#define URING_SLOT(ud)		((ud) &  0xFFFFFFFFULL)
+
+/** Maximum number of sends which are queued at the same time. */
+#define URING_TX_SLOTS		(4 * PROBE_BATCH)
+
+/** Number of TX timestamps per probe: before the qdisc (SCHED) and at the driver (SND). */
+#define URING_TX_STAMPS		2
+
+/** The error queue read for stragglers which are signaled by POLLERR. */
+#define URING_ERR_STRAGGLER	(URING_TX_STAMPS * URING_TX_SLOTS)
+
+/** Number of outstanding receives.
+ *  Each probe causes up to three packets: the reply, its TX timestamp and on loopback the request itself. */
+#define URING_RX_SLOTS		(4 * PROBE_BATCH)
+
+struct uring_slot {
+	struct msghdr msgh;
+	struct iovec iov;
+	struct sockaddr_in addr;
+	char ctrl[TS_CONTROL_LEN];
+};
+
+/** Each worker thread has its own ring. */
+static __thread struct {
+	struct uring ring;
+
+	struct uring_slot rx[URING_RX_SLOTS];
+	struct uring_slot tx[URING_TX_SLOTS];
+
+	/** The probes of the TX slots. Probes which fail to send are reported by probe_unsent(). */
+	struct {
+		struct target *target;
+		uint16_t seq;
+		uint64_t counter;
+	} tx_probe[URING_TX_SLOTS];
+
+	/** Each send is linked with a read from the error queue per TX timestamp.
+	 *  The last slot is used for stragglers which are signaled by POLLERR. */
+	struct uring_slot err[URING_ERR_STRAGGLER + 1];
+
+	char rx_buf[URING_RX_SLOTS][PROBE_RX_LEN];
+
+	/** Buffer for URING_TX_SLOTS packets of probe::len bytes each. */
+	char *tx_buf;
+
+	/** Stack of unused TX slots. */
+	unsigned tx_free[URING_TX_SLOTS];
+	unsigned tx_free_len;
+
+	struct __kernel_timespec timeout;
+	int timer_armed;
+} ur;
+
+static struct io_uring_sqe * probe_uring_recv(struct probe *p, struct uring_slot *s, char *buf, size_t len, int flags, uint64_t ud)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(&ur.ring);
+	if (!sqe)
+		error(-1, 0, "io_uring submission queue overflow");
+
+	memset(&s->msgh, 0, sizeof(s->msgh));
+	memset(s->ctrl, 0, sizeof(s->ctrl));
+
+	s->iov.iov_base = buf;
+	s->iov.iov_len = len;
+
+	s->msgh.msg_name = len ? &s->addr : NULL;
+	s->msgh.msg_namelen = len ? sizeof(s->addr) : 0;
+	s->msgh.msg_iov = len ? &s->iov : NULL;
+	s->msgh.msg_iovlen = len ? 1 : 0;
+	s->msgh.msg_control = s->ctrl;
+	s->msgh.msg_controllen = sizeof(s->ctrl);
+
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = p->sd;
+	sqe->addr = (uintptr_t) &s->msgh;
+	sqe->len = 1;
+	sqe->msg_flags = flags;
+	sqe->user_data = ud;
+
+	return sqe;
+}
+
+/** Wait until the error queue contains timestamps which have not been read by the linked reads */
+static void probe_uring_poll(struct probe *p)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(&ur.ring);
+	if (!sqe)
+		error(-1, 0, "io_uring submission queue overflow");
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = p->sd;
+	sqe->poll32_events = POLLERR;
+	sqe->user_data = URING_POLL;
+}
+
+static void probe_uring_send(struct probe *p, struct target *t, const struct timespec *now)
+{
+	unsigned i = ur.tx_free[--ur.tx_free_len];
+	struct uring_slot *s = &ur.tx[i];
+	char *buf = ur.tx_buf + i * p->len;
+
+	struct io_uring_sqe *sqe = uring_get_sqe(&ur.ring);
+	if (!sqe)
+		error(-1, 0, "io_uring submission queue overflow");
+
+	uint64_t counter = t->counter_tx;
+	uint16_t seq = probe_build(p, t, buf);
+
+	ur.tx_probe[i].target = t;
+	ur.tx_probe[i].seq = seq;
+	ur.tx_probe[i].counter = counter;
+
+	memset(&s->msgh, 0, sizeof(s->msgh));
+
+	s->iov.iov_base = buf;
+	s->iov.iov_len = p->len;
+
+	s->msgh.msg_name = &t->addr;
+	s->msgh.msg_namelen = sizeof(struct sockaddr_in);
+	s->msgh.msg_iov = &s->iov;
+	s->msgh.msg_iovlen = 1;
+
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = p->sd;
+	sqe->addr = (uintptr_t) &s->msgh;
+	sqe->len = 1;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->user_data = URING_TX | i;
+
+	/* The software TX timestamps are usually queued before the send completes.
+	 * The error queue never signals POLLIN. Hence a blocking read of a missing timestamp
+	 * (e.g. no SND timestamp from the driver) would never complete. Later ones are stragglers */
+	for (unsigned j = 0; j < URING_TX_STAMPS; j++) {
+		unsigned k = i * URING_TX_STAMPS + j;
+
+		sqe = probe_uring_recv(p, &ur.err[k], NULL, 0, MSG_ERRQUEUE | MSG_DONTWAIT, URING_ERR | k);
+		if (j < URING_TX_STAMPS - 1)
+			sqe->flags = IOSQE_IO_LINK;
+	}
+
+	/* The Kernel TX timestamp is collected asynchronously from the error queue */
+	probe_sent(p, t, seq, counter, &t->next, now, 1);
+}
+
+static void probe_uring_timer(const struct timespec *until)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(&ur.ring);
+	if (!sqe)
+		error(-1, 0, "io_uring submission queue overflow");
+
+	ur.timeout.tv_sec = until->tv_sec;
+	ur.timeout.tv_nsec = until->tv_nsec;
+
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = (uintptr_t) &ur.timeout;
+	sqe->len = 1;
+	sqe->timeout_flags = IORING_TIMEOUT_ABS; /* on CLOCK_MONOTONIC like the deadlines of the schedule */
+	sqe->user_data = URING_TIMER;
+
+	ur.timer_armed = 1;
+}
+
+static void probe_uring_complete(struct probe *p, struct io_uring_cqe *cqe)
+{
+	struct timespec ts;
+	uint32_t key;
+	int type;
+	unsigned i = URING_SLOT(cqe->user_data);
+
+	switch (URING_TYPE(cqe->user_data)) {
+		case URING_RX:
+			if (cqe->res > 0) {
+				clock_gettime(CLOCK_REALTIME, &p->ts_user_rx);
+
+				if (ts_parse(&ur.rx[i].msgh, &ts, NULL, NULL, &p->drops))
+					ts = p->ts_user_rx;
+
+				probe_handle(p, ur.rx_buf[i], cqe->res, &ur.rx[i].addr, &ts);
+				probe_drops(p);
+			}
+			else if (cqe->res < 0 && cqe->res != -EAGAIN && cqe->res != -EINTR)
+				error(-1, -cqe->res, "Failed to receive reply");
+
+			probe_uring_recv(p, &ur.rx[i], ur.rx_buf[i], PROBE_RX_LEN, 0, cqe->user_data);
+			break;
+
+		case URING_ERR:
+			if (cqe->res >= 0) {
+				key = 0;
+				type = SCM_TSTAMP_SND;
+				if (!ts_parse(&ur.err[i].msgh, &ts, &key, &type, NULL))
+					probe_txts(p, key, type, &ts);
+			}
+			else if (cqe->res != -EAGAIN && cqe->res != -EINTR && cqe->res != -ECANCELED)
+				error(-1, -cqe->res, "Failed to receive TX timestamp");
+
+			/* Drain the stragglers until the error queue is empty. Then wait for the next ones */
+			if (i == URING_ERR_STRAGGLER) {
+				if (cqe->res >= 0)
+					probe_uring_recv(p, &ur.err[i], NULL, 0, MSG_ERRQUEUE | MSG_DONTWAIT, URING_ERR | i);
+				else
+					probe_uring_poll(p);
+			}
+			/* The slot is released after the last linked read */
+			else if (i % URING_TX_STAMPS == URING_TX_STAMPS - 1)
+				ur.tx_free[ur.tx_free_len++] = i / URING_TX_STAMPS;
+			break;
+
+		case URING_POLL:
+			probe_uring_recv(p, &ur.err[URING_ERR_STRAGGLER], NULL, 0, MSG_ERRQUEUE | MSG_DONTWAIT, URING_ERR | URING_ERR_STRAGGLER);
+			break;
+
+		case URING_TX:
+			/* E.g. the target is unreachable. Keep probing the others */
+			if (cqe->res < 0)
+				probe_unsent(p, ur.tx_probe[i].target, ur.tx_probe[i].seq, ur.tx_probe[i].counter, -cqe->res);
+
+			break; /* The slot is released after the linked error queue reads */
+
+		case URING_TIMER:
+			ur.timer_armed = 0;
+			sched_wakeup(&p->sched);
+			break;
+	}
+}
+
+int probe_uring(struct probe *p)
+{
+	int ret;
+	struct target *t;
+	struct timespec now, until, res = { 0, INFLIGHT_RESOLUTION };
+	struct io_uring_cqe *cqe;
+
+	/* Room for all receives, sends and the timer */
+	if (uring_init(&ur.ring, URING_RX_SLOTS + (1 + URING_TX_STAMPS) * URING_TX_SLOTS + 3))
+		return -1;
+
+	ur.tx_buf = alloc(URING_TX_SLOTS * p->len);
+
+	for (unsigned i = 0; i < URING_TX_SLOTS; i++)
+		ur.tx_free[i] = i;
+	ur.tx_free_len = URING_TX_SLOTS;
+
+	/* Keep a batch of receives outstanding */
+	for (unsigned i = 0; i < URING_RX_SLOTS; i++)
+		probe_uring_recv(p, &ur.rx[i], ur.rx_buf[i], PROBE_RX_LEN, 0, URING_RX | i);
+
+	probe_uring_poll(p);
+
+	while (sched_peek(&p->sched) || p->inflight.length > 0 || ur.tx_free_len < URING_TX_SLOTS) {
+		clock_gettime(CLOCK_MONOTONIC, &p->mono);
+		clock_gettime(CLOCK_REALTIME, &now);
+
+		/* Queue a batch of the probes which are due in this tick.
+		 * Larger batches would overflow the receive buffer before we reap the replies. */
+		for (int i = 0; (t = sched_peek(&p->sched)) && time_cmp(&t->next, &p->mono) <= 0 && ur.tx_free_len > 0 && i < PROBE_BATCH; i++) {
+			probe_uring_send(p, t, &now);
+
+			if (cfg.probe.limit && t->counter_tx >= cfg.probe.limit)
+				sched_remove(&p->sched);
+			else
+				sched_advance(&p->sched);
+		}
+
+		probe_expire(p, &p->mono);
+
+		/* Wake up for the next probe or the next tick of the timer wheel */
+		if (!ur.timer_armed) {
+			if (!t)
+				until = time_add(&p->mono, &res);
+			else if (time_cmp(&t->next, &p->mono) > 0)
+				until = sched_timer(&p->sched);
+
+			if (!t || time_cmp(&t->next, &p->mono) > 0)
+				probe_uring_timer(&until);
+		}
+
+		ret = uring_submit(&ur.ring, 1);
+		if (ret < 0)
+			error(-1, -ret, "Failed to submit to io_uring");
+
+		while ((cqe = uring_peek_cqe(&ur.ring))) {
+			probe_uring_complete(p, cqe);
+			uring_cqe_seen(&ur.ring);
+		}
+	}
+
+	/* Closing the ring cancels all outstanding receives */
+	uring_destroy(&ur.ring);
+
+	free(ur.tx_buf);
+
+	return 0;
+}
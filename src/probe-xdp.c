@@ -0,0 +1,421 @@
+/** AF_XDP backend of the probe loop.
+ *
+ * Complete Ethernet frames of the probes are built in the UMEM and put on the TX ring.
+ * A small XDP program redirects the replies to our socket. All other packets pass to the Kernel.
+ * The probes thereby bypass most of the network stack which would otherwise add to the RTT.
+ *
+ * Generic XDP does not provide timestamps in its metadata. The TX timestamp is taken
+ * when the frame shows up on the completion ring, the RX timestamp when the RX ring is polled.
+ *
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <error.h>
+#include <poll.h>
+
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <linux/ip.h>
+#include <linux/icmp.h>
+#include <linux/errqueue.h>
+#include <linux/ethtool.h>
+#include <linux/sockios.h>
+
+#include "probe.h"
+#include "bpf.h"
+#include "xsk.h"
+#include "route.h"
+#include "timing.h"
+#include "config.h"
+#include "utils.h"
+
+/** The first half of the UMEM is used for RX, the second half for TX. */
+#define XDP_TX_FRAMES	(XSK_FRAMES / 2)
+
+#define XDP_HDR_LEN	(sizeof(struct ethhdr) + sizeof(struct iphdr))
+
+static struct {
+	struct xsk xsk;
+
+	/** The XSKMAP, the redirect program and its attachment. */
+	int map;
+	int prog;
+	int link;
+
+	int ifindex;
+	uint8_t lladdr[ETH_ALEN];
+
+	/** Hardware address of the next hop of each target. */
+	uint8_t (*nexthops)[ETH_ALEN];
+
+	/** Stack of unused TX frames. */
+	unsigned tx_free[XDP_TX_FRAMES];
+	unsigned tx_free_len;
+
+	/** The OPT_ID like key of the probe in each TX frame (see probe_txts()). */
+	uint32_t tx_keys[XDP_TX_FRAMES];
+} xdp;
+
+/** Assemble a program which redirects ICMP echo replies to our targets to the socket of the RX queue. */
+static int probe_xdp_prog(struct probe *p)
+{
+	char log[4096];
+
+	struct bpf_insn insns[] = {
+		BPF_MOV64_REG(BPF_REG_6, BPF_REG_1),
+		BPF_LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, data)),
+		BPF_LDX_MEM(BPF_W, BPF_REG_3, BPF_REG_6, offsetof(struct xdp_md, data_end)),
+
+		/* Ethernet + IP without options + ICMP header */
+		BPF_MOV64_REG(BPF_REG_4, BPF_REG_2),
+		BPF_ALU64_IMM(BPF_ADD, BPF_REG_4, XDP_HDR_LEN + sizeof(struct icmphdr)),
+		BPF_JMP_REG(BPF_JGT, BPF_REG_4, BPF_REG_3, BPF_LABEL(0)),
+
+		BPF_LDX_MEM(BPF_H, BPF_REG_5, BPF_REG_2, offsetof(struct ethhdr, h_proto)),
+		BPF_ENDIAN(BPF_TO_BE, BPF_REG_5, 16),
+		BPF_JMP_IMM(BPF_JNE, BPF_REG_5, ETH_P_IP, BPF_LABEL(0)),
+
+		BPF_LDX_MEM(BPF_B, BPF_REG_5, BPF_REG_2, sizeof(struct ethhdr)),
+		BPF_JMP_IMM(BPF_JNE, BPF_REG_5, 0x45, BPF_LABEL(0)),
+
+		BPF_LDX_MEM(BPF_B, BPF_REG_5, BPF_REG_2, sizeof(struct ethhdr) + offsetof(struct iphdr, protocol)),
+		BPF_JMP_IMM(BPF_JNE, BPF_REG_5, IPPROTO_ICMP, BPF_LABEL(0)),
+
+		BPF_LDX_MEM(BPF_B, BPF_REG_5, BPF_REG_2, XDP_HDR_LEN + offsetof(struct icmphdr, type)),
+		BPF_JMP_IMM(BPF_JNE, BPF_REG_5, ICMP_ECHOREPLY, BPF_LABEL(0)),
+
+		/* The echo identifier must belong to one of our targets */
+		BPF_LDX_MEM(BPF_H, BPF_REG_5, BPF_REG_2, XDP_HDR_LEN + offsetof(struct icmphdr, un.echo.id)),
+		BPF_ENDIAN(BPF_TO_BE, BPF_REG_5, 16),
+		BPF_ALU64_IMM(BPF_SUB, BPF_REG_5, p->targets.id_base),
+		BPF_ALU64_IMM(BPF_AND, BPF_REG_5, 0xFFFF),
+		BPF_JMP_IMM(BPF_JGE, BPF_REG_5, p->targets.length, BPF_LABEL(0)),
+
+		/* return bpf_redirect_map(&map, ctx->rx_queue_index, XDP_PASS) */
+		BPF_LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, rx_queue_index)),
+		BPF_LD_MAP_FD(BPF_REG_1, xdp.map),
+		BPF_MOV64_IMM(BPF_REG_3, XDP_PASS),
+		BPF_EMIT_CALL(BPF_FUNC_redirect_map),
+		BPF_EXIT_INSN(),
+
+		/* Label 0: return XDP_PASS */
+		BPF_MOV64_IMM(BPF_REG_0, XDP_PASS),
+		BPF_EXIT_INSN()
+	};
+
+	unsigned len = sizeof(insns) / sizeof(insns[0]);
+
+	bpf_patch(insns, len, 0, len - 2);
+
+	xdp.prog = bpf_prog_load(BPF_PROG_TYPE_XDP, insns, len, log, sizeof(log));
+	if (xdp.prog < 0 && log[0])
+		fprintf(stderr, "%s", log);
+
+	return xdp.prog < 0 ? -1 : 0;
+}
+
+/** Find the interface and the hardware addresses for all targets. */
+static int probe_xdp_route(struct probe *p)
+{
+	int ifindex;
+	struct in_addr src, nexthop;
+
+	xdp.nexthops = alloc(p->targets.length * ETH_ALEN);
+
+	for (int i = 0; i < p->targets.length; i++) {
+		struct target *t = &p->targets.targets[i];
+
+		if (route_get(t->addr.sin_addr, &ifindex, &src, &nexthop))
+			return -1;
+
+		if (i == 0)
+			xdp.ifindex = ifindex;
+		else if (ifindex != xdp.ifindex) {
+			errno = EXDEV;
+			return -1;
+		}
+
+		t->saddr = src.s_addr;
+
+		if (route_neigh(ifindex, nexthop, t->addr.sin_addr, xdp.nexthops[i])) {
+			errno = EHOSTUNREACH;
+			return -1;
+		}
+	}
+
+	return route_link(xdp.ifindex, xdp.lladdr);
+}
+
+static void probe_xdp_send(struct probe *p, struct target *t, unsigned frame, uint32_t idx, const struct timespec *now)
+{
+	uint8_t *buf = xdp.xsk.umem + (XDP_TX_FRAMES + frame) * XSK_FRAME_SIZE;
+
+	struct ethhdr *eth = (struct ethhdr *) buf;
+	struct iphdr *ip = (struct iphdr *) (eth + 1);
+
+	memcpy(eth->h_dest, xdp.nexthops[t - p->targets.targets], ETH_ALEN);
+	memcpy(eth->h_source, xdp.lladdr, ETH_ALEN);
+	eth->h_proto = htons(ETH_P_IP);
+
+	memset(ip, 0, sizeof(struct iphdr));
+
+	ip->version = 4;
+	ip->ihl = sizeof(struct iphdr) / 4;
+	ip->tot_len = htons(sizeof(struct iphdr) + p->len);
+	ip->id = htons(p->sequence);
+	ip->frag_off = htons(0x4000); /* Don't fragment */
+	ip->ttl = 64;
+	ip->protocol = IPPROTO_ICMP;
+	ip->saddr = t->saddr;
+	ip->daddr = t->addr.sin_addr.s_addr;
+	ip->check = chksum_rfc1071((char *) ip, sizeof(struct iphdr));
+
+	uint64_t counter = t->counter_tx;
+	uint16_t seq = probe_build(p, t, (char *) (ip + 1));
+
+	struct xdp_desc *desc = xsk_ring_desc(&xdp.xsk.tx, idx);
+
+	desc->addr = (XDP_TX_FRAMES + frame) * XSK_FRAME_SIZE;
+	desc->len = XDP_HDR_LEN + p->len;
+	desc->options = 0;
+
+	/* The completion ring returns the frames in the order they have been sent */
+	xdp.tx_keys[frame] = p->tskey;
+
+	probe_sent(p, t, seq, counter, &t->next, now, 1);
+}
+
+/** Reclaim sent frames and take their TX timestamps. */
+static void probe_xdp_complete(struct probe *p)
+{
+	struct timespec now;
+	uint32_t cnt = xsk_ring_avail(&xdp.xsk.comp);
+	uint32_t idx = *xdp.xsk.comp.consumer;
+
+	if (!cnt)
+		return;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	for (uint32_t i = 0; i < cnt; i++) {
+		unsigned frame = *xsk_ring_addr(&xdp.xsk.comp, idx + i) / XSK_FRAME_SIZE - XDP_TX_FRAMES;
+
+		probe_txts(p, xdp.tx_keys[frame], SCM_TSTAMP_SND, &now);
+
+		xdp.tx_free[xdp.tx_free_len++] = frame;
+	}
+
+	xsk_ring_release(&xdp.xsk.comp, cnt);
+}
+
+/** Process all replies on the RX ring and give their frames back to the fill ring. */
+static void probe_xdp_rx(struct probe *p)
+{
+	struct timespec now;
+	uint32_t cnt = xsk_ring_avail(&xdp.xsk.rx);
+	uint32_t idx = *xdp.xsk.rx.consumer;
+	uint32_t fill = *xdp.xsk.fill.producer;
+
+	if (!cnt)
+		return;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	/* Replies are read by user space directly from the NIC. Hence there is no stack delay */
+	p->ts_user_rx = now;
+
+	for (uint32_t i = 0; i < cnt; i++) {
+		struct xdp_desc *desc = xsk_ring_desc(&xdp.xsk.rx, idx + i);
+		uint8_t *buf = xdp.xsk.umem + desc->addr;
+
+		struct iphdr *ip = (struct iphdr *) (buf + sizeof(struct ethhdr));
+		struct sockaddr_in from = {
+			.sin_family = AF_INET,
+			.sin_addr.s_addr = ip->saddr
+		};
+
+		if (desc->len > XDP_HDR_LEN)
+			probe_handle(p, (char *) ip, desc->len - sizeof(struct ethhdr), &from, &now);
+
+		/* There are as many RX frames as slots in the fill ring */
+		*xsk_ring_addr(&xdp.xsk.fill, fill + i) = desc->addr - desc->addr % XSK_FRAME_SIZE;
+	}
+
+	xsk_ring_release(&xdp.xsk.rx, cnt);
+	xsk_ring_submit(&xdp.xsk.fill, cnt);
+}
+
+/** The number of RX queues of the interface or 1 if the driver does not tell. */
+static unsigned probe_xdp_queues(int ifindex)
+{
+	int sd, ret;
+	struct ethtool_channels ch = { .cmd = ETHTOOL_GCHANNELS };
+	struct ifreq ifr = { .ifr_data = (void *) &ch };
+
+	if (!if_indextoname(ifindex, ifr.ifr_name))
+		return 1;
+
+	sd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sd < 0)
+		return 1;
+
+	ret = ioctl(sd, SIOCETHTOOL, &ifr);
+
+	close(sd);
+
+	return ret ? 1 : MAX(1, ch.rx_count + ch.combined_count);
+}
+
+static int probe_xdp_init(struct probe *p)
+{
+	int key = 0;
+	unsigned queues;
+	char name[IFNAMSIZ];
+
+	if (probe_xdp_route(p))
+		return -1;
+
+	/* Our socket is bound to queue 0 only. Replies which RSS steers to other queues would pass to the Kernel and get lost */
+	queues = probe_xdp_queues(xdp.ifindex);
+	if (queues > 1 && if_indextoname(xdp.ifindex, name)) {
+		fprintf(stderr, "AF_XDP needs a single RX queue, but %s has %u (see 'ethtool -L %s combined 1')\n", name, queues, name);
+
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	xdp.map = bpf_map_create(BPF_MAP_TYPE_XSKMAP, sizeof(int), sizeof(int), 1);
+	if (xdp.map < 0)
+		return -1;
+
+	if (probe_xdp_prog(p))
+		return -1;
+
+	if (xsk_init(&xdp.xsk, xdp.ifindex, 0))
+		return -1;
+
+	if (bpf_map_update(xdp.map, &key, &xdp.xsk.fd))
+		return -1;
+
+	xdp.link = bpf_xdp_attach(xdp.prog, xdp.ifindex, XDP_FLAGS_SKB_MODE);
+	if (xdp.link < 0)
+		return -1;
+
+	/* Hand all RX frames to the Kernel */
+	for (uint32_t i = 0; i < XSK_RING_SIZE; i++)
+		*xsk_ring_addr(&xdp.xsk.fill, i) = i * XSK_FRAME_SIZE;
+
+	xsk_ring_submit(&xdp.xsk.fill, XSK_RING_SIZE);
+
+	for (unsigned i = 0; i < XDP_TX_FRAMES; i++)
+		xdp.tx_free[i] = XDP_TX_FRAMES - 1 - i;
+
+	xdp.tx_free_len = XDP_TX_FRAMES;
+
+	return 0;
+}
+
+int probe_xdp(struct probe *p)
+{
+	int ret;
+	unsigned cnt;
+	struct target *t;
+	struct timespec now, until, timeout, res = { 0, INFLIGHT_RESOLUTION };
+	struct pollfd pfd;
+
+	if (cfg.probe.mode != PROBE_ICMP) {
+		errno = EPROTONOSUPPORT;
+		return -1;
+	}
+
+	memset(&xdp, 0, sizeof(xdp));
+
+	xdp.map = xdp.prog = xdp.link = xdp.xsk.fd = -1;
+
+	ret = probe_xdp_init(p);
+	if (ret)
+		goto out;
+
+	pfd.fd = xdp.xsk.fd;
+	pfd.events = POLLIN;
+
+	while (sched_peek(&p->sched) || p->inflight.length > 0) {
+		clock_gettime(CLOCK_MONOTONIC, &p->mono);
+		clock_gettime(CLOCK_REALTIME, &now);
+
+		/* Queue all probes which are due and kick the Kernel once */
+		cnt = 0;
+		while ((t = sched_peek(&p->sched)) && time_cmp(&t->next, &p->mono) <= 0 &&
+		       xdp.tx_free_len > 0 && cnt < xsk_ring_free(&xdp.xsk.tx)) {
+			probe_xdp_send(p, t, xdp.tx_free[--xdp.tx_free_len], *xdp.xsk.tx.producer + cnt, &now);
+
+			if (cfg.probe.limit && t->counter_tx >= cfg.probe.limit)
+				sched_remove(&p->sched);
+			else
+				sched_advance(&p->sched);
+
+			cnt++;
+		}
+
+		if (cnt) {
+			xsk_ring_submit(&xdp.xsk.tx, cnt);
+
+			if (sendto(xdp.xsk.fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 &&
+			    errno != EAGAIN && errno != EBUSY && errno != ENOBUFS)
+				error(-1, errno, "Failed to kick AF_XDP TX ring");
+		}
+
+		probe_xdp_complete(p);
+		probe_xdp_rx(p);
+		probe_expire(p, &p->mono);
+
+		/* Wait for replies until the next probe is due or the next tick of the timer wheel */
+		if (t && time_cmp(&t->next, &p->mono) > 0) {
+			until = sched_timer(&p->sched);
+			timeout = time_cmp(&until, &p->mono) > 0 ? time_diff(&p->mono, &until) : (struct timespec) { 0, 0 };
+		}
+		else if (t)
+			continue;
+		else
+			timeout = res;
+
+		ret = ppoll(&pfd, 1, &timeout, NULL);
+		if (ret < 0 && errno != EINTR)
+			error(-1, errno, "Failed to poll");
+		else if (ret == 0 && t)
+			sched_wakeup(&p->sched);
+	}
+
+	ret = 0;
+
+out:	ret = ret ? errno : 0;
+
+	if (xdp.link >= 0)
+		close(xdp.link);
+	if (xdp.prog >= 0)
+		close(xdp.prog);
+	if (xdp.xsk.fd >= 0)
+		xsk_destroy(&xdp.xsk);
+	if (xdp.map >= 0)
+		close(xdp.map);
+
+	free(xdp.nexthops);
+
+	errno = ret;
+
+	return ret ? -1 : 0;
+}
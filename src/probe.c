@@ -5,8 +5,7 @@
  * @license GPLv3
  *********************************************************************************/
 
-#define _POSIX_C_SOURCE 199309L
-#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -22,299 +21,988 @@
 #include <sys/poll.h>
 #include <sys/timerfd.h>
 
+#include <stddef.h>
+#include <inttypes.h>
+
+#include <pthread.h>
+#include <sched.h>
+
 #include <netinet/in.h>
 #include <net/if.h>
 #include <arpa/inet.h>
 
-#include <netlink/addr.h>
-
 #include <linux/ip.h>
 #include <linux/icmp.h>
+#include <linux/tcp.h>
+#include <linux/errqueue.h>
 
 #include "ts.h"
 #include "timing.h"
 #include "config.h"
 #include "utils.h"
 #include "hist.h"
+#include "rt.h"
+#include "probe.h"
+#include "observe.h"
+
+/** Probes which are due in the same timer tick are sent with a single sendmmsg().
+ *  Each worker thread has its own batches. */
+static __thread struct {
+	struct mmsghdr msgs[PROBE_BATCH];
+	struct iovec iovs[PROBE_BATCH];
+	struct timespec ts[PROBE_BATCH];
+	struct target *targets[PROBE_BATCH];
+	uint16_t seq[PROBE_BATCH];
+	uint64_t counter[PROBE_BATCH];
+
+	/** The times at which the probes were due. */
+	struct timespec sched[PROBE_BATCH];
+
+	/** The errno of probes which could not be sent or zero. */
+	int failed[PROBE_BATCH];
+
+	/** Buffer for PROBE_BATCH packets of probe::len bytes each. */
+	char *buf;
+
+	/** Number of prepared packets. */
+	unsigned length;
+} batch_tx;
+
+/** Replies are received with a single recvmmsg() until the socket is drained. */
+static __thread struct {
+	struct mmsghdr msgs[PROBE_BATCH];
+	struct iovec iovs[PROBE_BATCH];
+	struct timespec ts[PROBE_BATCH];
+	struct sockaddr_in addrs[PROBE_BATCH];
+
+	char buf[PROBE_BATCH][PROBE_RX_LEN];
+} batch_rx;
+
+/** Split the time which a probe spent in our own host. Unknown parts are zero.
+ *
+ * @param host Filled with the time from the send call to the qdisc, the time
+ *             in the qdisc and driver and the time from the arrival of the reply
+ *             to its delivery to user space.
+ */
+static void probe_host_delay(struct inflight_entry *e, double host[3])
+{
+	host[0] = host[1] = 0;
+
+	if (e->flags & INFLIGHT_TX_SCHED) {
+		host[0] = MAX(0, time_delta(&e->ts_user[0], &e->ts_qdisc));
+
+		if (e->flags & INFLIGHT_TX_SND)
+			host[1] = MAX(0, time_delta(&e->ts_qdisc, &e->ts));
+	}
+
+	host[2] = MAX(0, time_delta(&e->ts_rx, &e->ts_user[1]));
+}
+
+/** Print the fields of the emulate sub-command followed by the probe counters. */
+static void probe_print(struct inflight_entry *e, double delay)
+{
+	struct target *t = e->target;
+	struct metrics *m = &t->metrics;
+
+	/* Keep the lines of multiple workers intact */
+	flockfile(stdout);
+
+	if (cfg.probe.targets)
+		printf("%s,", t->name);
+
+	double host[3];
 
-struct phdr {
-	uint32_t source;
-	uint32_t destination;
-	uint8_t reserved;
-	uint8_t protocol;
-	uint16_t length;
-} __attribute__((packed));
+	probe_host_delay(e, host);
 
-struct icmppl { // ICMP payload
-	uint64_t counter;
-} __attribute__((packed));
+	/* netem reorders only with a gap. Hence the gap is set once a reply has been reordered */
+	printf("%.10e,%.10e,%.10e,%d,%f,%f,%f,%f,%f,%f,%f,%f,%" PRIu64 ",%" PRIu64 ",%.10e,%.10e,%.10e,%.10e,%.10e,%.10e,%.10e,%.10e", delay,
+		metrics_series_mean(&m->delay), metrics_series_stddev(&m->delay),
+		m->reorder.events > 0,
+		metrics_window_prob(&m->loss),        metrics_window_corr(&m->loss),
+		metrics_window_prob(&m->reorder),     metrics_window_corr(&m->reorder),
+		metrics_window_prob(&m->corruption),  metrics_window_corr(&m->corruption),
+		metrics_window_prob(&m->duplication), metrics_window_corr(&m->duplication),
+		t->counter_rx, e->counter, MAX(0, time_delta(&e->ts_sched, &e->ts)),
+		host[0], host[1], host[2],
+		metrics_span_percentile(m, 50), metrics_span_percentile(m, 90),
+		metrics_span_percentile(m, 99), metrics_span_percentile(m, 99.9));
 
-struct timespec past_ts_req[1024];
-static uint64_t counter_tx = 0;
-static uint64_t counter_rx = 0;
+	/* The one-way delays require synchronized clocks */
+	if (e->flags & INFLIGHT_REMOTE)
+		printf(",%.10e,%.10e",
+			time_delta(&e->ts, &e->ts_remote[0]),
+			time_delta(&e->ts_remote[1], &e->ts_rx));
 
-int probe_icmp_tx(int sd, struct sockaddr_in *dst)
+	printf("\n");
+
+	funlockfile(stdout);
+}
+
+/** Print the names of the fields of probe_print(). */
+static void probe_print_header(void)
 {
-	struct timespec ts_req;
-	ssize_t bytes, wbytes;
+	printf("# %scurrent_rtt,mean,sigma,gap,loss_prob,loss_corr,reorder_prob,reorder_corr,"
+	       "corruption_prob,corruption_corr,duplication_prob,duplication_corr,counter_rx,counter,lag,tx_stack,tx_qdisc,rx_stack,p50,p90,p99,p999%s\n",
+		cfg.probe.targets ? "target," : "",
+		cfg.probe.mode == PROBE_UDP ? ",forward,reverse" : "");
+}
 
-	bytes = sizeof(struct icmphdr) + sizeof(struct icmppl) + cfg.probe.payload;
+/** Loss records are comments. Hence they are skipped by the dist and emulate sub-commands. */
+static void probe_print_loss(struct target *t, uint64_t counter)
+{
+	flockfile(stdout);
 
-	struct msghdr msgh;
-	struct iovec iov;
-	char buf[bytes];
+	printf("#");
 
-	memset(buf, 0, sizeof(buf));
-	memset(&msgh, 0, sizeof(msgh));
-	memset(&iov, 0, sizeof(iov));
+	if (cfg.probe.targets)
+		printf("%s,", t->name);
 
-	struct icmphdr *ichdr = (struct icmphdr *) buf;
-	struct icmppl *icpl = (struct icmppl *) (ichdr + 1);
+	printf("%" PRIu64 ",%" PRIu64 ",lost\n", t->counter_rx, counter);
 
-	ichdr->type = ICMP_ECHO;
-	ichdr->code = 0;
-	ichdr->checksum = 0;
-	ichdr->un.echo.id = 1;
-	ichdr->un.echo.sequence = rand();
+	funlockfile(stdout);
+}
 
-	icpl->counter = counter_tx++;
+/** Report the RTT of an answered probe and remove it from the in-flight table. */
+static void probe_complete(struct probe *p, struct inflight_entry *e)
+{
+	double delay = time_delta(&e->ts, &e->ts_rx);
 
-	ichdr->checksum = chksum_rfc1071((char *) ichdr, bytes);
+	/* The delay in our own host is only excluded if the Kernel timestamps are available */
+	if (cfg.probe.host == HOST_INCLUDE)
+		delay = time_delta(&e->ts_user[0], &e->ts_user[1]);
 
-	iov.iov_base = ichdr;
-	iov.iov_len = bytes;
+	/* The time which the probe spent in the reflector is not part of the path */
+	if (e->flags & INFLIGHT_REMOTE) {
+		if (cfg.emulate.delay == DELAY_ONEWAY)
+			delay = time_delta(&e->ts, &e->ts_remote[0]);
+		else
+			delay -= time_delta(&e->ts_remote[0], &e->ts_remote[1]);
+	}
+
+	metrics_delay(&e->target->metrics, delay, time_to_double(&e->ts_rx));
+
+	probe_print(e, delay);
+
+	e->target->counter_rx++;
 
-	msgh.msg_name = dst;
-	msgh.msg_namelen = sizeof(struct sockaddr_in);
-	msgh.msg_iov = &iov;
-	msgh.msg_iovlen = 1;
+	inflight_remove(&p->inflight, e);
+}
+
+void probe_expire(struct probe *p, const struct timespec *now)
+{
+	struct inflight_entry *e;
+
+	while ((e = inflight_expire(&p->inflight, now))) {
+		/* The TX timestamp got lost. We fall back to the user space send time */
+		if (e->flags & INFLIGHT_RX_DONE)
+			probe_complete(p, e);
+		else {
+			metrics_loss(&e->target->metrics);
+
+			probe_print_loss(e->target, e->counter);
+			inflight_remove(&p->inflight, e);
+		}
+	}
+}
 
-	wbytes = ts_sendmsg(sd, &msgh, 0, &ts_req);
-	if (bytes < 0)
-		error(-1, errno, "Failed to send ICMP echo request");
+void probe_drops(struct probe *p)
+{
+	/* Replies which the Kernel dropped are not reported as lost before the timeout */
+	if (p->drops != p->drops_reported) {
+		printf("#dropped,%u\n", p->drops - p->drops_reported);
 
-	if (wbytes != bytes)
-		fprintf(stderr, "wbytes(%zd) != bytes(%zd)\n", wbytes, bytes);
+		p->drops_reported = p->drops;
+	}
+}
 
-	past_ts_req[icpl->counter % 1024] = ts_req;
+uint16_t probe_build(struct probe *p, struct target *t, char *buf)
+{
+	switch (cfg.probe.mode) {
+		case PROBE_ICMP:
+		case PROBE_PING: return probe_icmp_build(p, t, buf);
+		case PROBE_TCP:  return probe_tcp_build(p, t, buf);
+		case PROBE_UDP:  return probe_udp_build(p, t, buf);
+	}
 
 	return 0;
 }
 
-int probe_icmp_rx(int sd)
+int probe_filter(struct probe *p)
+{
+	int ret;
+	struct filter f;
+
+	/* The Kernel demultiplexes replies to ping and UDP sockets by their echo identifier or port */
+	if (cfg.probe.mode == PROBE_PING || cfg.probe.mode == PROBE_UDP)
+		return 0;
+
+	filter_init(&f);
+
+	/* AF_PACKET sockets also see our own packets */
+	filter_insn(&f, BPF_LD | BPF_B | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_PKTTYPE);
+	filter_reject(&f, BPF_JEQ, PACKET_OUTGOING);
+
+	switch (cfg.probe.mode) {
+		case PROBE_ICMP: probe_icmp_filter(p, &f); break;
+		case PROBE_TCP:  probe_tcp_filter(p, &f); break;
+		default: break;
+	}
+
+	/* Nothing beyond the headers is needed */
+	filter_insn(&f, BPF_RET | BPF_K, 0, 0, PROBE_RX_LEN);
+
+	if (cfg.probe.backend == BACKEND_RING) {
+		ret = filter_attach(&f, p->ring.sd);
+		if (ret)
+			goto out;
+
+		/* The probe socket is only used to send and for the TX timestamps of its error queue */
+		f.length = 0;
+		filter_insn(&f, BPF_RET | BPF_K, 0, 0, 0);
+	}
+
+	ret = filter_attach(&f, p->sd);
+
+out:	filter_destroy(&f);
+
+	return ret;
+}
+
+/** Steer the replies of all workers to the ring of the worker which owns the target.
+ *
+ * The workers own consecutive shards of chunk identifiers each (see target_list_shard()).
+ */
+static int probe_fanout(struct probe *p, uint16_t group, uint16_t id_base, unsigned chunk)
+{
+	int ret;
+	struct filter f;
+
+	filter_init(&f);
+
+	/* Our own packets are not replies. They are steered to the first worker whose filter drops them */
+	filter_insn(&f, BPF_LD | BPF_B | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_PKTTYPE);
+	filter_reject(&f, BPF_JEQ, PACKET_OUTGOING);
+
+	/* X = length of IP header */
+	filter_insn(&f, BPF_LDX | BPF_B | BPF_MSH, 0, 0, 0);
+
+	switch (cfg.probe.mode) {
+		case PROBE_ICMP: filter_insn(&f, BPF_LD | BPF_H | BPF_IND, 0, 0, offsetof(struct icmphdr, un.echo.id)); break;
+		case PROBE_TCP:  filter_insn(&f, BPF_LD | BPF_H | BPF_IND, 0, 0, offsetof(struct tcphdr, dest)); break;
+		default: break;
+	}
+
+	filter_insn(&f, BPF_ALU | BPF_SUB | BPF_K, 0, 0, id_base);
+	filter_insn(&f, BPF_ALU | BPF_AND | BPF_K, 0, 0, 0xFFFF);
+	filter_insn(&f, BPF_ALU | BPF_DIV | BPF_K, 0, 0, chunk);
+	filter_insn(&f, BPF_RET | BPF_A, 0, 0, 0);
+
+	struct sock_fprog prog = {
+		.len = f.length,
+		.filter = f.insns
+	};
+
+	ret = ring_fanout(&p->ring, group, &prog);
+
+	filter_destroy(&f);
+
+	return ret;
+}
+
+void probe_handle(struct probe *p, char *buf, ssize_t len, const struct sockaddr_in *from, const struct timespec *ts)
+{
+	switch (cfg.probe.mode) {
+		case PROBE_ICMP: probe_icmp_handle(p, buf, len, ts); break;
+		case PROBE_PING: probe_ping_handle(p, buf, len, from, ts); break;
+		case PROBE_TCP:  probe_tcp_handle(p, buf, len, ts); break;
+		case PROBE_UDP:  probe_udp_handle(p, buf, len, from, ts); break;
+	}
+}
+
+/** Print the number of probes which left behind their schedule. */
+static void probe_print_late(struct probe *ps, int workers)
+{
+	uint64_t late = 0, missed = 0;
+
+	for (int i = 0; i < workers; i++) {
+		late += ps[i].late;
+		missed += ps[i].missed;
+	}
+
+	printf("#late,%" PRIu64 ",missed,%" PRIu64 "\n", late, missed);
+}
+
+void probe_sent(struct probe *p, struct target *t, uint16_t seq, uint64_t counter, const struct timespec *sched, const struct timespec *ts, int pending)
+{
+	struct inflight_entry *e = inflight_add(&p->inflight, t->id, seq, counter, ts, &p->mono);
+
+	e->target = t;
+	e->ts_sched = time_realtime(sched);
+	e->ts_user[0] = *ts;
+
+	/* A stalled prober does not see the network during the stall. Such probes are
+	 * accounted here and report their lag, so that the latencies which an on-schedule
+	 * prober would have seen can be reconstructed by adding it (coordinated omission). */
+	double lag = time_delta(&e->ts_sched, ts);
+	double interval = time_to_double(&p->sched.interval);
+
+	if (lag >= interval)
+		p->missed++;
+	else if (lag >= interval / (2 * p->targets.length))
+		p->late++;
+
+	if (!pending)
+		return;
+
+	e->flags |= INFLIGHT_TX_PENDING;
+
+	/* Grow FIFO */
+	if (p->txts_tail - p->txts_head > p->txts_mask) {
+		uint32_t mask = 2 * (p->txts_mask + 1) - 1;
+		struct probe_txts *txts = alloc((mask + 1) * sizeof(struct probe_txts));
+
+		for (uint32_t i = p->txts_head; i != p->txts_tail; i++)
+			txts[i & mask] = p->txts[i & p->txts_mask];
+
+		free(p->txts);
+
+		p->txts = txts;
+		p->txts_mask = mask;
+	}
+
+	struct probe_txts *q = &p->txts[p->txts_tail++ & p->txts_mask];
+
+	q->key = p->tskey++;
+	q->id = t->id;
+	q->seq = seq;
+	q->counter = counter;
+}
+
+void probe_unsent(struct probe *p, struct target *t, uint16_t seq, uint64_t counter, int err)
+{
+	struct inflight_entry *e = inflight_lookup(&p->inflight, t->id, seq, counter);
+	if (!e)
+		return;
+
+	/* Only errors which are raised after the packet has been built (by the netfilter
+	 * OUTPUT chain or the qdisc) consume a key. Otherwise the later probes move up */
+	if (e->flags & INFLIGHT_TX_PENDING && err != EPERM && err != ENOBUFS) {
+		uint32_t i;
+
+		for (i = p->txts_head; i != p->txts_tail; i++) {
+			struct probe_txts *q = &p->txts[i & p->txts_mask];
+
+			if (q->id == t->id && q->seq == seq && q->counter == counter)
+				break;
+		}
+
+		for (; i != p->txts_tail && i + 1 != p->txts_tail; i++) {
+			p->txts[i & p->txts_mask] = p->txts[(i + 1) & p->txts_mask];
+			p->txts[i & p->txts_mask].key--;
+		}
+
+		if (i != p->txts_tail) {
+			p->txts_tail--;
+			p->tskey--;
+		}
+	}
+
+	metrics_loss(&t->metrics);
+
+	probe_print_loss(t, counter);
+	inflight_remove(&p->inflight, e);
+}
+
+void probe_txts(struct probe *p, uint32_t key, int type, const struct timespec *ts)
+{
+	struct inflight_entry *e;
+
+	/* The probe is still waiting for its timestamp from the driver */
+	if (type == SCM_TSTAMP_SCHED) {
+		for (uint32_t i = p->txts_head; i != p->txts_tail; i++) {
+			struct probe_txts *q = &p->txts[i & p->txts_mask];
+
+			if (q->key != key)
+				continue;
+
+			e = inflight_lookup(&p->inflight, q->id, q->seq, q->counter);
+			if (e) {
+				e->ts_qdisc = *ts;
+				e->flags |= INFLIGHT_TX_SCHED;
+			}
+
+			break;
+		}
+
+		return;
+	}
+
+	while (p->txts_head != p->txts_tail) {
+		struct probe_txts *q = &p->txts[p->txts_head & p->txts_mask];
+
+		/* Stale timestamp */
+		if ((int32_t) (key - q->key) < 0)
+			break;
+
+		p->txts_head++;
+
+		e = inflight_lookup(&p->inflight, q->id, q->seq, q->counter);
+		if (!e)
+			continue; /* already expired */
+
+		/* Probes without a timestamp keep their user space send time */
+		if (q->key == key) {
+			e->ts = *ts;
+			e->flags |= INFLIGHT_TX_SND;
+		}
+
+		e->flags &= ~INFLIGHT_TX_PENDING;
+
+		if (e->flags & INFLIGHT_RX_DONE)
+			probe_complete(p, e);
+
+		if (q->key == key)
+			break;
+	}
+}
+
+void probe_reply(struct probe *p, struct target *t, uint16_t seq, uint64_t counter, const struct timespec *ts, const struct timespec remote[2], int corrupt)
+{
+	/* Corrupted replies are not matched, as their sequence number and counter may be corrupted as well.
+	 * Hence the probe is reported as lost like by a Kernel which discards such packets */
+	if (metrics_arrival(&t->metrics, counter, corrupt) || corrupt)
+		return;
+
+	/* Late or duplicate replies are not matched */
+	struct inflight_entry *e = inflight_lookup(&p->inflight, t->id, seq, counter);
+	if (!e || e->flags & INFLIGHT_RX_DONE)
+		return;
+
+	e->ts_rx = *ts;
+	e->ts_user[1] = p->ts_user_rx;
+	e->flags |= INFLIGHT_RX_DONE;
+
+	if (remote) {
+		e->ts_remote[0] = remote[0];
+		e->ts_remote[1] = remote[1];
+		e->flags |= INFLIGHT_REMOTE;
+	}
+
+	/* Wait for the Kernel TX timestamp */
+	if (!(e->flags & INFLIGHT_TX_PENDING))
+		probe_complete(p, e);
+}
+
+/** Send all prepared probes with a single syscall. */
+static void probe_flush(struct probe *p)
 {
-	struct timespec ts_rep;
-	ssize_t bytes, rbytes;
+	int sent;
+
+	memset(batch_tx.failed, 0, batch_tx.length * sizeof(int));
+
+	for (unsigned i = 0; i < batch_tx.length; i += sent) {
+		sent = ts_sendmmsg(p->sd, batch_tx.msgs + i, batch_tx.length - i, 0, batch_tx.ts + i);
+		if (sent < 0) {
+			if (errno == EINTR) {
+				sent = 0;
+				continue;
+			}
+
+			/* sendmmsg() stops at the first probe which fails. Skip it */
+			batch_tx.failed[i] = errno;
+			sent = 1;
+		}
+	}
+
+	/* The TX timestamps are collected asynchronously by probe_poll() */
+	for (unsigned i = 0; i < batch_tx.length; i++) {
+		probe_sent(p, batch_tx.targets[i], batch_tx.seq[i], batch_tx.counter[i], &batch_tx.sched[i], &batch_tx.ts[i], 1);
+
+		if (batch_tx.failed[i])
+			probe_unsent(p, batch_tx.targets[i], batch_tx.seq[i], batch_tx.counter[i], batch_tx.failed[i]);
+	}
+
+	batch_tx.length = 0;
+}
 
-	bytes = sizeof(struct iphdr) + sizeof(struct icmphdr) + sizeof(struct icmppl);
+/** Prepare a probe in the next slot of the TX batch. */
+static void probe_prepare(struct probe *p, struct target *t)
+{
+	unsigned i = batch_tx.length++;
 
-	struct msghdr msgh;
-	struct iovec iov;
-	char buf[bytes];
+	char *buf = batch_tx.buf + i * p->len;
+
+	batch_tx.counter[i] = t->counter_tx;
+	batch_tx.sched[i] = t->next;
+	batch_tx.seq[i] = probe_build(p, t, buf);
+
+	batch_tx.iovs[i].iov_base = buf;
+	batch_tx.iovs[i].iov_len = p->len;
+
+	memset(&batch_tx.msgs[i], 0, sizeof(struct mmsghdr));
+
+	batch_tx.msgs[i].msg_hdr.msg_name = &t->addr;
+	batch_tx.msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+	batch_tx.msgs[i].msg_hdr.msg_iov = &batch_tx.iovs[i];
+	batch_tx.msgs[i].msg_hdr.msg_iovlen = 1;
+
+	batch_tx.targets[i] = t;
+
+	if (batch_tx.length == PROBE_BATCH)
+		probe_flush(p);
+}
 
-	memset(buf, 0, sizeof(buf));
-	memset(&msgh, 0, sizeof(msgh));
-	memset(&iov, 0, sizeof(iov));
+/** Receive a batch of replies with a single syscall.
+ *
+ * @return The number of received packets.
+ */
+static int probe_rx(struct probe *p)
+{
+	int ret;
 
-	struct iphdr *ihdr = (struct iphdr *) buf;
-	struct icmphdr *ichdr = (struct icmphdr *) (ihdr + 1);
-	struct icmppl *icpl = (struct icmppl *) (ichdr + 1);
+	memset(batch_rx.msgs, 0, sizeof(batch_rx.msgs));
 
-	iov.iov_base = ihdr;
-	iov.iov_len = bytes;
+	for (int i = 0; i < PROBE_BATCH; i++) {
+		batch_rx.iovs[i].iov_base = batch_rx.buf[i];
+		batch_rx.iovs[i].iov_len = sizeof(batch_rx.buf[i]);
 
-	msgh.msg_iov = &iov;
-	msgh.msg_iovlen = 1;
+		batch_rx.msgs[i].msg_hdr.msg_name = &batch_rx.addrs[i];
+		batch_rx.msgs[i].msg_hdr.msg_namelen = sizeof(batch_rx.addrs[i]);
+		batch_rx.msgs[i].msg_hdr.msg_iov = &batch_rx.iovs[i];
+		batch_rx.msgs[i].msg_hdr.msg_iovlen = 1;
+	}
 
-	rbytes = ts_recvmsg(sd, &msgh, MSG_DONTWAIT, &ts_rep);
-	if (rbytes < 0) {
+	ret = ts_recvmmsg(p->sd, batch_rx.msgs, PROBE_BATCH, MSG_DONTWAIT, batch_rx.ts, &p->drops);
+	if (ret < 0) {
 		if (errno == EAGAIN)
-			return 1;
+			return 0;
 		else
-			error(-1, errno, "Failed to receive ICMP echo reply");
+			error(-1, errno, "Failed to receive replies");
+	}
+
+	clock_gettime(CLOCK_REALTIME, &p->ts_user_rx);
+
+	for (int i = 0; i < ret; i++)
+		probe_handle(p, batch_rx.buf[i], batch_rx.msgs[i].msg_len, &batch_rx.addrs[i], &batch_rx.ts[i]);
+
+	probe_drops(p);
+
+	return ret;
+}
+
+/** Process all blocks of the ring which have been handed over by the Kernel.
+ *
+ * @return The number of received packets.
+ */
+static int probe_ring_rx(struct probe *p)
+{
+	int cnt = 0;
+	struct tpacket_block_desc *b;
+	struct tpacket_stats_v3 stats;
+	socklen_t len = sizeof(stats);
+
+	while ((b = ring_block(&p->ring))) {
+		clock_gettime(CLOCK_REALTIME, &p->ts_user_rx);
+
+		struct tpacket3_hdr *h = (struct tpacket3_hdr *) ((uint8_t *) b + b->hdr.bh1.offset_to_first_pkt);
+
+		for (unsigned i = 0; i < b->hdr.bh1.num_pkts; i++) {
+			struct iphdr *ihdr = (struct iphdr *) ((uint8_t *) h + h->tp_net);
+			struct timespec ts = { h->tp_sec, h->tp_nsec };
+			struct sockaddr_in from = {
+				.sin_family = AF_INET,
+				.sin_addr.s_addr = ihdr->saddr
+			};
+
+			probe_handle(p, (char *) ihdr, h->tp_snaplen, &from, &ts);
+
+			h = (struct tpacket3_hdr *) ((uint8_t *) h + h->tp_next_offset);
+		}
+
+		cnt += b->hdr.bh1.num_pkts;
+
+		/* The Kernel had to drop packets because the ring was full */
+		if (b->hdr.bh1.block_status & TP_STATUS_LOSING &&
+		    !getsockopt(p->ring.sd, SOL_PACKET, PACKET_STATISTICS, &stats, &len))
+			p->drops += stats.tp_drops;
+
+		ring_release(&p->ring, b);
+	}
+
+	probe_drops(p);
+
+	return cnt;
+}
+
+/** Drain the error queue and the receive queue of the socket. */
+static void probe_poll(struct probe *p)
+{
+	int cnt;
+	uint32_t keys[PROBE_BATCH];
+	int types[PROBE_BATCH];
+	struct timespec ts[PROBE_BATCH];
+
+	/* Process the TX timestamps first, so that fewer replies have to wait for them */
+	do {
+		cnt = ts_recverr(p->sd, PROBE_BATCH, ts, keys, types);
+		if (cnt < 0)
+			error(-1, errno, "Failed to receive TX timestamps");
+
+		for (int i = 0; i < cnt; i++)
+			probe_txts(p, keys[i], types[i], &ts[i]);
+	} while (cnt == PROBE_BATCH);
+
+	if (cfg.probe.backend == BACKEND_RING)
+		probe_ring_rx(p);
+	else
+		while (probe_rx(p) == PROBE_BATCH);
+}
+
+/** Receive replies until all outstanding probes have been answered or expired. */
+static void probe_drain(struct probe *p)
+{
+	struct pollfd pfds[] = {
+		{ .fd = p->sd,      .events = POLLIN },
+		{ .fd = p->ring.sd, .events = POLLIN }
+	};
+
+	while (p->inflight.length > 0) {
+		if (poll(pfds, cfg.probe.backend == BACKEND_RING ? 2 : 1, INFLIGHT_RESOLUTION / 1000000) > 0)
+			probe_poll(p);
+
+		clock_gettime(CLOCK_MONOTONIC, &p->mono);
+		probe_expire(p, &p->mono);
 	}
+}
+
+/** The probe loop on top of blocking socket calls and a timerfd. */
+static int probe_socket(struct probe *p)
+{
+	int tfd;
+	struct target *t;
+	struct timespec now, until, armed = { 0, 0 };
+
+	/* Start timer */
+	if ((tfd = timerfd_init(cfg.probe.rate)) < 0)
+		error(-1, errno, "Failed to initilize timer");
+
+	/* POLLERR signals pending TX timestamps */
+	struct pollfd pfds[] = {
+		{ .fd = tfd,        .events = POLLIN },
+		{ .fd = p->sd,      .events = POLLIN },
+		{ .fd = p->ring.sd, .events = POLLIN }
+	};
+
+	batch_tx.buf = alloc(PROBE_BATCH * p->len);
+
+	while (sched_peek(&p->sched)) {
+		clock_gettime(CLOCK_MONOTONIC, &p->mono);
+		clock_gettime(CLOCK_REALTIME, &now);
+
+		/* Send all probes which are due in this tick */
+		while ((t = sched_peek(&p->sched)) && time_cmp(&t->next, &p->mono) <= 0) {
+			probe_prepare(p, t);
+
+			/* Replies share the receive buffer with the TX timestamps of the error queue */
+			if (batch_tx.length == 0)
+				probe_poll(p);
+
+			if (cfg.probe.limit && t->counter_tx >= cfg.probe.limit)
+				sched_remove(&p->sched);
+			else
+				sched_advance(&p->sched);
+		}
+
+		probe_flush(p);
+		probe_poll(p);
 
-	if (rbytes != bytes)
-		fprintf(stderr, "rbytes(%zd) != bytes(%zd)\n", rbytes, bytes);
+		probe_expire(p, &p->mono);
 
-	if (counter_tx - icpl->counter < 1024)
-		printf("%zd,%zd,%.10e\n", counter_rx, icpl->counter, time_delta(&past_ts_req[icpl->counter % 1024], &ts_rep));
+		if (!t)
+			break;
 
-	counter_rx++;
+		until = sched_timer(&p->sched);
+		if (time_cmp(&until, &armed)) {
+			armed = until;
+			timerfd_set_until(tfd, &armed);
+		}
+
+		/* Process replies and timestamps while we wait for the next tick */
+		if (poll(pfds, cfg.probe.backend == BACKEND_RING ? 3 : 2, -1) < 0 && errno != EINTR)
+			error(-1, errno, "Failed to poll");
+
+		if (pfds[0].revents & POLLIN) {
+			timerfd_wait(tfd);
+			sched_wakeup(&p->sched);
+		}
+	}
+
+	probe_drain(p);
+
+	free(batch_tx.buf);
+
+	close(tfd);
 
 	return 0;
 }
 
-int probe_tcp(int sd, struct sockaddr_in *src, struct sockaddr_in *dst, struct timespec *ts)
+/** Create the socket of a worker and prepare the probing of its targets. */
+static void probe_open(struct probe *p)
 {
-	struct timespec ts_syn, ts_ack;
-	ssize_t bytes, rbytes, wbytes;
-	struct phdr   *phdr;
-	struct tcphdr *thdr;
+	int ret;
 
-	bytes = sizeof(struct phdr) + sizeof(struct tcphdr);
-	char buf[bytes];
+	switch (cfg.probe.mode) {
+		case PROBE_ICMP: p->sd = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP); break;
+		case PROBE_PING: p->sd = socket(AF_INET, SOCK_DGRAM, IPPROTO_ICMP); break;
+		case PROBE_TCP:  p->sd = socket(AF_INET, SOCK_RAW, IPPROTO_TCP); break;
+		case PROBE_UDP:  p->sd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP); break;
+	}
 
-	struct msghdr msgh;
-	struct iovec iov;
+	if (p->sd < 0) {
+		if (cfg.probe.mode == PROBE_PING && errno == EACCES)
+			error(-1, errno, "Failed to create ping socket (see net.ipv4.ping_group_range)");
+		else
+			error(-1, errno, "Failed to create socket");
+	}
 
-	memset(buf, 0, sizeof(buf));
-	memset(&iov, 0, sizeof(iov));
-	memset(&msgh, 0, sizeof(msgh));
+	if (cfg.probe.backend == BACKEND_RING) {
+		if (cfg.probe.mode == PROBE_PING || cfg.probe.mode == PROBE_UDP)
+			error(-1, 0, "The ring backend requires raw sockets");
 
-	/* Randomize sequence number and source port */
-	unsigned int seq = (unsigned) rand();
-	unsigned short sport = (rand() + 1024) & 0xFFFF;
+		if (ring_init(&p->ring))
+			error(-1, errno, "Failed to setup AF_PACKET ring");
+	}
 
-	phdr = (struct phdr *) buf;
-	thdr = (struct tcphdr *) (phdr + 1);
+	/* Enable Kernel TS support */
+	ret = ts_enable(p->sd);
+	if (ret)
+		fprintf(stderr, "Failed to set SO_TIMESTAMPING: %s\n", strerror(errno));
+
+	/* Absorb bursts of replies between two batches */
+	int rcvbuf = PROBE_RCVBUF;
+	if (setsockopt(p->sd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)))
+		setsockopt(p->sd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
 
-	phdr->source = src->sin_addr.s_addr;
-	phdr->destination = dst->sin_addr.s_addr;
-	phdr->protocol = IPPROTO_TCP;
-	phdr->length = htons(sizeof(struct tcphdr));
+	ret = ts_enable_drops(p->sd);
+	if (ret)
+		fprintf(stderr, "Failed to set SO_RXQ_OVFL: %s\n", strerror(errno));
 
-	thdr->source = htons(sport);
-	thdr->dest = dst->sin_port;
-	thdr->syn = 1;
-	thdr->ack = 0;
-	thdr->seq = htonl(seq);
-	thdr->doff = 5;
-	thdr->check = 0;
+	if (cfg.probe.mode == PROBE_TCP) {
+		if (probe_tcp_init(p))
+			error(-1, errno, "Failed to initialize TCP probes");
 
-	thdr->check = chksum_rfc1071((char *) phdr, bytes);
+		p->len = sizeof(struct tcphdr);
+	}
+	else if (cfg.probe.mode == PROBE_UDP)
+		p->len = sizeof(struct udppl) + cfg.probe.payload;
+	else
+		p->len = sizeof(struct icmphdr) + sizeof(struct icmppl) + cfg.probe.payload;
 
-	hexdump(phdr, bytes);
+	p->txts_mask = PROBE_BATCH - 1;
+	p->txts = alloc(PROBE_BATCH * sizeof(struct probe_txts));
 
-	iov.iov_base = thdr;
-	iov.iov_len = sizeof(struct tcphdr);
+	/* Let the Kernel discard packets which are not for us */
+	ret = probe_filter(p);
+	if (ret)
+		fprintf(stderr, "Failed to attach socket filter: %s\n", strerror(errno));
 
-	msgh.msg_name = dst;
-	msgh.msg_namelen = sizeof(struct sockaddr_in);
-	msgh.msg_iov = &iov;
-	msgh.msg_iovlen = 1;
+	for (int i = 0; i < p->targets.length; i++)
+		metrics_init(&p->targets.targets[i].metrics, cfg.probe.window, cfg.probe.span, cfg.probe.aging == AGING_DECAY);
 
-	wbytes = ts_sendmsg(sd, &msgh, 0, &ts_syn);
-	if (wbytes < 0)
-		error(-1, errno, "Failed to send SYN packet");
+	/* Stagger probes of all targets */
+	sched_init(&p->sched, &p->targets, cfg.probe.rate, cfg.probe.arrival == ARRIVAL_POISSON, cfg.probe.spin);
+	inflight_init(&p->inflight, cfg.probe.timeout);
 
-	msgh.msg_name = NULL;
+	/* Avoid allocations and page faults while probing */
+	if (cfg.rt.priority > 0) {
+		double outstanding = cfg.probe.rate * p->targets.length * (cfg.probe.timeout + 2 * INFLIGHT_RESOLUTION / 1e9);
 
-retry:	rbytes = ts_recvmsg(sd, &msgh, 0, &ts_ack);
-	if (rbytes < 0)
-		error(-1, 0, "Failed to receive ACK / RST packet");
+		inflight_reserve(&p->inflight, MIN(outstanding, PROBE_RESERVE_MAX) + PROBE_BATCH);
 
-	printf("TCP: rbytes=%zd, syn=%u, ack=%u, rst=%u, seq=%u, ack_seq=%u, src=%u, dst=%u\n",
-		rbytes, thdr->syn, thdr->ack, thdr->rst, ntohl(thdr->seq), ntohl(thdr->ack_seq), ntohs(thdr->source), ntohs(thdr->dest));
+		rt_busy_poll("socket", p->sd);
 
-	/* Check response */
-	if (thdr->source != dst->sin_port || thdr->dest != sport) {
-//		printf("Skipping invalid ports\n");
-//		goto retry;
+		if (cfg.probe.backend == BACKEND_RING)
+			rt_busy_poll("ring", p->ring.sd);
 	}
-	else if (!thdr->rst && !(thdr->ack && thdr->syn)) {
-		printf("Skipping invalid flags\n");
-		goto retry;
+}
+
+static void probe_close(struct probe *p)
+{
+	for (int i = 0; i < p->targets.length; i++)
+		metrics_destroy(&p->targets.targets[i].metrics);
+
+	sched_destroy(&p->sched);
+	inflight_destroy(&p->inflight);
+	target_list_destroy(&p->targets);
+
+	free(p->txts);
+
+	if (cfg.probe.backend == BACKEND_RING)
+		ring_destroy(&p->ring);
+
+	close(p->sd);
+}
+
+/** Run the probe loop of a single worker. */
+static void * probe_run(void *ctx)
+{
+	int ret;
+	struct probe *p = ctx;
+
+	char name[32];
+
+	snprintf(name, sizeof(name), "worker %d", p->worker);
+
+	rt_thread(name, p->cpu);
+
+	ret = -1;
+	if (cfg.probe.backend == BACKEND_URING) {
+		ret = probe_uring(p);
+		if (ret)
+			fprintf(stderr, "Failed to setup io_uring: %s. Falling back to socket backend\n", strerror(errno));
 	}
-	else if (ntohl(thdr->ack_seq) != seq + 1) {
-		printf("Skipping invalid seq\n");
-		goto retry;
+	else if (cfg.probe.backend == BACKEND_XDP) {
+		ret = probe_xdp(p);
+		if (ret)
+			fprintf(stderr, "Failed to setup AF_XDP: %s. Falling back to socket backend\n", strerror(errno));
 	}
 
-	*ts = time_diff(&ts_syn, &ts_ack);
+	if (ret)
+		probe_socket(p);
 
-	return 0;
+	return NULL;
 }
 
 int probe(int argc, char *argv[])
 {
-	int run = 0, tfd, sd, ret, prot;
-	socklen_t sinlen;
+	int ret;
+	struct target_list targets;
 
-	if (cfg.probe.mode == PROBE_TCP) {
-		prot = IPPROTO_TCP;
+	/* The samples are taken from a capture instead */
+	if (cfg.probe.pcap) {
+		if (argc != 0)
+			error(-1, 0, "usage: netem --pcap FILE probe");
+
+		return observe_capture(cfg.probe.pcap);
 	}
-	else if (cfg.probe.mode == PROBE_ICMP) {
-		prot = IPPROTO_ICMP;
+
+	/* Parse targets */
+	target_list_init(&targets);
+
+	if (cfg.probe.targets) {
+		FILE *f;
+
+		if (argc != 0)
+			error(-1, 0, "usage: netem -T FILE probe");
+
+		if (!strcmp(cfg.probe.targets, "-"))
+			f = stdin;
+		else if (!(f = fopen(cfg.probe.targets, "r")))
+			error(-1, errno, "Failed to open target list: %s", cfg.probe.targets);
+
+		ret = target_list_load(&targets, f);
+		if (ret)
+			error(-1, 0, "Failed to parse target in line %d of %s", -ret, cfg.probe.targets);
+
+		if (f != stdin)
+			fclose(f);
+
+		if (targets.length == 0)
+			error(-1, 0, "No targets given in %s", cfg.probe.targets);
 	}
 	else {
-		error(-1, 0, "Invalid probe mode");
+		if (argc != 2)
+			error(-1, 0, "usage: netem probe IP [PORT]");
+
+		if (!atoi(argv[1]))
+			error(-1, 0, "Failed to parse port: %s", argv[1]);
+
+		if (target_list_add(&targets, argv[0], argv[1]))
+			error(-1, 0, "Failed to parse address: %s", argv[0]);
 	}
 
-	/* Parse address */
-	struct nl_addr *addr;
-	struct sockaddr_in src, dst;
+	/* Each worker probes its own share of the targets with its own socket */
+	int workers = MAX(1, MIN(cfg.probe.workers, targets.length));
+	int chunk = (targets.length + workers - 1) / workers;
 
-	/* Parse args */
-	if (argc != 2)
-		error(-1, 0, "usage: netem probe IP [PORT]");
+	if (cfg.probe.backend == BACKEND_XDP && workers > 1)
+		error(-1, 0, "The xdp backend supports only a single worker");
 
-	/* Destination */
-	ret = nl_addr_parse(argv[0], AF_INET, &addr);
-	if (ret)
-		error(-1, 0, "Failed to parse address: %s", argv[0]);
+	workers = (targets.length + chunk - 1) / chunk;
 
-	sinlen = sizeof(src);
-	if (nl_addr_fill_sockaddr(addr, (struct sockaddr *) &dst, &sinlen))
-		error(-1, 0, "Failed to fill sockaddr");
+	struct probe *ps = alloc(workers * sizeof(struct probe));
+	pthread_t *threads = alloc(workers * sizeof(pthread_t));
 
-	/* Source */
-	ret = nl_addr_parse("10.211.55.6", AF_INET, &addr);
-	if (ret)
-		error(-1, 0, "Failed to parse address: %s", argv[0]);
+	cpu_set_t cpus;
+	int cpu = -1;
 
-	sinlen = sizeof(dst);
-	if (nl_addr_fill_sockaddr(addr, (struct sockaddr *) &src, &sinlen))
-		error(-1, 0, "Failed to fill sockaddr");
+	if (sched_getaffinity(0, sizeof(cpus), &cpus))
+		CPU_ZERO(&cpus);
 
-	int port = atoi(argv[1]);
-	if (!port)
-		error(-1, 0, "Failed to parse port: %s", argv[1]);
+	for (int i = 0; i < workers; i++) {
+		struct probe *p = &ps[i];
 
-	dst.sin_port = htons(port);
+		memset(p, 0, sizeof(struct probe));
 
-	/* Create RAW socket */
-	sd = socket(AF_INET, SOCK_RAW, prot);
-	if (sd < 0)
-		error(-1, errno, "Failed to create socket");
+		target_list_shard(&targets, &p->targets, i, workers);
 
-	/* Enable Kernel TS support */
-	ret = ts_enable(sd);
-	if (ret)
-		fprintf(stderr, "Failed to set SO_TIMESTAMPING: %s\n", strerror(errno));
+		p->worker = i;
 
-	/* Prepare payload */
-	struct timespec ts;
+		/* Pin the workers round-robin to the CPUs we are allowed to run on */
+		p->cpu = rt_cpu(i);
+		if (p->cpu < 0 && workers > 1 && CPU_COUNT(&cpus) > 0) {
+			do
+				cpu = (cpu + 1) % CPU_SETSIZE;
+			while (!CPU_ISSET(cpu, &cpus));
 
-	/* Prepare statistics */
+			p->cpu = cpu;
+		}
 
-	/* Start timer */
-	if ((tfd = timerfd_init(cfg.probe.rate)) < 0)
-		error(-1, errno, "Failed to initilize timer");
+		probe_open(p);
+
+		/* Replies of other workers are steered to their own rings */
+		if (cfg.probe.backend == BACKEND_RING && workers > 1) {
+			ret = probe_fanout(p, getpid() & 0xFFFF, targets.id_base, chunk);
+			if (ret)
+				error(-1, errno, "Failed to join fanout group");
+		}
+	}
 
-	if (cfg.probe.mode == PROBE_ICMP) {
-		do {
-			if (!cfg.probe.limit || run < cfg.probe.limit)
-				probe_icmp_tx(sd, &dst);
+	/* All buffers have been allocated by now */
+	rt_lock();
 
-			do {
-				ret = probe_icmp_rx(sd);
-			} while (!ret);
+	probe_print_header();
 
-			run += timerfd_wait(tfd);
-		} while (cfg.probe.limit && run < 2*cfg.probe.limit);
+	if (workers == 1)
+		probe_run(&ps[0]);
+	else {
+		for (int i = 0; i < workers; i++) {
+			ret = pthread_create(&threads[i], NULL, probe_run, &ps[i]);
+			if (ret)
+				error(-1, ret, "Failed to create worker thread");
+		}
+
+		for (int i = 0; i < workers; i++)
+			pthread_join(threads[i], NULL);
 	}
-	else if (cfg.probe.mode == PROBE_TCP) {
-		do {
-			probe_tcp(sd, &src, &dst, &ts);
 
-			double rtt = time_to_double(&ts);
+	probe_print_late(ps, workers);
 
-			printf("%d,%.10f\n", run, rtt);
+	for (int i = 0; i < workers; i++) {
+		if (ps[i].sched.wakeup.total == 0)
+			continue;
 
-			run += timerfd_wait(tfd);
-		} while (cfg.probe.limit && run < cfg.probe.limit);
+		fprintf(stderr, "Wakeup error of worker %d in microseconds:\n", i);
+		hist_print(&ps[i].sched.wakeup, stderr);
 	}
 
+	for (int i = 0; i < workers; i++)
+		probe_close(&ps[i]);
+
+	target_list_destroy(&targets);
+
+	free(threads);
+	free(ps);
+
 	return 0;
 }
@@ -0,0 +1,218 @@
+/** Probing for RTT, Loss, Duplication, Corruption.
+ *
+ * @file
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#ifndef _PROBE_H_
+#define _PROBE_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#include "target.h"
+#include "sched.h"
+#include "inflight.h"
+#include "filter.h"
+#include "ring.h"
+
+/** Maximum number of packets per batch of sent / received packets. */
+#define PROBE_BATCH	64
+
+/** Size of the socket receive buffer (SO_RCVBUF). */
+#define PROBE_RCVBUF	(4 << 20)
+
+/** Size of the receive buffer for a single reply (leaving room for IP and TCP options). */
+#define PROBE_RX_LEN	(60 + 60)
+
+/** Upper limit of the number of outstanding probes which is preallocated in the real-time mode. */
+#define PROBE_RESERVE_MAX	(1 << 20)
+
+struct icmppl { // ICMP payload
+	uint64_t counter;
+
+	/** Identifier of the target. Ping sockets overwrite the echo identifier. */
+	uint16_t id;
+} __attribute__((packed));
+
+/** Magic number of UDP probes ("NPLK"). The reflector ignores all other datagrams. */
+#define UDPPL_MAGIC	0x4E504C4B
+
+/** The default port of the reflectors. This is the well-known port of TWAMP. */
+#define UDPPL_PORT	862
+
+/** UDP payload in the spirit of TWAMP-light (RFC 5357, Appendix I).
+ *
+ * The reflector echoes the datagram and fills in the times at which it
+ * received and returned it. All fields except #counter are in network byte order.
+ */
+struct udppl {
+	uint32_t magic;
+
+	/** Identifier of the target and sequence number of the probe. */
+	uint16_t id;
+	uint16_t seq;
+
+	uint64_t counter;
+
+	/** Receive and send time of the reflector in nanoseconds since the epoch. */
+	uint64_t ts_rx;
+	uint64_t ts_tx;
+} __attribute__((packed));
+
+/** A probe whose TX timestamp has not yet been received from the error queue. */
+struct probe_txts {
+	/** The SOF_TIMESTAMPING_OPT_ID key of the packet. */
+	uint32_t key;
+
+	/** The key of the probe in the in-flight table. */
+	uint16_t id;
+	uint16_t seq;
+	uint64_t counter;
+};
+
+/** State of the probing engine which is shared by all backends. */
+struct probe {
+	/** The socket which is shared by all targets of this worker. */
+	int sd;
+
+	/** The index of the worker and the CPU to which its thread is pinned or -1. */
+	int worker;
+	int cpu;
+
+	/** Replies are read from this ring instead of #sd (see BACKEND_RING). */
+	struct ring ring;
+
+	struct target_list targets;
+	struct sched sched;
+	struct inflight inflight;
+
+	/** The ICMP sequence number of the next probe. */
+	uint16_t sequence;
+
+	/** Key of the TCP SYN cookies (see probe-tcp.c). */
+	uint8_t secret[16];
+
+	/** Size of a probe without IP header. */
+	size_t len;
+
+	/** FIFO of probes waiting for their TX timestamp, ordered by their key. */
+	struct probe_txts *txts;
+	uint32_t txts_head;
+	uint32_t txts_tail;
+	uint32_t txts_mask;
+
+	/** The SOF_TIMESTAMPING_OPT_ID key of the next packet sent on #sd. */
+	uint32_t tskey;
+
+	/** The time of the current tick of the probe loop on CLOCK_MONOTONIC.
+	 *  The timeouts of the probes which are sent in this tick count from it. */
+	struct timespec mono;
+
+	/** The user space arrival time of the replies which are currently handled. */
+	struct timespec ts_user_rx;
+
+	/** Number of packets dropped by the Kernel (SO_RXQ_OVFL). */
+	uint32_t drops;
+	uint32_t drops_reported;
+
+	/** Number of probes which have been sent more than half the spacing of two probes
+	 *  late or even after the next probe to the same target was due (see probe_sent()). */
+	uint64_t late;
+	uint64_t missed;
+};
+
+/** Report all probes which have not been answered until now (on CLOCK_MONOTONIC). */
+void probe_expire(struct probe *p, const struct timespec *now);
+
+/** Report Kernel drops if the SO_RXQ_OVFL counter has changed. */
+void probe_drops(struct probe *p);
+
+/** Build the next probe of p->len bytes for target t in buf.
+ *
+ * @return The sequence number which identifies the probe in the in-flight table.
+ */
+uint16_t probe_build(struct probe *p, struct target *t, char *buf);
+
+/** Register a probe which has been sent at time ts.
+ *
+ * @param seq The sequence number returned by probe_build().
+ * @param counter The value of t->counter_tx before probe_build().
+ * @param sched The time at which the probe was due (t->next before sched_advance()).
+ * @param pending If non-zero, ts is only a preliminary user space time
+ *                which is replaced once the Kernel TX timestamp arrives (see probe_txts()).
+ */
+void probe_sent(struct probe *p, struct target *t, uint16_t seq, uint64_t counter, const struct timespec *sched, const struct timespec *ts, int pending);
+
+/** Report a probe which has been registered by probe_sent() but could not be sent as lost.
+ *
+ * @param err The errno of the failed send (e.g. EHOSTUNREACH or EPERM).
+ */
+void probe_unsent(struct probe *p, struct target *t, uint16_t seq, uint64_t counter, int err);
+
+/** Process a TX timestamp which has been received from the error queue.
+ *
+ * @param type SCM_TSTAMP_SCHED or SCM_TSTAMP_SND (see ts_parse()).
+ */
+void probe_txts(struct probe *p, uint32_t key, int type, const struct timespec *ts);
+
+/** Process a received packet.
+ *
+ * @param buf The packet including its IP header. Ping sockets only return the ICMP message.
+ * @param from The source address of the packet.
+ */
+void probe_handle(struct probe *p, char *buf, ssize_t len, const struct sockaddr_in *from, const struct timespec *ts);
+
+/** Match a reply which has been received at time ts against the in-flight table.
+ *
+ * All replies including late and duplicate ones are accounted by the estimators of the target (see metrics.h).
+ *
+ * @param remote Optional. The receive and send time of the reflector (see struct udppl).
+ * @param corrupt Non-zero if the reply did not pass its checksum.
+ */
+void probe_reply(struct probe *p, struct target *t, uint16_t seq, uint64_t counter, const struct timespec *ts, const struct timespec remote[2], int corrupt);
+
+/** Attach a socket filter which passes only replies from the current targets.
+ *
+ * Must be called again whenever the list of targets changes.
+ */
+int probe_filter(struct probe *p);
+
+/* ICMP echo probes (probe-icmp.c) */
+uint16_t probe_icmp_build(struct probe *p, struct target *t, char *buf);
+void probe_icmp_handle(struct probe *p, char *buf, ssize_t len, const struct timespec *ts);
+void probe_icmp_filter(struct probe *p, struct filter *f);
+
+/* ICMP echo probes on unprivileged ping sockets (probe-icmp.c) */
+void probe_ping_handle(struct probe *p, char *buf, ssize_t len, const struct sockaddr_in *from, const struct timespec *ts);
+
+/* Stateless TCP SYN probes (probe-tcp.c) */
+int probe_tcp_init(struct probe *p);
+uint16_t probe_tcp_build(struct probe *p, struct target *t, char *buf);
+void probe_tcp_handle(struct probe *p, char *buf, ssize_t len, const struct timespec *ts);
+void probe_tcp_filter(struct probe *p, struct filter *f);
+
+/* UDP probes which are answered by 'netem reflect' (probe-udp.c) */
+uint16_t probe_udp_build(struct probe *p, struct target *t, char *buf);
+void probe_udp_handle(struct probe *p, char *buf, ssize_t len, const struct sockaddr_in *from, const struct timespec *ts);
+
+/** Run the probe loop on top of io_uring(7).
+ *
+ * @retval 0 All probes have been answered or expired.
+ * @retval -1 io_uring is not supported by the Kernel. Nothing has been sent yet.
+ */
+int probe_uring(struct probe *p);
+
+/** Run the probe loop on top of an AF_XDP socket (see probe-xdp.c).
+ *
+ * @retval 0 All probes have been answered or expired.
+ * @retval -1 AF_XDP or the redirect program could not be set up. Nothing has been sent yet.
+ */
+int probe_xdp(struct probe *p);
+
+#endif /* _PROBE_H_ */
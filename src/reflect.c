@@ -0,0 +1,181 @@
+/** Reflector for UDP probes.
+ *
+ * Datagrams are received and returned in batches. Each probe is stamped with the
+ * Kernel RX timestamp of its arrival and the time just before its batch is
+ * handed back to the Kernel (see struct udppl).
+ *
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <endian.h>
+
+#include <errno.h>
+#include <error.h>
+
+#include <sys/socket.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ts.h"
+#include "rt.h"
+#include "probe.h"
+
+/** Maximum number of datagrams per batch. */
+#define REFLECT_BATCH	256
+
+/** Longer datagrams are truncated. */
+#define REFLECT_LEN	2048
+
+static struct {
+	struct mmsghdr msgs[REFLECT_BATCH];
+	struct iovec iovs[REFLECT_BATCH];
+	struct timespec ts[REFLECT_BATCH];
+	struct sockaddr_in addrs[REFLECT_BATCH];
+
+	/** The probes which are returned. */
+	struct mmsghdr tx[REFLECT_BATCH];
+	struct iovec tx_iovs[REFLECT_BATCH];
+
+	char buf[REFLECT_BATCH][REFLECT_LEN];
+} batch;
+
+static uint64_t reflect_ns(const struct timespec *ts)
+{
+	return htobe64(ts->tv_sec * 1000000000ULL + ts->tv_nsec);
+}
+
+int reflect(int argc, char *argv[])
+{
+	int sd, ret, sent;
+	uint32_t drops = 0, drops_reported = 0;
+	unsigned long port = UDPPL_PORT;
+	char *endptr;
+
+	if (argc > 1)
+		error(-1, 0, "usage: netem reflect [PORT]");
+
+	if (argc == 1) {
+		port = strtoul(argv[0], &endptr, 10);
+		if (endptr == argv[0] || *endptr || port > 0xFFFF)
+			error(-1, 0, "Failed to parse port: %s", argv[0]);
+	}
+
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = htonl(INADDR_ANY)
+	};
+
+	sd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (sd < 0)
+		error(-1, errno, "Failed to create socket");
+
+	if (bind(sd, (struct sockaddr *) &addr, sizeof(addr)))
+		error(-1, errno, "Failed to bind to port %lu", port);
+
+	/* The send time can not be stamped into the probe after the fact.
+	 * Hence TX timestamps would only fill the error queue. */
+	ret = ts_enable_rx(sd);
+	if (ret)
+		fprintf(stderr, "Failed to set SO_TIMESTAMPING: %s\n", strerror(errno));
+
+	int rcvbuf = PROBE_RCVBUF;
+	if (setsockopt(sd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)))
+		setsockopt(sd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	ret = ts_enable_drops(sd);
+	if (ret)
+		fprintf(stderr, "Failed to set SO_RXQ_OVFL: %s\n", strerror(errno));
+
+	rt_busy_poll("socket", sd);
+	rt_thread("reflect", rt_cpu(0));
+	rt_lock();
+
+	for (int i = 0; i < REFLECT_BATCH; i++) {
+		batch.iovs[i].iov_base = batch.buf[i];
+		batch.iovs[i].iov_len = sizeof(batch.buf[i]);
+		batch.tx_iovs[i].iov_base = batch.buf[i];
+	}
+
+	for (;;) {
+		memset(batch.msgs, 0, sizeof(batch.msgs));
+
+		for (int i = 0; i < REFLECT_BATCH; i++) {
+			batch.msgs[i].msg_hdr.msg_name = &batch.addrs[i];
+			batch.msgs[i].msg_hdr.msg_namelen = sizeof(batch.addrs[i]);
+			batch.msgs[i].msg_hdr.msg_iov = &batch.iovs[i];
+			batch.msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		/* Block until the first datagram arrives and take all others which are queued */
+		ret = ts_recvmmsg(sd, batch.msgs, REFLECT_BATCH, MSG_WAITFORONE, batch.ts, &drops);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			error(-1, errno, "Failed to receive probes");
+		}
+
+		unsigned len = 0;
+		for (int i = 0; i < ret; i++) {
+			struct udppl *upl = (struct udppl *) batch.buf[i];
+
+			if (batch.msgs[i].msg_len < sizeof(struct udppl) || upl->magic != htonl(UDPPL_MAGIC))
+				continue;
+
+			upl->ts_rx = reflect_ns(&batch.ts[i]);
+
+			batch.tx_iovs[i].iov_len = batch.msgs[i].msg_len;
+
+			memset(&batch.tx[len], 0, sizeof(struct mmsghdr));
+
+			batch.tx[len].msg_hdr.msg_name = &batch.addrs[i];
+			batch.tx[len].msg_hdr.msg_namelen = sizeof(batch.addrs[i]);
+			batch.tx[len].msg_hdr.msg_iov = &batch.tx_iovs[i];
+			batch.tx[len].msg_hdr.msg_iovlen = 1;
+
+			len++;
+		}
+
+		/* All probes of a batch share the same send time */
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+
+		uint64_t tx = reflect_ns(&now);
+		for (unsigned i = 0; i < len; i++)
+			((struct udppl *) batch.tx[i].msg_hdr.msg_iov->iov_base)->ts_tx = tx;
+
+		for (unsigned i = 0; i < len; i += sent) {
+			sent = sendmmsg(sd, batch.tx + i, len - i, 0);
+			if (sent < 0) {
+				if (errno == EINTR) {
+					sent = 0;
+					continue;
+				}
+
+				/* Skip probes which can not be returned */
+				fprintf(stderr, "Failed to return probe: %s\n", strerror(errno));
+				sent = 1;
+			}
+		}
+
+		if (drops != drops_reported) {
+			fprintf(stderr, "Dropped %u probes\n", drops - drops_reported);
+
+			drops_reported = drops;
+		}
+	}
+
+	close(sd);
+
+	return 0;
+}
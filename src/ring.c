@@ -0,0 +1,88 @@
+/** Memory mapped TPACKET_V3 receive ring of an AF_PACKET socket.
+ *
+ * The Kernel fills whole blocks of packets and their timestamps.
+ * A block is handed to user space once it is full or RING_RETIRE_TIMEOUT has passed.
+ * Hence a single poll() covers many packets and no packet is copied again.
+ *
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include <arpa/inet.h>
+#include <net/ethernet.h>
+
+#include "ring.h"
+
+int ring_init(struct ring *r)
+{
+	int val = TPACKET_V3;
+
+	memset(r, 0, sizeof(struct ring));
+
+	r->sd = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_IP));
+	if (r->sd < 0)
+		return -1;
+
+	if (setsockopt(r->sd, SOL_PACKET, PACKET_VERSION, &val, sizeof(val)))
+		goto fail;
+
+	r->req.tp_block_size = RING_BLOCK_SIZE;
+	r->req.tp_block_nr = RING_BLOCKS;
+	r->req.tp_frame_size = TPACKET_ALIGNMENT << 7;
+	r->req.tp_frame_nr = RING_BLOCKS * RING_BLOCK_SIZE / r->req.tp_frame_size;
+	r->req.tp_retire_blk_tov = RING_RETIRE_TIMEOUT;
+
+	if (setsockopt(r->sd, SOL_PACKET, PACKET_RX_RING, &r->req, sizeof(r->req)))
+		goto fail;
+
+	r->map_len = r->req.tp_block_size * r->req.tp_block_nr;
+	r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, r->sd, 0);
+	if (r->map == MAP_FAILED) {
+		/* Locking might exceed RLIMIT_MEMLOCK */
+		r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, r->sd, 0);
+		if (r->map == MAP_FAILED)
+			goto fail;
+	}
+
+	return 0;
+
+fail:	close(r->sd);
+
+	return -1;
+}
+
+void ring_destroy(struct ring *r)
+{
+	munmap(r->map, r->map_len);
+	close(r->sd);
+}
+
+int ring_bind(struct ring *r, int ifindex, int outgoing)
+{
+	struct sockaddr_ll sll = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = htons(outgoing ? ETH_P_ALL : ETH_P_IP),
+		.sll_ifindex = ifindex
+	};
+
+	return bind(r->sd, (struct sockaddr *) &sll, sizeof(sll));
+}
+
+int ring_fanout(struct ring *r, uint16_t id, struct sock_fprog *prog)
+{
+	int val = id | (prog ? PACKET_FANOUT_CBPF : PACKET_FANOUT_HASH) << 16;
+
+	if (setsockopt(r->sd, SOL_PACKET, PACKET_FANOUT, &val, sizeof(val)))
+		return -1;
+
+	return prog ? setsockopt(r->sd, SOL_PACKET, PACKET_FANOUT_DATA, prog, sizeof(struct sock_fprog)) : 0;
+}
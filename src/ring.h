@@ -0,0 +1,81 @@
+/** Memory mapped TPACKET_V3 receive ring of an AF_PACKET socket.
+ *
+ * @file
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#ifndef _RING_H_
+#define _RING_H_
+
+#include <stdint.h>
+
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+
+/** Number of blocks in the ring. */
+#define RING_BLOCKS		64
+
+/** Size of a single block. */
+#define RING_BLOCK_SIZE		(1 << 17)
+
+/** Milliseconds after which the Kernel hands over a partially filled block. */
+#define RING_RETIRE_TIMEOUT	1
+
+/** A receive ring which is shared with the Kernel. */
+struct ring {
+	/** The AF_PACKET socket (SOCK_DGRAM). Packets start at their IP header. */
+	int sd;
+
+	uint8_t *map;
+	size_t map_len;
+
+	struct tpacket_req3 req;
+
+	/** Index of the next block which will be handed over by the Kernel. */
+	unsigned block;
+};
+
+/** Create a AF_PACKET socket for IPv4 packets of all interfaces and map its receive ring.
+ *
+ * The socket should be bound to a filter before packets are read.
+ */
+int ring_init(struct ring *r);
+
+/** Unmap the ring and close the socket. */
+void ring_destroy(struct ring *r);
+
+/** Only receive packets of a single interface.
+ *
+ * @param outgoing If non-zero, the packets which are sent by this host are received too.
+ *                 They are only passed to sockets of all protocols (ETH_P_ALL).
+ *                 Hence the filter has to check the protocol itself (SKF_AD_PROTOCOL).
+ */
+int ring_bind(struct ring *r, int ifindex, int outgoing);
+
+/** Join the fanout group id with mode PACKET_FANOUT_CBPF.
+ *
+ * All members of the group must attach the same steering program. It returns the index of the member.
+ * Without a program, packets are steered by the symmetric flow hash of the Kernel (PACKET_FANOUT_HASH).
+ * Hence both directions of a flow end up in the same ring.
+ */
+int ring_fanout(struct ring *r, uint16_t id, struct sock_fprog *prog);
+
+/** Return the next block which is owned by user space or NULL. */
+static inline struct tpacket_block_desc * ring_block(struct ring *r)
+{
+	struct tpacket_block_desc *b = (struct tpacket_block_desc *) (r->map + r->block * r->req.tp_block_size);
+
+	return __atomic_load_n(&b->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER ? b : NULL;
+}
+
+/** Hand the block returned by ring_block() back to the Kernel. */
+static inline void ring_release(struct ring *r, struct tpacket_block_desc *b)
+{
+	__atomic_store_n(&b->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+
+	r->block = (r->block + 1) % r->req.tp_block_nr;
+}
+
+#endif /* _RING_H_ */
@@ -0,0 +1,204 @@
+/** Route and neighbour lookups via netlink.
+ *
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <sys/socket.h>
+
+#include <netlink/netlink.h>
+#include <netlink/msg.h>
+#include <netlink/attr.h>
+#include <netlink/route/link.h>
+#include <netlink/route/neighbour.h>
+
+#include <linux/rtnetlink.h>
+#include <linux/neighbour.h>
+
+#include "route.h"
+
+struct route_result {
+	int ifindex;
+	uint32_t src;
+	uint32_t gateway;
+	int found;
+};
+
+static int route_parse(struct nl_msg *msg, void *arg)
+{
+	struct route_result *r = arg;
+	struct nlattr *tb[RTA_MAX + 1];
+
+	if (nlmsg_parse(nlmsg_hdr(msg), sizeof(struct rtmsg), tb, RTA_MAX, NULL) < 0)
+		return NL_SKIP;
+
+	if (tb[RTA_OIF])
+		r->ifindex = nla_get_u32(tb[RTA_OIF]);
+	if (tb[RTA_PREFSRC])
+		r->src = nla_get_u32(tb[RTA_PREFSRC]);
+	if (tb[RTA_GATEWAY])
+		r->gateway = nla_get_u32(tb[RTA_GATEWAY]);
+
+	r->found = 1;
+
+	return NL_OK;
+}
+
+int route_get(struct in_addr dst, int *ifindex, struct in_addr *src, struct in_addr *nexthop)
+{
+	int ret;
+	struct nl_sock *sock;
+	struct nl_msg *msg;
+	struct route_result res = { 0 };
+	struct rtmsg rtm = {
+		.rtm_family = AF_INET,
+		.rtm_dst_len = 32
+	};
+
+	sock = nl_socket_alloc();
+	if (!sock)
+		return -1;
+
+	ret = nl_connect(sock, NETLINK_ROUTE);
+	if (ret)
+		goto out;
+
+	msg = nlmsg_alloc_simple(RTM_GETROUTE, 0);
+	if (!msg) {
+		ret = -1;
+		goto out;
+	}
+
+	nlmsg_append(msg, &rtm, sizeof(rtm), NLMSG_ALIGNTO);
+	nla_put_u32(msg, RTA_DST, dst.s_addr);
+
+	nl_socket_modify_cb(sock, NL_CB_VALID, NL_CB_CUSTOM, route_parse, &res);
+
+	ret = nl_send_auto(sock, msg);
+	nlmsg_free(msg);
+	if (ret < 0)
+		goto out;
+
+	ret = nl_recvmsgs_default(sock);
+	if (ret < 0 || !res.found) {
+		ret = -1;
+		goto out;
+	}
+
+	*ifindex = res.ifindex;
+	src->s_addr = res.src;
+	nexthop->s_addr = res.gateway ? res.gateway : dst.s_addr;
+
+	ret = 0;
+
+out:	nl_socket_free(sock);
+
+	return ret;
+}
+
+/** Let the Kernel resolve the next hop towards via. */
+static void route_trigger(struct in_addr via)
+{
+	int sd;
+	struct sockaddr_in sin = {
+		.sin_family = AF_INET,
+		.sin_port = htons(9), /* discard */
+		.sin_addr = via
+	};
+
+	sd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sd < 0)
+		return;
+
+	sendto(sd, NULL, 0, 0, (struct sockaddr *) &sin, sizeof(sin));
+	close(sd);
+}
+
+int route_neigh(int ifindex, struct in_addr addr, struct in_addr via, uint8_t lladdr[6])
+{
+	int ret = -1;
+	struct nl_sock *sock;
+	struct nl_cache *cache;
+	struct nl_addr *a;
+	struct rtnl_neigh *neigh;
+	struct timespec delay = { 0, 100000000 };
+
+	sock = nl_socket_alloc();
+	if (!sock)
+		return -1;
+
+	if (nl_connect(sock, NETLINK_ROUTE))
+		goto out;
+
+	a = nl_addr_build(AF_INET, &addr, sizeof(addr));
+
+	for (int retries = 0; retries < 10 && ret; retries++) {
+		if (rtnl_neigh_alloc_cache(sock, &cache))
+			break;
+
+		neigh = rtnl_neigh_get(cache, ifindex, a);
+		if (neigh) {
+			struct nl_addr *ll = rtnl_neigh_get_lladdr(neigh);
+
+			if (ll && nl_addr_get_len(ll) == 6 && rtnl_neigh_get_state(neigh) & (NUD_REACHABLE | NUD_STALE | NUD_DELAY | NUD_PROBE | NUD_PERMANENT | NUD_NOARP)) {
+				memcpy(lladdr, nl_addr_get_binary_addr(ll), 6);
+				ret = 0;
+			}
+
+			rtnl_neigh_put(neigh);
+		}
+
+		nl_cache_free(cache);
+
+		if (ret) {
+			route_trigger(via);
+			nanosleep(&delay, NULL);
+		}
+	}
+
+	nl_addr_put(a);
+
+out:	nl_socket_free(sock);
+
+	return ret;
+}
+
+int route_link(int ifindex, uint8_t lladdr[6])
+{
+	int ret = -1;
+	struct nl_sock *sock;
+	struct nl_cache *cache;
+	struct rtnl_link *link;
+
+	sock = nl_socket_alloc();
+	if (!sock)
+		return -1;
+
+	if (nl_connect(sock, NETLINK_ROUTE) || rtnl_link_alloc_cache(sock, AF_UNSPEC, &cache))
+		goto out;
+
+	link = rtnl_link_get(cache, ifindex);
+	if (link) {
+		struct nl_addr *ll = rtnl_link_get_addr(link);
+
+		if (ll && nl_addr_get_len(ll) == 6) {
+			memcpy(lladdr, nl_addr_get_binary_addr(ll), 6);
+			ret = 0;
+		}
+
+		rtnl_link_put(link);
+	}
+
+	nl_cache_free(cache);
+
+out:	nl_socket_free(sock);
+
+	return ret;
+}
@@ -0,0 +1,33 @@
+/** Route and neighbour lookups via netlink.
+ *
+ * @file
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#ifndef _ROUTE_H_
+#define _ROUTE_H_
+
+#include <stdint.h>
+
+#include <netinet/in.h>
+
+/** Ask the Kernel how it would reach dst.
+ *
+ * @param[out] ifindex The outgoing interface.
+ * @param[out] src The preferred source address.
+ * @param[out] nexthop The gateway or dst itself if it is on-link.
+ */
+int route_get(struct in_addr dst, int *ifindex, struct in_addr *src, struct in_addr *nexthop);
+
+/** Get the hardware address of a neighbour.
+ *
+ * If the neighbour is not yet known, the Kernel is triggered to resolve it by sending a datagram to via.
+ */
+int route_neigh(int ifindex, struct in_addr addr, struct in_addr via, uint8_t lladdr[6]);
+
+/** Get the hardware address of an interface. */
+int route_link(int ifindex, uint8_t lladdr[6]);
+
+#endif /* _ROUTE_H_ */
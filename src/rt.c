@@ -0,0 +1,151 @@
+/** Real-time execution mode.
+ *
+ * Preemption and page faults add multiple milliseconds to single samples.
+ * Each measure is verified after it has been applied and reported on STDERR,
+ * as most of them silently fail without the required privileges.
+ *
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <error.h>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "config.h"
+#include "rt.h"
+
+static void rt_report(const char *name, const char *measure, int ret)
+{
+	fprintf(stderr, "Real-time: %s: %s: %s\n", name, measure, ret ? strerror(ret) : "ok");
+}
+
+int rt_enabled(void)
+{
+	return cfg.rt.priority > 0 || cfg.rt.cpus;
+}
+
+int rt_cpu(unsigned i)
+{
+	int cpus[CPU_SETSIZE], len = 0;
+	char *cur, *end;
+
+	if (!cfg.rt.cpus)
+		return -1;
+
+	/* A list of CPUs and ranges of CPUs like "2,4-7" */
+	for (cur = cfg.rt.cpus; *cur && len < CPU_SETSIZE; cur = end) {
+		long first = strtol(cur, &end, 10), last = first;
+
+		if (end == cur)
+			error(-1, 0, "Failed to parse CPU list: %s", cfg.rt.cpus);
+
+		if (*end == '-') {
+			cur = end + 1;
+			last = strtol(cur, &end, 10);
+			if (end == cur)
+				error(-1, 0, "Failed to parse CPU list: %s", cfg.rt.cpus);
+		}
+
+		for (long c = first; c <= last && len < CPU_SETSIZE; c++)
+			cpus[len++] = c;
+
+		if (*end == ',')
+			end++;
+	}
+
+	return len ? cpus[i % len] : -1;
+}
+
+int rt_lock(void)
+{
+	int ret;
+	char measure[64];
+
+	if (cfg.rt.priority <= 0)
+		return 0;
+
+	ret = mlockall(MCL_CURRENT | MCL_FUTURE) ? errno : 0;
+	rt_report("process", "locking memory", ret);
+
+	/* Fault in the stack, so that it does not grow later on */
+	volatile char stack[RT_STACK];
+	memset((char *) stack, 0, sizeof(stack));
+
+	snprintf(measure, sizeof(measure), "prefaulting %u KiB of stack", RT_STACK / 1024);
+	rt_report("process", measure, 0);
+
+	return ret;
+}
+
+int rt_thread(const char *name, int cpu)
+{
+	int ret = 0, policy;
+	char measure[64];
+	cpu_set_t cpus;
+	struct sched_param param = {
+		.sched_priority = cfg.rt.priority
+	};
+
+	if (cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+
+		ret = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+		if (!ret)
+			ret = pthread_getaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+		if (!ret && (CPU_COUNT(&cpus) != 1 || !CPU_ISSET(cpu, &cpus)))
+			ret = EINVAL;
+
+		snprintf(measure, sizeof(measure), "pinning to CPU %d", cpu);
+
+		/* Pinning is also used without the real-time mode to spread the workers */
+		if (ret || rt_enabled())
+			rt_report(name, measure, ret);
+	}
+
+	if (cfg.rt.priority > 0) {
+		ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if (!ret)
+			ret = pthread_getschedparam(pthread_self(), &policy, &param);
+		if (!ret && (policy != SCHED_FIFO || param.sched_priority != cfg.rt.priority))
+			ret = EPERM;
+
+		snprintf(measure, sizeof(measure), "SCHED_FIFO priority %d", cfg.rt.priority);
+		rt_report(name, measure, ret);
+	}
+
+	return ret;
+}
+
+int rt_busy_poll(const char *name, int sd)
+{
+	int ret, usecs = RT_BUSY_POLL;
+	socklen_t len = sizeof(usecs);
+	char measure[64];
+
+	if (cfg.rt.priority <= 0)
+		return 0;
+
+	ret = setsockopt(sd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) ? errno : 0;
+	if (!ret)
+		ret = getsockopt(sd, SOL_SOCKET, SO_BUSY_POLL, &usecs, &len) ? errno : 0;
+	if (!ret && usecs != RT_BUSY_POLL)
+		ret = EPERM;
+
+	snprintf(measure, sizeof(measure), "busy-polling %d us", RT_BUSY_POLL);
+	rt_report(name, measure, ret);
+
+	return ret;
+}
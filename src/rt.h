@@ -0,0 +1,37 @@
+/** Real-time execution mode.
+ *
+ * @file
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#ifndef _RT_H_
+#define _RT_H_
+
+/** The time in microseconds which a blocking receive busy-polls the device queue. */
+#define RT_BUSY_POLL	50
+
+/** The size of the stack which is faulted in up front. */
+#define RT_STACK	(512 * 1024)
+
+/** Return non-zero if any of the real-time measures has been requested (-R or -c). */
+int rt_enabled(void);
+
+/** Return the CPU for the i-th thread from the list given by -c or -1. */
+int rt_cpu(unsigned i);
+
+/** Lock all current and future memory of the process and fault in the stack. */
+int rt_lock(void);
+
+/** Pin the calling thread to cpu and switch it to SCHED_FIFO with the priority given by -R.
+ *
+ * @param name The name of the thread in the report.
+ * @param cpu The CPU or -1 to keep the affinity.
+ */
+int rt_thread(const char *name, int cpu);
+
+/** Let blocking receives on the socket busy-poll the device queue (SO_BUSY_POLL). */
+int rt_busy_poll(const char *name, int sd);
+
+#endif /* _RT_H_ */
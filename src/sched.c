@@ -0,0 +1,147 @@
+/** Scheduling of probes to many targets.
+ *
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "sched.h"
+#include "timing.h"
+#include "utils.h"
+
+static void sched_sift_down(struct sched *s, size_t i)
+{
+	struct target *t = s->heap[i];
+
+	for (;;) {
+		size_t c = 2 * i + 1;
+		if (c >= s->length)
+			break;
+
+		if (c + 1 < s->length && time_cmp(&s->heap[c + 1]->next, &s->heap[c]->next) < 0)
+			c++;
+
+		if (time_cmp(&s->heap[c]->next, &t->next) >= 0)
+			break;
+
+		s->heap[i] = s->heap[c];
+		i = c;
+	}
+
+	s->heap[i] = t;
+}
+
+/** An exponentially distributed gap with a mean of one period. */
+static double sched_gap(struct sched *s)
+{
+	double u = (rand_r(&s->seed) + 1.0) / (RAND_MAX + 2.0);
+
+	return -log(u) * s->period;
+}
+
+/** Calculate the absolute deadline of the next probe to t. */
+static void sched_deadline(struct sched *s, struct target *t)
+{
+	struct timespec offset = time_from_double(t->phase + t->slot * s->period);
+
+	t->next = time_add(&s->start, &offset);
+}
+
+void sched_init(struct sched *s, struct target_list *l, double rate, int poisson, double spin)
+{
+	s->length = l->length;
+	s->heap = alloc(l->length * sizeof(struct target *));
+	s->period = 1 / rate;
+	s->interval = time_from_double(s->period);
+	s->poisson = poisson;
+	s->spin = time_from_double(spin);
+
+	clock_gettime(CLOCK_MONOTONIC, &s->start);
+
+	s->seed = s->start.tv_nsec ^ (uintptr_t) s;
+
+	hist_create(&s->wakeup, SCHED_WAKEUP_LOW, SCHED_WAKEUP_HIGH, SCHED_WAKEUP_DIGITS);
+
+	/* Deadlines are increasing with the index. Hence the array is already a valid heap */
+	for (size_t i = 0; i < l->length; i++) {
+		struct target *t = &l->targets[i];
+
+		t->slot = 0;
+		t->phase = i / (rate * l->length);
+
+		if (poisson)
+			t->phase += sched_gap(s) / l->length;
+
+		sched_deadline(s, t);
+
+		s->heap[i] = t;
+	}
+
+	/* The random offsets may break the heap order */
+	if (poisson)
+		for (size_t i = s->length / 2; i-- > 0;)
+			sched_sift_down(s, i);
+}
+
+void sched_destroy(struct sched *s)
+{
+	hist_destroy(&s->wakeup);
+
+	free(s->heap);
+}
+
+void sched_advance(struct sched *s)
+{
+	struct target *t = s->heap[0];
+
+	if (s->poisson)
+		t->phase += sched_gap(s);
+	else
+		t->slot++;
+
+	sched_deadline(s, t);
+
+	sched_sift_down(s, 0);
+}
+
+void sched_remove(struct sched *s)
+{
+	s->heap[0] = s->heap[--s->length];
+
+	if (s->length > 0)
+		sched_sift_down(s, 0);
+}
+
+struct timespec sched_timer(struct sched *s)
+{
+	struct target *t = sched_peek(s);
+
+	return time_diff(&s->spin, &t->next);
+}
+
+void sched_wakeup(struct sched *s)
+{
+	struct timespec now, until;
+	struct target *t = sched_peek(s);
+
+	if (!t)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	/* We have not been woken up for this deadline */
+	until = sched_timer(s);
+	if (time_cmp(&now, &until) < 0)
+		return;
+
+	while (time_cmp(&now, &t->next) < 0)
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+	hist_put(&s->wakeup, time_delta(&t->next, &now) * 1e6);
+}
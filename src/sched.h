@@ -0,0 +1,87 @@
+/** Scheduling of probes to many targets.
+ *
+ * @file
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+#include <time.h>
+
+#include "target.h"
+#include "hist.h"
+
+/** The resolution and range of the wakeup error histogram in microseconds and its significant digits. */
+#define SCHED_WAKEUP_LOW	0.1
+#define SCHED_WAKEUP_HIGH	1e6
+#define SCHED_WAKEUP_DIGITS	2
+
+/** A min-heap of targets ordered by the time their next probe is due.
+ *
+ * All deadlines are absolute times on CLOCK_MONOTONIC. They are calculated from
+ * the start of the schedule and not from the previous deadline. Hence rounding
+ * errors of the interval do not accumulate.
+ */
+struct sched {
+	struct target **heap;
+
+	/** Number of targets in #heap. */
+	size_t length;
+
+	/** The (mean) distance between two probes to the same target. */
+	struct timespec interval;
+	double period;
+
+	/** The point in time from which all deadlines are counted. */
+	struct timespec start;
+
+	/** Exponentially distributed gaps between the probes instead of a constant interval. */
+	int poisson;
+	unsigned seed;
+
+	/** The timer fires this long before a deadline. The rest is busy-waited. */
+	struct timespec spin;
+
+	/** The distribution of the difference between deadlines and wakeups in microseconds. */
+	struct hist wakeup;
+};
+
+/** Schedule all targets of the list with the given per-target rate.
+ *
+ * The first probes are evenly staggered across one interval,
+ * so that the aggregate probe rate is constant.
+ *
+ * @param poisson If non-zero, the send times form a Poisson process to avoid phase-locking with periodic cross traffic.
+ * @param spin The number of seconds which are busy-waited before each deadline (see sched_wakeup()).
+ */
+void sched_init(struct sched *s, struct target_list *l, double rate, int poisson, double spin);
+
+/** Free the memory of the heap. */
+void sched_destroy(struct sched *s);
+
+/** Return the target whose probe is due next or NULL if none is left. */
+static inline struct target * sched_peek(struct sched *s)
+{
+	return s->length > 0 ? s->heap[0] : NULL;
+}
+
+/** Postpone the target returned by sched_peek() to its next deadline. */
+void sched_advance(struct sched *s);
+
+/** Remove the target returned by sched_peek() from the schedule. */
+void sched_remove(struct sched *s);
+
+/** The time at which the timer has to fire for the target returned by sched_peek(). */
+struct timespec sched_timer(struct sched *s);
+
+/** Complete a wakeup of the timer returned by sched_timer().
+ *
+ * Busy-waits for the remainder of the spin time and accounts the wakeup error.
+ * Wakeups for anything else than the next deadline are ignored.
+ */
+void sched_wakeup(struct sched *s);
+
+#endif /* _SCHED_H_ */
@@ -0,0 +1,126 @@
+/** Probe targets.
+ *
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <error.h>
+
+#include <arpa/inet.h>
+
+#include "target.h"
+#include "utils.h"
+
+int target_parse(struct target *t, const char *host, const char *port)
+{
+	char *endptr;
+
+	memset(t, 0, sizeof(struct target));
+
+	t->addr.sin_family = AF_INET;
+
+	if (inet_pton(AF_INET, host, &t->addr.sin_addr) != 1)
+		return -1;
+
+	if (port) {
+		unsigned long p = strtoul(port, &endptr, 10);
+		if (endptr == port || *endptr || p > 0xFFFF)
+			return -1;
+
+		t->addr.sin_port = htons(p);
+
+		snprintf(t->name, sizeof(t->name), "%s:%lu", host, p);
+	}
+	else
+		snprintf(t->name, sizeof(t->name), "%s", host);
+
+	return 0;
+}
+
+void target_list_init(struct target_list *l)
+{
+	l->targets = NULL;
+	l->length = 0;
+	l->allocated = 0;
+
+	/* Avoid clashes with other probing processes on the same host */
+	l->id_base = getpid() & 0xFFFF;
+}
+
+void target_list_destroy(struct target_list *l)
+{
+	free(l->targets);
+}
+
+int target_list_add(struct target_list *l, const char *host, const char *port)
+{
+	struct target t;
+
+	/* The echo identifier is 16 bits wide */
+	if (l->length > 0xFFFF)
+		return -1;
+
+	if (target_parse(&t, host, port))
+		return -1;
+
+	if (l->length == l->allocated) {
+		l->allocated = l->allocated ? 2 * l->allocated : 64;
+		l->targets = realloc(l->targets, l->allocated * sizeof(struct target));
+		if (!l->targets)
+			error(-1, 0, "Failed to allocate memory");
+	}
+
+	t.id = l->id_base + l->length;
+
+	l->targets[l->length++] = t;
+
+	return 0;
+}
+
+void target_list_shard(struct target_list *l, struct target_list *shard, unsigned i, unsigned n)
+{
+	size_t chunk = (l->length + n - 1) / n;
+	size_t start = MIN(chunk * i, l->length);
+	size_t end = MIN(chunk * (i + 1), l->length);
+
+	shard->length = end - start;
+	shard->allocated = shard->length;
+	shard->id_base = l->id_base + start;
+
+	shard->targets = alloc(shard->allocated * sizeof(struct target));
+
+	memcpy(shard->targets, l->targets + start, shard->length * sizeof(struct target));
+}
+
+int target_list_load(struct target_list *l, FILE *f)
+{
+	char *line = NULL, *host, *port, *saveptr;
+	size_t linelen = 0;
+	int lineno = 0, ret = 0;
+
+	while (getline(&line, &linelen, f) > 0) {
+		lineno++;
+
+		host = strtok_r(line, " \t\r\n", &saveptr);
+		if (!host || host[0] == '#')
+			continue;
+
+		port = strtok_r(NULL, " \t\r\n", &saveptr);
+
+		if (target_list_add(l, host, port)) {
+			ret = -lineno;
+			break;
+		}
+	}
+
+	free(line);
+
+	return ret;
+}
@@ -0,0 +1,98 @@
+/** Probe targets.
+ *
+ * @file
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#ifndef _TARGET_H_
+#define _TARGET_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <netinet/in.h>
+
+#include "metrics.h"
+
+/** Per-target probing state. */
+struct target {
+	/** Destination address and port of the probes. */
+	struct sockaddr_in addr;
+
+	/** Printable "IP[:PORT]" used to tag the output. */
+	char name[32];
+
+	/** Local address which the Kernel uses to reach the target (TCP pseudo header). */
+	uint32_t saddr;
+
+	/** ICMP echo identifier or TCP source port which is used to demultiplex replies. */
+	uint16_t id;
+
+	/** Number of probes sent to / received from this target. */
+	uint64_t counter_tx;
+	uint64_t counter_rx;
+
+	/** The time at which the next probe is due (see sched.h). */
+	struct timespec next;
+
+	/** The deadline of the next probe is #phase + #slot intervals after the start of the schedule. */
+	double phase;
+	uint64_t slot;
+
+	/** Loss, reordering, corruption and duplication of the replies (see metrics.h). */
+	struct metrics metrics;
+};
+
+/** A list of targets which are probed by a single process. */
+struct target_list {
+	struct target *targets;
+
+	/** Number of targets in #targets. */
+	size_t length;
+	/** Number of allocated slots in #targets. */
+	size_t allocated;
+
+	/** The echo identifier of the first target. Others are numbered consecutively. */
+	uint16_t id_base;
+};
+
+/** Parse an IPv4 address and an optional port into a target. */
+int target_parse(struct target *t, const char *host, const char *port);
+
+/** Initialize an empty list of targets. */
+void target_list_init(struct target_list *l);
+
+/** Free all memory allocated by the list. */
+void target_list_destroy(struct target_list *l);
+
+/** Parse a target and append it to the list. */
+int target_list_add(struct target_list *l, const char *host, const char *port);
+
+/** Read targets from a file with one "IP [PORT]" pair per line.
+ *
+ * Empty lines and lines starting with '#' are skipped.
+ *
+ * @retval 0 All lines have been parsed.
+ * @retval <0 The line number of the first invalid line (negated).
+ */
+int target_list_load(struct target_list *l, FILE *f);
+
+/** Copy the i-th of n contiguous parts of the list to shard.
+ *
+ * All parts but the last one have the same size of ceil(length / n) targets.
+ * The targets keep their identifiers. Hence the shards own disjoint ranges of identifiers.
+ */
+void target_list_shard(struct target_list *l, struct target_list *shard, unsigned i, unsigned n);
+
+/** Find the target to which a probe with identifier id has been sent. */
+static inline struct target * target_list_lookup(struct target_list *l, uint16_t id)
+{
+	uint16_t idx = id - l->id_base;
+
+	return idx < l->length ? &l->targets[idx] : NULL;
+}
+
+#endif /* _TARGET_H_ */
@@ -7,8 +7,10 @@
 
 #define _POSIX_C_SOURCE 200112L
 #include <netdb.h>
+#include <inttypes.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <arpa/inet.h>
 
 #include <netlink/route/qdisc/netem.h>
 #include <netlink/route/qdisc/prio.h>
@@ -17,6 +19,8 @@
 #include <netlink/fib_lookup/lookup.h>
 
 #include <linux/if_ether.h>
+#include <linux/pkt_cls.h>
+#include <linux/pkt_sched.h>
 
 #include "tc.h"
 
@@ -26,7 +30,7 @@ struct rtnl_link * tc_get_link(struct nl_sock *sock, const char *dev)
 	struct rtnl_link *link;
 
 	rtnl_link_alloc_cache(sock, AF_UNSPEC, &cache);
-	link = rtnl_link_get_by_name(cache, "eth0");
+	link = rtnl_link_get_by_name(cache, dev);
 	nl_cache_put(cache);
 
 	return link;
@@ -77,6 +81,84 @@ int tc_netem(struct nl_sock *sock, struct rtnl_link *link, struct rtnl_tc **tc)
 	return ret;
 }
 
+static uint32_t tc_netem_get(int val)
+{
+	/* The getters of libnl return negative error codes for unset attributes */
+	return val > 0 ? val : 0;
+}
+
+int tc_netem_gemodel(struct nl_sock *sock, struct rtnl_link *link, struct rtnl_tc *tc, const struct tc_netem_gemodel *ge)
+{
+	struct nl_msg *msg;
+	struct nlattr *opts, *loss;
+	struct rtnl_qdisc *ne = (struct rtnl_qdisc *) tc;
+	int16_t *dist;
+
+	/* libnl has no support for the loss models of netem.
+	 * As netem falls back to random loss whenever the loss model is missing,
+	 * we have to send all other parameters along with it. */
+	struct tcmsg tcm = {
+		.tcm_family = AF_UNSPEC,
+		.tcm_ifindex = rtnl_link_get_ifindex(link),
+		.tcm_handle = TC_HANDLE(2, 0),
+		.tcm_parent = TC_HANDLE(1, 1)
+	};
+
+	/* The limit is the one of the qdisc which emulate() has set up for tc_netem() */
+	struct tc_netem_qopt qopt = {
+		.limit = tc_netem_get(rtnl_netem_get_limit(ne)),
+		.gap = tc_netem_get(rtnl_netem_get_gap(ne)),
+		.duplicate = tc_netem_get(rtnl_netem_get_duplicate(ne))
+	};
+
+	struct tc_netem_corr corr = {
+		.delay_corr = tc_netem_get(rtnl_netem_get_delay_correlation(ne)),
+		.dup_corr = tc_netem_get(rtnl_netem_get_duplicate_correlation(ne))
+	};
+
+	struct tc_netem_reorder reorder = {
+		.probability = tc_netem_get(rtnl_netem_get_reorder_probability(ne)),
+		.correlation = tc_netem_get(rtnl_netem_get_reorder_correlation(ne))
+	};
+
+	struct tc_netem_corrupt corrupt = {
+		.probability = tc_netem_get(rtnl_netem_get_corruption_probability(ne)),
+		.correlation = tc_netem_get(rtnl_netem_get_corruption_correlation(ne))
+	};
+
+	/* libnl keeps the delay in microseconds */
+	int64_t latency = 1000LL * tc_netem_get(rtnl_netem_get_delay(ne));
+	int64_t jitter = 1000LL * tc_netem_get(rtnl_netem_get_jitter(ne));
+
+	msg = nlmsg_alloc_simple(RTM_NEWQDISC, NLM_F_CREATE);
+	if (!msg)
+		return -NLE_NOMEM;
+
+	nlmsg_append(msg, &tcm, sizeof(tcm), NLMSG_ALIGNTO);
+	nla_put_string(msg, TCA_KIND, "netem");
+
+	/* The options of netem start with a struct tc_netem_qopt followed by nested attributes */
+	opts = nla_nest_start(msg, TCA_OPTIONS);
+	nlmsg_append(msg, &qopt, sizeof(qopt), NLMSG_ALIGNTO);
+
+	nla_put(msg, TCA_NETEM_CORR, sizeof(corr), &corr);
+	nla_put(msg, TCA_NETEM_REORDER, sizeof(reorder), &reorder);
+	nla_put(msg, TCA_NETEM_CORRUPT, sizeof(corrupt), &corrupt);
+	nla_put_s64(msg, TCA_NETEM_LATENCY64, latency);
+	nla_put_s64(msg, TCA_NETEM_JITTER64, jitter);
+
+	if (!rtnl_netem_get_delay_distribution(ne, &dist))
+		nla_put(msg, TCA_NETEM_DELAY_DIST, rtnl_netem_get_delay_distribution_size(ne) * sizeof(int16_t), dist);
+
+	loss = nla_nest_start(msg, TCA_NETEM_LOSS);
+	nla_put(msg, NETEM_LOSS_GE, sizeof(*ge), ge);
+	nla_nest_end(msg, loss);
+
+	nla_nest_end(msg, opts);
+
+	return nl_send_sync(sock, msg);
+}
+
 int tc_classifier(struct nl_sock *sock, struct rtnl_link *link, struct rtnl_tc **tc, int mark, int mask)
 {
 	struct rtnl_cls *c = rtnl_cls_alloc();
@@ -111,6 +193,67 @@ int tc_reset(struct nl_sock *sock, struct rtnl_link *link)
 	return ret;
 }
 
+static struct rtnl_qdisc * tc_clsact_alloc(struct rtnl_link *link)
+{
+	struct rtnl_qdisc *q = rtnl_qdisc_alloc();
+
+	rtnl_tc_set_link(TC_CAST(q), link);
+	rtnl_tc_set_parent(TC_CAST(q), TC_H_CLSACT);
+	rtnl_tc_set_handle(TC_CAST(q), TC_H_MAKE(TC_H_CLSACT, 0));
+	rtnl_tc_set_kind(TC_CAST(q), "clsact");
+
+	return q;
+}
+
+int tc_clsact(struct nl_sock *sock, struct rtnl_link *link)
+{
+	struct rtnl_qdisc *q = tc_clsact_alloc(link);
+
+	int ret = rtnl_qdisc_add(sock, q, NLM_F_CREATE);
+	rtnl_qdisc_put(q);
+
+	return ret;
+}
+
+int tc_clsact_reset(struct nl_sock *sock, struct rtnl_link *link)
+{
+	struct rtnl_qdisc *q = tc_clsact_alloc(link);
+
+	int ret = rtnl_qdisc_delete(sock, q);
+	rtnl_qdisc_put(q);
+
+	return ret;
+}
+
+int tc_bpf(struct nl_sock *sock, struct rtnl_link *link, int prog, const char *name)
+{
+	struct nl_msg *msg;
+	struct nlattr *opts;
+
+	/* libnl has no support for the bpf classifier */
+	struct tcmsg tcm = {
+		.tcm_family = AF_UNSPEC,
+		.tcm_ifindex = rtnl_link_get_ifindex(link),
+		.tcm_parent = TC_H_MAKE(TC_H_CLSACT, TC_H_MIN_INGRESS),
+		.tcm_info = TC_H_MAKE(1 << 16, htons(ETH_P_ALL))
+	};
+
+	msg = nlmsg_alloc_simple(RTM_NEWTFILTER, NLM_F_CREATE | NLM_F_EXCL);
+	if (!msg)
+		return -NLE_NOMEM;
+
+	nlmsg_append(msg, &tcm, sizeof(tcm), NLMSG_ALIGNTO);
+	nla_put_string(msg, TCA_KIND, "bpf");
+
+	opts = nla_nest_start(msg, TCA_OPTIONS);
+	nla_put_u32(msg, TCA_BPF_FD, prog);
+	nla_put_string(msg, TCA_BPF_NAME, name);
+	nla_put_u32(msg, TCA_BPF_FLAGS, TCA_BPF_FLAG_ACT_DIRECT);
+	nla_nest_end(msg, opts);
+
+	return nl_send_sync(sock, msg);
+}
+
 int tc_get_stats(struct nl_sock *sock, struct rtnl_tc *tc, struct tc_stats *stats)
 {
 	uint64_t *counters = (uint64_t *) stats;
@@ -129,7 +272,7 @@ int tc_get_stats(struct nl_sock *sock, struct rtnl_tc *tc, struct tc_stats *stat
 
 void tc_print_stats(struct tc_statistics *stats)
 {
-	printf("packets %lu bytes %lu\n", stats->packets, stats->bytes);
+	printf("packets %" PRIu64 " bytes %" PRIu64 "\n", stats->packets, stats->bytes);
 }
 
 int tc_print_netem(struct rtnl_tc *tc)
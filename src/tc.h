@@ -30,10 +30,27 @@ int tc_prio(struct nl_sock *sock, struct rtnl_link *link, struct rtnl_tc **tc);
 
 int tc_netem(struct nl_sock *sock, struct rtnl_link *link, struct rtnl_tc **tc);
 
+struct tc_netem_gemodel;
+
+/** Update the netem qdisc with the parameters of tc and a Gilbert-Elliott loss model.
+ *
+ * The loss probability and correlation of tc are ignored.
+ */
+int tc_netem_gemodel(struct nl_sock *sock, struct rtnl_link *link, struct rtnl_tc *tc, const struct tc_netem_gemodel *ge);
+
 int tc_classifier(struct nl_sock *sock, struct rtnl_link *link, struct rtnl_tc **tc, int mark, int mask);
 
 int tc_reset(struct nl_sock *sock, struct rtnl_link *link);
 
+/** Add a clsact qdisc which provides the ingress and egress hooks for BPF classifiers. */
+int tc_clsact(struct nl_sock *sock, struct rtnl_link *link);
+
+/** Remove the clsact qdisc together with all its classifiers. */
+int tc_clsact_reset(struct nl_sock *sock, struct rtnl_link *link);
+
+/** Attach a BPF program in direct-action mode to the ingress hook of the clsact qdisc. */
+int tc_bpf(struct nl_sock *sock, struct rtnl_link *link, int prog, const char *name);
+
 int tc_get_stats(struct nl_sock *sock, struct rtnl_tc *tc, struct tc_stats *stats);
 
 void tc_print_stats(struct tc_statistics *stats);
@@ -21,7 +21,8 @@ int timerfd_init(double rate)
 		.it_value = { 1, 0 }
 	};
 
-	int tfd = timerfd_create(CLOCK_REALTIME, 0);
+	/* Unlike CLOCK_REALTIME, this clock does not jump */
+	int tfd = timerfd_create(CLOCK_MONOTONIC, 0);
 	if (tfd < 0)
 		return -1;
 
@@ -38,26 +39,31 @@ uint64_t timerfd_wait(int fd)
 	return read(fd, &runs, sizeof(runs)) < 0 ? 0 : runs;
 }
 
-uint64_t timerfd_wait_until(int fd, struct timespec *until)
+int timerfd_set_until(int fd, struct timespec *until)
 {
 	struct itimerspec its = {
 		.it_value = *until
 	};
-		
-	if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL))
+
+	return timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+uint64_t timerfd_wait_until(int fd, struct timespec *until)
+{
+	if (timerfd_set_until(fd, until))
 		return 0;
 	else
 		return timerfd_wait(fd);
 }
 
-struct timespec time_add(struct timespec *start, struct timespec *end)
+struct timespec time_add(const struct timespec *start, const struct timespec *end)
 {
 	struct timespec sum = {
 		.tv_sec  = end->tv_sec  + start->tv_sec,
 		.tv_nsec = end->tv_nsec + start->tv_nsec
 	};
 
-	if (sum.tv_nsec > 1000000000) {
+	if (sum.tv_nsec >= 1000000000) {
 		sum.tv_sec  += 1;
 		sum.tv_nsec -= 1000000000;
 	}
@@ -65,7 +71,7 @@ struct timespec time_add(struct timespec *start, struct timespec *end)
 	return sum;
 }
 
-struct timespec time_diff(struct timespec *start, struct timespec *end)
+struct timespec time_diff(const struct timespec *start, const struct timespec *end)
 {
 	struct timespec diff = {
 		.tv_sec  = end->tv_sec  - start->tv_sec,
@@ -80,6 +86,16 @@ struct timespec time_diff(struct timespec *start, struct timespec *end)
 	return diff;
 }
 
+int time_cmp(const struct timespec *a, const struct timespec *b)
+{
+	if (a->tv_sec != b->tv_sec)
+		return a->tv_sec < b->tv_sec ? -1 : 1;
+	else if (a->tv_nsec != b->tv_nsec)
+		return a->tv_nsec < b->tv_nsec ? -1 : 1;
+	else
+		return 0;
+}
+
 struct timespec time_from_double(double secs)
 {
 	struct timespec ts;
@@ -90,12 +106,24 @@ struct timespec time_from_double(double secs)
 	return ts;
 }
 
-double time_to_double(struct timespec *ts)
+struct timespec time_realtime(const struct timespec *ts)
+{
+	struct timespec mono, real, diff;
+
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	clock_gettime(CLOCK_REALTIME, &real);
+
+	diff = time_diff(&mono, &real);
+
+	return time_add(ts, &diff);
+}
+
+double time_to_double(const struct timespec *ts)
 {
 	return ts->tv_sec + ts->tv_nsec * 1e-9;
 }
 
-double time_delta(struct timespec *start, struct timespec *end)
+double time_delta(const struct timespec *start, const struct timespec *end)
 {
 	struct timespec diff = time_diff(start, end);
 	
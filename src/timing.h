@@ -10,7 +10,12 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <time.h>
 
+/** Create a periodic timer on CLOCK_MONOTONIC.
+ *
+ * Absolute times of timerfd_set_until() are CLOCK_MONOTONIC times as well.
+ */
 int timerfd_init(double rate);
 
 /** Wait until timer elapsed
@@ -21,6 +26,15 @@ int timerfd_init(double rate);
  */
 uint64_t timerfd_wait(int fd);
 
+/** Arm a timer to expire once at a fixed time without waiting for it.
+ *
+ * @param fd A file descriptor which was created by timerfd_create(3).
+ * @param until A pointer to a time in the future.
+ * @retval 0 Success.
+ * @retval -1 An error occured.
+ */
+int timerfd_set_until(int fd, struct timespec *until);
+
 /** Wait until a fixed time in the future is reached
  *
  * @param fd A file descriptor which was created by timerfd_create(3).
@@ -31,16 +45,27 @@ uint64_t timerfd_wait(int fd);
 uint64_t timerfd_wait_until(int fd, struct timespec *until);
 
 /** Get delta between two timespec structs */
-struct timespec time_diff(struct timespec *start, struct timespec *end);
+struct timespec time_diff(const struct timespec *start, const struct timespec *end);
 
 /** Get sum of two timespec structs */
-struct timespec time_add(struct timespec *start, struct timespec *end);
+struct timespec time_add(const struct timespec *start, const struct timespec *end);
+
+/** Compare two timestamps.
+ *
+ * @retval <0 a is earlier than b.
+ * @retval 0 Both timestamps are equal.
+ * @retval >0 a is later than b.
+ */
+int time_cmp(const struct timespec *a, const struct timespec *b);
 
 /** Return the diffrence off two timestamps as double value in seconds. */
-double time_delta(struct timespec *start, struct timespec *end);
+double time_delta(const struct timespec *start, const struct timespec *end);
+
+/** Convert a CLOCK_MONOTONIC time to the corresponding CLOCK_REALTIME time. */
+struct timespec time_realtime(const struct timespec *ts);
 
 /** Convert timespec to double value representing seconds */
-double time_to_double(struct timespec *ts);
+double time_to_double(const struct timespec *ts);
 
 /** Convert double containing seconds after 1970 to timespec. */
 struct timespec time_from_double(double secs);
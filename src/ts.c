@@ -4,7 +4,7 @@
  * @copyright 2014-2017, Steffen Vogel
  * @license GPLv3
  *********************************************************************************/
-#define _POSIX_C_SOURCE 199309L
+#define _GNU_SOURCE
 
 #include <stdio.h>
 #include <unistd.h>
@@ -27,26 +27,44 @@
 
 #include "ts.h"
 
-ssize_t ts_sendmsg(int sd, const struct msghdr *msg, int flags, struct timespec *ts)
+int ts_parse(struct msghdr *msgh, struct timespec *ts, uint32_t *key, int *type, uint32_t *drops)
 {
-	ssize_t ret = sendmsg(sd, msg, flags);
+	struct cmsghdr *cmsg;
+	struct sock_extended_err *serr = NULL;
+	struct scm_timestamping *scmts = NULL;
+
+	for (cmsg = CMSG_FIRSTHDR(msgh); cmsg != NULL; cmsg = CMSG_NXTHDR(msgh, cmsg)) {
+		if       (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING)
+			scmts = (struct scm_timestamping *) CMSG_DATA(cmsg);
+		else if  (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+			if (drops)
+				memcpy(drops, CMSG_DATA(cmsg), sizeof(uint32_t));
+		}
+		else if ((cmsg->cmsg_level == SOL_IP   && cmsg->cmsg_type == IP_RECVERR) ||
+			 (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+			serr = (struct sock_extended_err *) CMSG_DATA(cmsg);
+	}
 
-	/* Wait for TS */
-	struct pollfd pfd = {
-		.fd = sd,
-		.events = POLLIN
-	};
+	if (serr && key)
+		*key = serr->ee_data;
 
-retry:	if (poll(&pfd, 1, 10000) < 0)
-		error(-1, errno, "Failed poll");
-	if (!(pfd.revents & POLLERR))
-		goto retry;
+	if (serr && type)
+		*type = serr->ee_info;
 
-	struct msghdr msg2 = { 0 };
-	if (ts_recvmsg(sd, &msg2, MSG_ERRQUEUE, ts) < 0)
-		error(-1, errno, "Failed to receive TS");
+	if (!scmts)
+		return -1;
 
-	return ret;
+	*ts = scmts->ts[0];
+
+	return 0;
+}
+
+ssize_t ts_sendmsg(int sd, const struct msghdr *msg, int flags, struct timespec *ts)
+{
+	/* The Kernel timestamps are collected later from the error queue (see ts_recverr()) */
+	clock_gettime(CLOCK_REALTIME, ts);
+
+	return sendmsg(sd, msg, flags);
 }
 
 ssize_t ts_recvmsg(int sd, struct msghdr *msgh, int flags, struct timespec *ts)
@@ -55,26 +73,64 @@ ssize_t ts_recvmsg(int sd, struct msghdr *msgh, int flags, struct timespec *ts)
 	msgh->msg_control = &buf;
 	msgh->msg_controllen = sizeof(buf);
 
-	struct cmsghdr *cmsg;
-	struct sock_extended_err *serr = NULL;
+	ssize_t ret = recvmsg(sd, msgh, flags);
+	if (ret >= 0)
+		ts_parse(msgh, ts, NULL, NULL, NULL);
 
-	struct scm_timestamping {
-		struct timespec ts[3];
-	} *scmts;
+	return ret;
+}
 
-	ssize_t ret = recvmsg(sd, msgh, flags);
-	if (ret >= 0) {
-		for (cmsg = CMSG_FIRSTHDR(msgh); cmsg != NULL; cmsg = CMSG_NXTHDR(msgh, cmsg)) {
-			if       (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING)
-				scmts = (struct scm_timestamping *) CMSG_DATA(cmsg);
-			else if ((cmsg->cmsg_level == SOL_IP   && cmsg->cmsg_type == IP_RECVERR) ||
-				 (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
-				serr = (struct sock_extended_err *) CMSG_DATA(cmsg);
-		}
+int ts_sendmmsg(int sd, struct mmsghdr *msgvec, unsigned vlen, int flags, struct timespec *ts)
+{
+	struct timespec now;
 
-		if (scmts) {
-			*ts = scmts->ts[0];
-		}
+	clock_gettime(CLOCK_REALTIME, &now);
+	for (int i = 0; i < vlen; i++)
+		ts[i] = now;
+
+	return sendmmsg(sd, msgvec, vlen, flags);
+}
+
+int ts_recverr(int sd, unsigned vlen, struct timespec *ts, uint32_t *keys, int *types)
+{
+	int ret, cnt = 0;
+	struct mmsghdr errvec[vlen];
+	char ctrl[vlen][TS_CONTROL_LEN];
+
+	memset(errvec, 0, sizeof(errvec));
+	for (int i = 0; i < vlen; i++) {
+		errvec[i].msg_hdr.msg_control = ctrl[i];
+		errvec[i].msg_hdr.msg_controllen = sizeof(ctrl[i]);
+	}
+
+	/* The error queue never blocks */
+	ret = recvmmsg(sd, errvec, vlen, MSG_ERRQUEUE | MSG_DONTWAIT, NULL);
+	if (ret < 0)
+		return errno == EAGAIN ? 0 : -1;
+
+	for (int i = 0; i < ret; i++) {
+		if (!ts_parse(&errvec[i].msg_hdr, &ts[cnt], &keys[cnt], &types[cnt], NULL))
+			cnt++;
+	}
+
+	return cnt;
+}
+
+int ts_recvmmsg(int sd, struct mmsghdr *msgvec, unsigned vlen, int flags, struct timespec *ts, uint32_t *drops)
+{
+	int ret;
+	char ctrl[vlen][TS_CONTROL_LEN];
+
+	for (int i = 0; i < vlen; i++) {
+		msgvec[i].msg_hdr.msg_control = ctrl[i];
+		msgvec[i].msg_hdr.msg_controllen = sizeof(ctrl[i]);
+	}
+
+	ret = recvmmsg(sd, msgvec, vlen, flags, NULL);
+
+	for (int i = 0; i < ret; i++) {
+		if (ts_parse(&msgvec[i].msg_hdr, &ts[i], NULL, NULL, drops))
+			clock_gettime(CLOCK_REALTIME, &ts[i]);
 	}
 
 	return ret;
@@ -86,9 +142,24 @@ int ts_enable(int sd)
 
 	/* Enable kernel / hw timestamping */
 	val  = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE;	/* Enable SW timestamps */
+	val |= SOF_TIMESTAMPING_TX_SCHED;					/* Enable SW timestamps before the qdisc */
 	val |= SOF_TIMESTAMPING_SOFTWARE; 					/* Report SW and HW timestamps */
 	val |= SOF_TIMESTAMPING_OPT_TSONLY;					/* Only return timestamp in cmsg */
 	val |= SOF_TIMESTAMPING_OPT_ID;
 
 	return setsockopt(sd, SOL_SOCKET, SO_TIMESTAMPING, (void *) &val, sizeof(val));
 }
+
+int ts_enable_rx(int sd)
+{
+	int val = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+
+	return setsockopt(sd, SOL_SOCKET, SO_TIMESTAMPING, (void *) &val, sizeof(val));
+}
+
+int ts_enable_drops(int sd)
+{
+	int val = 1;
+
+	return setsockopt(sd, SOL_SOCKET, SO_RXQ_OVFL, (void *) &val, sizeof(val));
+}
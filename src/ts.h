@@ -8,10 +8,69 @@
 #ifndef _TS_H_
 #define _TS_H_
 
+#include <stdint.h>
+#include <time.h>
+
+#include <sys/socket.h>
+
+/** Size of the buffer for the control messages of a single packet. */
+#define TS_CONTROL_LEN	256
+
+/** Send a packet without waiting for its TX timestamp.
+ *
+ * @param ts Filled with the user space time just before the packet is handed to the Kernel.
+ *           The Kernel TX timestamps can later be collected by ts_recverr().
+ */
 ssize_t ts_sendmsg(int sd, const struct msghdr *msgh, int flags, struct timespec *ts);
 
 ssize_t ts_recvmsg(int sd,       struct msghdr *msgh, int flags, struct timespec *ts);
 
+/** Extract the Kernel timestamp, the SOF_TIMESTAMPING_OPT_ID key and the SO_RXQ_OVFL drop counter from the control messages.
+ *
+ * @param key Optional. Only updated for messages from the error queue.
+ * @param type Optional. The type of a TX timestamp from the error queue:
+ *             SCM_TSTAMP_SCHED (before the qdisc) or SCM_TSTAMP_SND (handed to the driver).
+ * @param drops Optional. Only updated if the Kernel has dropped packets.
+ * @retval 0 A timestamp has been found.
+ * @retval -1 No timestamp has been found.
+ */
+int ts_parse(struct msghdr *msgh, struct timespec *ts, uint32_t *key, int *type, uint32_t *drops);
+
+/** Send a batch of packets with a single syscall without waiting for their TX timestamps.
+ *
+ * @param ts An array of vlen timestamps which is filled with the user space time just before the batch is sent.
+ * @return The number of sent packets or a negative value on error.
+ */
+int ts_sendmmsg(int sd, struct mmsghdr *msgvec, unsigned vlen, int flags, struct timespec *ts);
+
+/** Drain up to vlen TX timestamps from the error queue without blocking.
+ *
+ * The SOF_TIMESTAMPING_OPT_ID key of the n-th packet sent on a socket is n.
+ *
+ * @param ts An array of vlen timestamps.
+ * @param keys An array of vlen SOF_TIMESTAMPING_OPT_ID keys belonging to the timestamps.
+ * @param types An array of vlen SCM_TSTAMP_* types of the timestamps (see ts_parse()).
+ * @return The number of timestamps or -1 on error.
+ */
+int ts_recverr(int sd, unsigned vlen, struct timespec *ts, uint32_t *keys, int *types);
+
+/** Receive a batch of packets with a single syscall and extract their RX timestamps.
+ *
+ * The control buffers of msgvec are provided by this function.
+ *
+ * @param ts An array of vlen timestamps which is filled with the RX time of each packet.
+ * @param drops Updated with the number of packets which have been dropped by the Kernel (see ts_enable_drops()).
+ * @return The number of received packets or a negative value on error.
+ */
+int ts_recvmmsg(int sd, struct mmsghdr *msgvec, unsigned vlen, int flags, struct timespec *ts, uint32_t *drops);
+
+/** Enable RX timestamps and the TX timestamps before the qdisc and at the driver. */
 int ts_enable(int sd);
 
+/** Enable only RX timestamps. Nothing is queued on the error queue. */
+int ts_enable_rx(int sd);
+
+/** Enable reporting of the number of packets dropped due to a full receive buffer (SO_RXQ_OVFL). */
+int ts_enable_drops(int sd);
+
 #endif
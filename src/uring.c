@@ -0,0 +1,146 @@
+/** Minimal wrapper around the io_uring(7) system calls.
+ *
+ * We do not depend on liburing. The rings are set up directly via
+ * io_uring_setup(2) and io_uring_enter(2).
+ *
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+int uring_init(struct uring *u, unsigned entries)
+{
+	struct io_uring_params params;
+
+	memset(u, 0, sizeof(struct uring));
+	memset(&params, 0, sizeof(params));
+
+#ifdef __NR_io_uring_setup
+	u->fd = syscall(__NR_io_uring_setup, entries, &params);
+#else
+	u->fd = -1;
+	errno = ENOSYS;
+#endif
+	if (u->fd < 0)
+		return -1;
+
+	u->sq_ring_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	u->cq_ring_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	u->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	/* Both rings share a single mapping on newer Kernels */
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->cq_ring_len > u->sq_ring_len)
+			u->sq_ring_len = u->cq_ring_len;
+		u->cq_ring_len = u->sq_ring_len;
+	}
+
+	u->sq_ring = mmap(NULL, u->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (u->sq_ring == MAP_FAILED)
+		goto fail;
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		u->cq_ring = u->sq_ring;
+	else {
+		u->cq_ring = mmap(NULL, u->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+		if (u->cq_ring == MAP_FAILED)
+			goto fail;
+	}
+
+	u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED)
+		goto fail;
+
+	u->sq_head  = (void *) ((char *) u->sq_ring + params.sq_off.head);
+	u->sq_tail  = (void *) ((char *) u->sq_ring + params.sq_off.tail);
+	u->sq_mask  = (void *) ((char *) u->sq_ring + params.sq_off.ring_mask);
+	u->sq_array = (void *) ((char *) u->sq_ring + params.sq_off.array);
+
+	u->cq_head  = (void *) ((char *) u->cq_ring + params.cq_off.head);
+	u->cq_tail  = (void *) ((char *) u->cq_ring + params.cq_off.tail);
+	u->cq_mask  = (void *) ((char *) u->cq_ring + params.cq_off.ring_mask);
+	u->cqes     = (void *) ((char *) u->cq_ring + params.cq_off.cqes);
+
+	return 0;
+
+fail:	close(u->fd);
+	return -1;
+}
+
+void uring_destroy(struct uring *u)
+{
+	munmap(u->sqes, u->sqes_len);
+
+	if (u->cq_ring != u->sq_ring)
+		munmap(u->cq_ring, u->cq_ring_len);
+
+	munmap(u->sq_ring, u->sq_ring_len);
+
+	close(u->fd);
+}
+
+struct io_uring_sqe * uring_get_sqe(struct uring *u)
+{
+	unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+	unsigned tail = *u->sq_tail + u->sq_pending;
+
+	if (tail - head > *u->sq_mask)
+		return NULL;
+
+	unsigned idx = tail & *u->sq_mask;
+	struct io_uring_sqe *sqe = &u->sqes[idx];
+
+	u->sq_array[idx] = idx;
+	u->sq_pending++;
+
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+	return sqe;
+}
+
+int uring_submit(struct uring *u, unsigned min)
+{
+	unsigned submit = u->sq_pending;
+	int ret;
+
+	/* Publish the new SQEs to the Kernel */
+	__atomic_store_n(u->sq_tail, *u->sq_tail + submit, __ATOMIC_RELEASE);
+	u->sq_pending = 0;
+
+	for (;;) {
+		ret = syscall(__NR_io_uring_enter, u->fd, submit, min, min ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		if (ret >= 0 || errno != EINTR)
+			break;
+
+		/* The SQEs have been consumed before we got interrupted */
+		submit = 0;
+	}
+
+	return ret < 0 ? -errno : (int) submit;
+}
+
+struct io_uring_cqe * uring_peek_cqe(struct uring *u)
+{
+	unsigned head = *u->cq_head;
+
+	if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	return &u->cqes[head & *u->cq_mask];
+}
+
+void uring_cqe_seen(struct uring *u)
+{
+	__atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}
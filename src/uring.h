@@ -0,0 +1,69 @@
+/** Minimal wrapper around the io_uring(7) system calls.
+ *
+ * @file
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <stdint.h>
+
+#include <linux/io_uring.h>
+
+/** A submission and a completion ring shared with the Kernel. */
+struct uring {
+	int fd;
+
+	/* Submission queue */
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+
+	/** Number of SQEs which have been queued but not yet submitted. */
+	unsigned sq_pending;
+
+	/* Completion queue */
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/* Mappings */
+	void *sq_ring;
+	void *cq_ring;
+	size_t sq_ring_len;
+	size_t cq_ring_len;
+	size_t sqes_len;
+};
+
+/** Setup a new ring with room for at least entries SQEs.
+ *
+ * @retval 0 Success.
+ * @retval <0 The Kernel does not support io_uring. errno is set accordingly.
+ */
+int uring_init(struct uring *u, unsigned entries);
+
+/** Unmap the rings and close the file descriptor. */
+void uring_destroy(struct uring *u);
+
+/** Get a cleared SQE or NULL if the submission queue is full. */
+struct io_uring_sqe * uring_get_sqe(struct uring *u);
+
+/** Submit all queued SQEs and wait until at least min CQEs are available.
+ *
+ * @return The number of submitted SQEs or a negative error number.
+ */
+int uring_submit(struct uring *u, unsigned min);
+
+/** Return the next CQE or NULL if the completion queue is empty. */
+struct io_uring_cqe * uring_peek_cqe(struct uring *u);
+
+/** Mark the CQE returned by uring_peek_cqe() as consumed. */
+void uring_cqe_seen(struct uring *u);
+
+#endif /* _URING_H_ */
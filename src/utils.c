@@ -39,6 +39,56 @@ uint16_t chksum_rfc1071(char *buf, size_t count)
 	return ~sum;
 }
 
+#define ROTL(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND do { \
+	v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32); \
+	v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2; \
+	v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0; \
+	v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32); \
+} while (0)
+
+uint64_t siphash(const uint8_t key[16], const void *data, size_t len)
+{
+	const uint8_t *in = data;
+	const uint8_t *end = in + len - (len % 8);
+	uint64_t k0, k1, m, b = (uint64_t) len << 56;
+
+	memcpy(&k0, key, 8);
+	memcpy(&k1, key + 8, 8);
+
+	uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+	uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+	uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+	uint64_t v3 = 0x7465646279746573ULL ^ k1;
+
+	for (; in != end; in += 8) {
+		memcpy(&m, in, 8);
+
+		v3 ^= m;
+		SIPROUND;
+		SIPROUND;
+		v0 ^= m;
+	}
+
+	/* Add left-over bytes, if any */
+	for (int i = len % 8; i > 0; i--)
+		b |= (uint64_t) in[i - 1] << (8 * (i - 1));
+
+	v3 ^= b;
+	SIPROUND;
+	SIPROUND;
+	v0 ^= b;
+
+	v2 ^= 0xff;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
 
 void hexdump(void *mem, unsigned int len)
 {
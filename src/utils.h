@@ -25,6 +25,12 @@ void * alloc(size_t bytes);
  */
 uint16_t chksum_rfc1071(char *buf, size_t count);
 
+/** Keyed hash of "len" bytes at "data" with a 128 bit key.
+ *
+ * Source: SipHash-2-4 by J.-P. Aumasson and D. J. Bernstein
+ */
+uint64_t siphash(const uint8_t key[16], const void *data, size_t len);
+
 /** Safely append a format string to an existing string.
  *
  * This function is similar to strlcat() from BSD.
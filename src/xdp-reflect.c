@@ -0,0 +1,377 @@
+/** In-Kernel reflector for UDP probes.
+ *
+ * A program which is generated at runtime answers UDP probes (see struct udppl)
+ * directly in the driver (XDP) or, if XDP is not available, in the ingress hook
+ * of the traffic controller (tc-bpf(8)). The probes never reach the network stack.
+ *
+ * The program swaps the addresses and ports, stamps the time of arrival into the
+ * payload and returns the packet on the same interface. The UDP checksum is
+ * cleared as the payload changes.
+ *
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <errno.h>
+#include <error.h>
+
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include <net/if.h>
+#include <arpa/inet.h>
+
+#include <netlink/route/link.h>
+
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+#include <linux/pkt_cls.h>
+#include <linux/ethtool.h>
+#include <linux/sockios.h>
+
+#include "bpf.h"
+#include "tc.h"
+#include "probe.h"
+#include "timing.h"
+#include "config.h"
+#include "utils.h"
+
+#define XDP_REFLECT_HDR_LEN	(sizeof(struct ethhdr) + sizeof(struct iphdr) + sizeof(struct udphdr))
+
+/** Offset of a field of the UDP payload from the start of the frame. */
+#define XDP_REFLECT_PL(f)	(XDP_REFLECT_HDR_LEN + offsetof(struct udppl, f))
+#define XDP_REFLECT_IP(f)	(sizeof(struct ethhdr) + offsetof(struct iphdr, f))
+#define XDP_REFLECT_UDP(f)	(sizeof(struct ethhdr) + sizeof(struct iphdr) + offsetof(struct udphdr, f))
+
+/** Per-CPU counters of the reflected probes. */
+struct xdp_reflect_stats {
+	uint64_t packets;
+	uint64_t bytes;
+};
+
+static struct {
+	/** Per-CPU array of struct xdp_reflect_stats. */
+	int stats;
+
+	/** Array with the offset of CLOCK_REALTIME to CLOCK_MONOTONIC in nanoseconds. */
+	int clock;
+
+	int prog;
+	int link;
+
+	/** The interface of the tc-bpf(8) fallback or NULL. */
+	struct nl_sock *sock;
+	struct rtnl_link *tc;
+} xr;
+
+/** Assemble the reflector for the XDP or the tc ingress hook. */
+static int xdp_reflect_prog(enum bpf_prog_type type, int ifindex, uint16_t port)
+{
+	char log[4096];
+	int xdp = type == BPF_PROG_TYPE_XDP;
+
+	struct bpf_insn insns[] = {
+		BPF_MOV64_REG(BPF_REG_6, BPF_REG_1),
+		BPF_LDX_MEM(BPF_W, BPF_REG_7, BPF_REG_6, xdp ? offsetof(struct xdp_md, data)     : offsetof(struct __sk_buff, data)),
+		BPF_LDX_MEM(BPF_W, BPF_REG_8, BPF_REG_6, xdp ? offsetof(struct xdp_md, data_end) : offsetof(struct __sk_buff, data_end)),
+
+		/* Ethernet + IP without options + UDP header + probe */
+		BPF_MOV64_REG(BPF_REG_4, BPF_REG_7),
+		BPF_ALU64_IMM(BPF_ADD, BPF_REG_4, XDP_REFLECT_HDR_LEN + sizeof(struct udppl)),
+		BPF_JMP_REG(BPF_JGT, BPF_REG_4, BPF_REG_8, BPF_LABEL(0)),
+
+		BPF_LDX_MEM(BPF_H, BPF_REG_5, BPF_REG_7, offsetof(struct ethhdr, h_proto)),
+		BPF_ENDIAN(BPF_TO_BE, BPF_REG_5, 16),
+		BPF_JMP_IMM(BPF_JNE, BPF_REG_5, ETH_P_IP, BPF_LABEL(0)),
+
+		BPF_LDX_MEM(BPF_B, BPF_REG_5, BPF_REG_7, sizeof(struct ethhdr)),
+		BPF_JMP_IMM(BPF_JNE, BPF_REG_5, 0x45, BPF_LABEL(0)),
+
+		BPF_LDX_MEM(BPF_B, BPF_REG_5, BPF_REG_7, XDP_REFLECT_IP(protocol)),
+		BPF_JMP_IMM(BPF_JNE, BPF_REG_5, IPPROTO_UDP, BPF_LABEL(0)),
+
+		/* Fragments */
+		BPF_LDX_MEM(BPF_H, BPF_REG_5, BPF_REG_7, XDP_REFLECT_IP(frag_off)),
+		BPF_ENDIAN(BPF_TO_BE, BPF_REG_5, 16),
+		BPF_ALU64_IMM(BPF_AND, BPF_REG_5, 0x3FFF),
+		BPF_JMP_IMM(BPF_JNE, BPF_REG_5, 0, BPF_LABEL(0)),
+
+		BPF_LDX_MEM(BPF_H, BPF_REG_5, BPF_REG_7, XDP_REFLECT_UDP(dest)),
+		BPF_ENDIAN(BPF_TO_BE, BPF_REG_5, 16),
+		BPF_JMP_IMM(BPF_JNE, BPF_REG_5, port, BPF_LABEL(0)),
+
+		BPF_LDX_MEM(BPF_W, BPF_REG_5, BPF_REG_7, XDP_REFLECT_PL(magic)),
+		BPF_ENDIAN(BPF_TO_BE, BPF_REG_5, 32),
+		BPF_JMP_IMM(BPF_JNE, BPF_REG_5, UDPPL_MAGIC, BPF_LABEL(0)),
+
+		/* r9 = *bpf_map_lookup_elem(&clock, &0) */
+		BPF_ST_MEM(BPF_W, BPF_REG_10, -4, 0),
+		BPF_MOV64_REG(BPF_REG_2, BPF_REG_10),
+		BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, -4),
+		BPF_LD_MAP_FD(BPF_REG_1, xr.clock),
+		BPF_EMIT_CALL(BPF_FUNC_map_lookup_elem),
+		BPF_JMP_IMM(BPF_JEQ, BPF_REG_0, 0, BPF_LABEL(0)),
+		BPF_LDX_MEM(BPF_DW, BPF_REG_9, BPF_REG_0, 0),
+
+		/* The probe leaves as soon as it arrived */
+		BPF_EMIT_CALL(BPF_FUNC_ktime_get_ns),
+		BPF_ALU64_REG(BPF_ADD, BPF_REG_0, BPF_REG_9),
+		BPF_ENDIAN(BPF_TO_BE, BPF_REG_0, 64),
+		BPF_STX_MEM(BPF_DW, BPF_REG_7, BPF_REG_0, XDP_REFLECT_PL(ts_rx)),
+		BPF_STX_MEM(BPF_DW, BPF_REG_7, BPF_REG_0, XDP_REFLECT_PL(ts_tx)),
+
+		/* r0 = bpf_map_lookup_elem(&stats, &0) */
+		BPF_MOV64_REG(BPF_REG_2, BPF_REG_10),
+		BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, -4),
+		BPF_LD_MAP_FD(BPF_REG_1, xr.stats),
+		BPF_EMIT_CALL(BPF_FUNC_map_lookup_elem),
+		BPF_JMP_IMM(BPF_JEQ, BPF_REG_0, 0, BPF_LABEL(0)),
+
+		BPF_LDX_MEM(BPF_DW, BPF_REG_1, BPF_REG_0, offsetof(struct xdp_reflect_stats, packets)),
+		BPF_ALU64_IMM(BPF_ADD, BPF_REG_1, 1),
+		BPF_STX_MEM(BPF_DW, BPF_REG_0, BPF_REG_1, offsetof(struct xdp_reflect_stats, packets)),
+
+		BPF_LDX_MEM(BPF_H, BPF_REG_2, BPF_REG_7, XDP_REFLECT_IP(tot_len)),
+		BPF_ENDIAN(BPF_TO_BE, BPF_REG_2, 16),
+		BPF_LDX_MEM(BPF_DW, BPF_REG_1, BPF_REG_0, offsetof(struct xdp_reflect_stats, bytes)),
+		BPF_ALU64_REG(BPF_ADD, BPF_REG_1, BPF_REG_2),
+		BPF_STX_MEM(BPF_DW, BPF_REG_0, BPF_REG_1, offsetof(struct xdp_reflect_stats, bytes)),
+
+		/* Swap hardware addresses */
+		BPF_LDX_MEM(BPF_W, BPF_REG_1, BPF_REG_7, offsetof(struct ethhdr, h_dest)),
+		BPF_LDX_MEM(BPF_H, BPF_REG_2, BPF_REG_7, offsetof(struct ethhdr, h_dest) + 4),
+		BPF_LDX_MEM(BPF_W, BPF_REG_3, BPF_REG_7, offsetof(struct ethhdr, h_source)),
+		BPF_LDX_MEM(BPF_H, BPF_REG_4, BPF_REG_7, offsetof(struct ethhdr, h_source) + 4),
+		BPF_STX_MEM(BPF_W, BPF_REG_7, BPF_REG_3, offsetof(struct ethhdr, h_dest)),
+		BPF_STX_MEM(BPF_H, BPF_REG_7, BPF_REG_4, offsetof(struct ethhdr, h_dest) + 4),
+		BPF_STX_MEM(BPF_W, BPF_REG_7, BPF_REG_1, offsetof(struct ethhdr, h_source)),
+		BPF_STX_MEM(BPF_H, BPF_REG_7, BPF_REG_2, offsetof(struct ethhdr, h_source) + 4),
+
+		/* Swap IP addresses. The IP checksum does not change */
+		BPF_LDX_MEM(BPF_W, BPF_REG_1, BPF_REG_7, XDP_REFLECT_IP(saddr)),
+		BPF_LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_7, XDP_REFLECT_IP(daddr)),
+		BPF_STX_MEM(BPF_W, BPF_REG_7, BPF_REG_2, XDP_REFLECT_IP(saddr)),
+		BPF_STX_MEM(BPF_W, BPF_REG_7, BPF_REG_1, XDP_REFLECT_IP(daddr)),
+
+		/* Swap ports */
+		BPF_LDX_MEM(BPF_H, BPF_REG_1, BPF_REG_7, XDP_REFLECT_UDP(source)),
+		BPF_LDX_MEM(BPF_H, BPF_REG_2, BPF_REG_7, XDP_REFLECT_UDP(dest)),
+		BPF_STX_MEM(BPF_H, BPF_REG_7, BPF_REG_2, XDP_REFLECT_UDP(source)),
+		BPF_STX_MEM(BPF_H, BPF_REG_7, BPF_REG_1, XDP_REFLECT_UDP(dest)),
+
+		/* No checksum */
+		BPF_ST_MEM(BPF_H, BPF_REG_7, XDP_REFLECT_UDP(check), 0),
+
+		/* return XDP_TX or bpf_redirect(ifindex, 0) which sends the packet on the egress.
+		 * XDP skips the call with a jump to the next instruction */
+		BPF_MOV64_IMM(BPF_REG_0, XDP_TX),
+		BPF_MOV64_IMM(BPF_REG_1, ifindex),
+		BPF_MOV64_IMM(BPF_REG_2, 0),
+		xdp ? BPF_JMP_A(0) : BPF_EMIT_CALL(BPF_FUNC_redirect),
+		BPF_EXIT_INSN(),
+
+		/* Label 0: return XDP_PASS or TC_ACT_OK */
+		BPF_MOV64_IMM(BPF_REG_0, xdp ? XDP_PASS : TC_ACT_OK),
+		BPF_EXIT_INSN()
+	};
+
+	unsigned len = sizeof(insns) / sizeof(insns[0]);
+
+	bpf_patch(insns, len, 0, len - 2);
+
+	xr.prog = bpf_prog_load(type, insns, len, log, sizeof(log));
+	if (xr.prog < 0 && log[0])
+		fprintf(stderr, "%s", log);
+
+	return xr.prog < 0 ? -1 : 0;
+}
+
+/** The offset which turns bpf_ktime_get_ns() into nanoseconds since the epoch.
+ *
+ * It is updated periodically to follow adjustments of the system clock.
+ */
+static int xdp_reflect_clock(void)
+{
+	int key = 0;
+	struct timespec real, mono;
+
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	clock_gettime(CLOCK_REALTIME, &real);
+
+	uint64_t offset = (real.tv_sec - mono.tv_sec) * 1000000000LL + (real.tv_nsec - mono.tv_nsec);
+
+	return bpf_map_update(xr.clock, &key, &offset);
+}
+
+static void xdp_reflect_print(int cpus)
+{
+	int key = 0;
+	struct xdp_reflect_stats stats[cpus], total = { 0 };
+
+	if (bpf_map_lookup(xr.stats, &key, stats))
+		error(-1, errno, "Failed to read counters");
+
+	for (int i = 0; i < cpus; i++) {
+		if (!stats[i].packets)
+			continue;
+
+		printf("cpu %d: packets %" PRIu64 " bytes %" PRIu64 "\n", i, stats[i].packets, stats[i].bytes);
+
+		total.packets += stats[i].packets;
+		total.bytes += stats[i].bytes;
+	}
+
+	printf("total: packets %" PRIu64 " bytes %" PRIu64 "\n", total.packets, total.bytes);
+
+	fflush(stdout);
+}
+
+/** Native XDP_TX on a veth device silently drops all packets unless the peer has an XDP program or GRO enabled. */
+static int xdp_reflect_veth(const char *dev)
+{
+	int sd, ret;
+	struct ethtool_drvinfo info = { .cmd = ETHTOOL_GDRVINFO };
+	struct ifreq ifr = { .ifr_data = (void *) &info };
+
+	strncpy(ifr.ifr_name, dev, IFNAMSIZ - 1);
+
+	sd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sd < 0)
+		return 0;
+
+	ret = ioctl(sd, SIOCETHTOOL, &ifr);
+
+	close(sd);
+
+	return !ret && !strcmp(info.driver, "veth");
+}
+
+/** Remove the tc-bpf(8) fallback. Called at exit as the classifier outlives us. */
+static void xdp_reflect_reset(void)
+{
+	if (!xr.tc)
+		return;
+
+	tc_clsact_reset(xr.sock, xr.tc);
+
+	rtnl_link_put(xr.tc);
+	nl_close(xr.sock);
+	nl_socket_free(xr.sock);
+
+	xr.tc = NULL;
+}
+
+/** Attach the reflector with the tc-bpf(8) fallback. */
+static int xdp_reflect_tc(int ifindex, uint16_t port)
+{
+	int ret;
+
+	if (xdp_reflect_prog(BPF_PROG_TYPE_SCHED_CLS, ifindex, port))
+		return -1;
+
+	xr.sock = nl_socket_alloc();
+	nl_connect(xr.sock, NETLINK_ROUTE);
+
+	xr.tc = tc_get_link(xr.sock, cfg.emulate.dev);
+	if (!xr.tc)
+		return -1;
+
+	atexit(xdp_reflect_reset);
+
+	ret = tc_clsact(xr.sock, xr.tc);
+	if (ret && ret != -NLE_EXIST)
+		error(-1, 0, "Failed to setup TC: clsact qdisc: %s", nl_geterror(ret));
+
+	ret = tc_bpf(xr.sock, xr.tc, xr.prog, "netem-reflect");
+	if (ret)
+		error(-1, 0, "Failed to setup TC: bpf filter: %s", nl_geterror(ret));
+
+	return 0;
+}
+
+int xdp_reflect(int argc, char *argv[])
+{
+	int tfd, ifindex, cpus;
+	unsigned long port = UDPPL_PORT;
+	char *endptr;
+
+	if (argc < 1 || argc > 2)
+		error(-1, 0, "usage: netem xdp-reflect IFACE [PORT]");
+
+	cfg.emulate.dev = argv[0];
+
+	ifindex = if_nametoindex(argv[0]);
+	if (!ifindex)
+		error(-1, errno, "Interface does not exist: %s", argv[0]);
+
+	if (argc == 2) {
+		port = strtoul(argv[1], &endptr, 10);
+		if (endptr == argv[1] || *endptr || port > 0xFFFF)
+			error(-1, 0, "Failed to parse port: %s", argv[1]);
+	}
+
+	cpus = bpf_num_cpus();
+
+	xr.stats = bpf_map_create(BPF_MAP_TYPE_PERCPU_ARRAY, sizeof(int), sizeof(struct xdp_reflect_stats), 1);
+	if (xr.stats < 0)
+		error(-1, errno, "Failed to create counter map");
+
+	xr.clock = bpf_map_create(BPF_MAP_TYPE_ARRAY, sizeof(int), sizeof(uint64_t), 1);
+	if (xr.clock < 0)
+		error(-1, errno, "Failed to create clock map");
+
+	if (xdp_reflect_clock())
+		error(-1, errno, "Failed to initialize clock map");
+
+	/* Prefer the driver over generic XDP over the traffic controller */
+	xr.link = -1;
+	if (!xdp_reflect_prog(BPF_PROG_TYPE_XDP, ifindex, port)) {
+		if (!xdp_reflect_veth(argv[0]))
+			xr.link = bpf_xdp_attach(xr.prog, ifindex, XDP_FLAGS_DRV_MODE);
+
+		if (xr.link >= 0)
+			fprintf(stderr, "Reflecting probes to port %lu on %s in native XDP mode\n", port, argv[0]);
+		else {
+			xr.link = bpf_xdp_attach(xr.prog, ifindex, XDP_FLAGS_SKB_MODE);
+			if (xr.link >= 0)
+				fprintf(stderr, "Reflecting probes to port %lu on %s in generic XDP mode\n", port, argv[0]);
+		}
+
+		if (xr.link < 0)
+			close(xr.prog);
+	}
+
+	if (xr.link < 0) {
+		fprintf(stderr, "Failed to attach XDP program: %s. Falling back to tc-bpf\n", strerror(errno));
+
+		if (xdp_reflect_tc(ifindex, port))
+			error(-1, errno, "Failed to attach tc-bpf program");
+
+		fprintf(stderr, "Reflecting probes to port %lu on %s in tc-bpf mode\n", port, argv[0]);
+	}
+
+	/* Print the counters every interval */
+	if ((tfd = timerfd_init(1.0 / (cfg.emulate.interval ? cfg.emulate.interval : 1))) < 0)
+		error(-1, errno, "Failed to initilize timer");
+
+	while (timerfd_wait(tfd)) {
+		xdp_reflect_print(cpus);
+
+		if (xdp_reflect_clock())
+			error(-1, errno, "Failed to update clock map");
+	}
+
+	close(tfd);
+
+	return 0;
+}
@@ -0,0 +1,121 @@
+/** Minimal wrapper around AF_XDP sockets.
+ *
+ * We do not depend on libxdp. The UMEM and the rings are set up directly
+ * via setsockopt(2) and mmap(2).
+ *
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "xsk.h"
+
+static int xsk_ring_map(struct xsk_ring *r, int fd, struct xdp_ring_offset *off, off_t pgoff, size_t size)
+{
+	r->map_len = off->desc + XSK_RING_SIZE * size;
+	r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+	if (r->map == MAP_FAILED) {
+		r->map = NULL;
+		return -1;
+	}
+
+	r->producer = (uint32_t *) ((uint8_t *) r->map + off->producer);
+	r->consumer = (uint32_t *) ((uint8_t *) r->map + off->consumer);
+	r->descs = (uint8_t *) r->map + off->desc;
+	r->mask = XSK_RING_SIZE - 1;
+
+	return 0;
+}
+
+static void xsk_ring_unmap(struct xsk_ring *r)
+{
+	if (r->map)
+		munmap(r->map, r->map_len);
+}
+
+int xsk_init(struct xsk *x, int ifindex, int queue)
+{
+	int size = XSK_RING_SIZE;
+	struct xdp_mmap_offsets off;
+	socklen_t optlen = sizeof(off);
+
+	memset(x, 0, sizeof(struct xsk));
+
+	x->fd = socket(AF_XDP, SOCK_RAW, 0);
+	if (x->fd < 0)
+		return -1;
+
+	x->umem_len = XSK_FRAMES * XSK_FRAME_SIZE;
+	x->umem = mmap(NULL, x->umem_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (x->umem == MAP_FAILED)
+		goto fail;
+
+	struct xdp_umem_reg reg = {
+		.addr = (uintptr_t) x->umem,
+		.len = x->umem_len,
+		.chunk_size = XSK_FRAME_SIZE,
+		.headroom = 0
+	};
+
+	if (setsockopt(x->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) ||
+	    setsockopt(x->fd, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof(size)) ||
+	    setsockopt(x->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size, sizeof(size)) ||
+	    setsockopt(x->fd, SOL_XDP, XDP_RX_RING, &size, sizeof(size)) ||
+	    setsockopt(x->fd, SOL_XDP, XDP_TX_RING, &size, sizeof(size)))
+		goto fail;
+
+	if (getsockopt(x->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen))
+		goto fail;
+
+	if (xsk_ring_map(&x->rx,   x->fd, &off.rx, XDP_PGOFF_RX_RING, sizeof(struct xdp_desc)) ||
+	    xsk_ring_map(&x->tx,   x->fd, &off.tx, XDP_PGOFF_TX_RING, sizeof(struct xdp_desc)) ||
+	    xsk_ring_map(&x->fill, x->fd, &off.fr, XDP_UMEM_PGOFF_FILL_RING, sizeof(uint64_t)) ||
+	    xsk_ring_map(&x->comp, x->fd, &off.cr, XDP_UMEM_PGOFF_COMPLETION_RING, sizeof(uint64_t)))
+		goto fail;
+
+	/* Generic XDP works on every interface including veth */
+	struct sockaddr_xdp sxdp = {
+		.sxdp_family = AF_XDP,
+		.sxdp_ifindex = ifindex,
+		.sxdp_queue_id = queue,
+		.sxdp_flags = XDP_COPY
+	};
+
+	if (bind(x->fd, (struct sockaddr *) &sxdp, sizeof(sxdp)))
+		goto fail;
+
+	return 0;
+
+fail:	size = errno;
+	xsk_destroy(x);
+	errno = size;
+
+	x->fd = -1;
+
+	return -1;
+}
+
+void xsk_destroy(struct xsk *x)
+{
+	xsk_ring_unmap(&x->rx);
+	xsk_ring_unmap(&x->tx);
+	xsk_ring_unmap(&x->fill);
+	xsk_ring_unmap(&x->comp);
+
+	if (x->umem && x->umem != MAP_FAILED)
+		munmap(x->umem, x->umem_len);
+
+	memset(&x->rx, 0, 4 * sizeof(struct xsk_ring));
+	x->umem = NULL;
+
+	close(x->fd);
+}
@@ -0,0 +1,96 @@
+/** Minimal wrapper around AF_XDP sockets.
+ *
+ * @file
+ * @author Steffen Vogel <post@steffenvogel.de>
+ * @copyright 2014-2017, Steffen Vogel
+ * @license GPLv3
+ *********************************************************************************/
+
+#ifndef _XSK_H_
+#define _XSK_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <linux/if_xdp.h>
+
+/** Size of a single frame in the UMEM. */
+#define XSK_FRAME_SIZE		2048
+
+/** Number of frames in the UMEM. */
+#define XSK_FRAMES		4096
+
+/** Number of descriptors in each ring. */
+#define XSK_RING_SIZE		(XSK_FRAMES / 2)
+
+/** A single producer / single consumer ring shared with the Kernel. */
+struct xsk_ring {
+	uint32_t *producer;
+	uint32_t *consumer;
+
+	/** Array of struct xdp_desc (RX, TX) or UMEM addresses (fill, completion). */
+	void *descs;
+	uint32_t mask;
+
+	void *map;
+	size_t map_len;
+};
+
+/** An AF_XDP socket with its own UMEM. */
+struct xsk {
+	int fd;
+
+	uint8_t *umem;
+	size_t umem_len;
+
+	struct xsk_ring rx;
+	struct xsk_ring tx;
+	struct xsk_ring fill;
+	struct xsk_ring comp;
+};
+
+/** Create an AF_XDP socket and bind it to a queue of an interface in copy mode.
+ *
+ * @retval 0 Success.
+ * @retval <0 The Kernel does not support AF_XDP. errno is set accordingly.
+ */
+int xsk_init(struct xsk *x, int ifindex, int queue);
+
+/** Unmap the rings and the UMEM and close the socket. */
+void xsk_destroy(struct xsk *x);
+
+/** Number of free slots of a ring which is produced by user space (TX, fill). */
+static inline uint32_t xsk_ring_free(struct xsk_ring *r)
+{
+	return r->mask + 1 - (*r->producer - __atomic_load_n(r->consumer, __ATOMIC_ACQUIRE));
+}
+
+/** Hand n entries after the current producer index over to the Kernel. */
+static inline void xsk_ring_submit(struct xsk_ring *r, uint32_t n)
+{
+	__atomic_store_n(r->producer, *r->producer + n, __ATOMIC_RELEASE);
+}
+
+/** Number of entries of a ring which is produced by the Kernel (RX, completion). */
+static inline uint32_t xsk_ring_avail(struct xsk_ring *r)
+{
+	return __atomic_load_n(r->producer, __ATOMIC_ACQUIRE) - *r->consumer;
+}
+
+/** Return n entries after the current consumer index to the Kernel. */
+static inline void xsk_ring_release(struct xsk_ring *r, uint32_t n)
+{
+	__atomic_store_n(r->consumer, *r->consumer + n, __ATOMIC_RELEASE);
+}
+
+static inline struct xdp_desc * xsk_ring_desc(struct xsk_ring *r, uint32_t idx)
+{
+	return &((struct xdp_desc *) r->descs)[idx & r->mask];
+}
+
+static inline uint64_t * xsk_ring_addr(struct xsk_ring *r, uint32_t idx)
+{
+	return &((uint64_t *) r->descs)[idx & r->mask];
+}
+
+#endif /* _XSK_H_ */
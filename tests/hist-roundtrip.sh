@@ -0,0 +1,35 @@
+#!/bin/sh
+#
+# The binary histograms are exchanged between hosts and merged by the
+# thousands. A histogram has to survive hist_save() and hist_load() unchanged
+# and merged counts must not wrap at 32 bits. HIST holds 5e9 RTTs of 1 ms
+# in a single bucket is merged with itself.
+#
+# Usage: hist-roundtrip.sh NETEM HIST
+
+set -e
+
+NETEM=$1
+HIST=$2
+
+TMP=$(mktemp -d)
+trap 'rm -rf ${TMP}' EXIT
+
+printf 'current_rtt\n0.0001\n0.00025\n0.001\n0.001\n0.0042\n1.5\n' | ${NETEM} hist create > ${TMP}/a.hist
+
+# Loading and saving again gives the same file
+${NETEM} hist merge ${TMP}/a.hist > ${TMP}/b.hist
+cmp ${TMP}/a.hist ${TMP}/b.hist
+
+${NETEM} hist print ${TMP}/a.hist | grep -q '^Total: 6 values$'
+
+# Merging doubles all counts but keeps the percentiles
+${NETEM} hist merge ${TMP}/a.hist ${TMP}/a.hist > ${TMP}/c.hist
+${NETEM} hist print ${TMP}/c.hist | grep -q '^Total: 12 values$'
+[ "$(${NETEM} hist print ${TMP}/a.hist | grep '^Percentiles')" = "$(${NETEM} hist print ${TMP}/c.hist | grep '^Percentiles')" ]
+
+${NETEM} hist print ${HIST} | grep -q '^Total: 5000000000 values$'
+
+${NETEM} hist merge ${HIST} ${HIST} > ${TMP}/d.hist
+${NETEM} hist print ${TMP}/d.hist | grep -q '^Total: 10000000000 values$'
+${NETEM} hist print ${TMP}/d.hist | grep -q '^Matlab data: \[ .* 10000000000 \]$'
@@ -0,0 +1,23 @@
+#!/bin/sh
+#
+# RTT samples from TCP timestamps must not shrink if the RTT is shorter than the
+# tick of the TSval. The capture has three ticks with an RTT of 200 us each. After
+# the first ACK, more segments with the same TSval are sent and the peer answers
+# with data which echoes that TSval 10 us later.
+#
+# Usage: observe-tsval.sh NETEM CAPTURE
+
+set -e
+
+NETEM=$1
+CAPTURE=$2
+
+SAMPLES=$(${NETEM} --pcap ${CAPTURE} probe 2>/dev/null | grep -v '^#' | cut -d, -f1)
+
+echo "${SAMPLES}"
+
+[ "$(echo "${SAMPLES}" | wc -l)" -eq 3 ]
+
+for RTT in ${SAMPLES}; do
+	awk -v rtt=${RTT} 'BEGIN { exit !(rtt > 1.9e-4 && rtt < 2.1e-4) }'
+done